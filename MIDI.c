@@ -37,9 +37,30 @@
 
 #include "MIDI.h"
 #include "avr-midi/midi.h"
+#include "usb_fifo.h"
+#include "scheduler.h"
+#include "debounce.h"
+#include "input_map.h"
+#include "sysex.h"
+#include "encoder.h"
+#include "spi_link.h"
+#include "expander.h"
+#include "tiny_isp.h"
+#include "control.h"
+#include "bootloader/bootloader.h"
+#ifdef MATRIX_ENABLE
+#include "matrix.h"
+#endif
 #include <util/delay.h>
+#include <avr/pgmspace.h>
+
+//the ports our digital inputs live on, as handed to the debouncer
+#define DIGITAL_PORT_C 0
+#define DIGITAL_PORT_D 1
+#define DIGITAL_NONE 0xFF
 
-#define NUM_DIGITAL_INS 4
+//most bytes we parse from each device per pass of the main loop
+#define MIDI_PROCESS_BUDGET 32
 
 #define LED_1 PORTC2
 #define LED_2 PORTC4
@@ -53,17 +74,39 @@
 #define SYS_COMMON_3 0x30
 
 #define TINY_RESET PINB5
-
-#define DDR_SPI DDRB
-#define DD_SS PINB0
-#define DD_SCK PINB1
-#define DD_MOSI PINB2
-#define DD_MISO PINB3
 #define TINY_SS PINB4
 
 //we have 2 midi devices, the usb one and the serial midi one
 MidiDevice midi_device_usb;
 MidiDevice midi_device_serial;
+//their input queues, sized for each in the makefile [see avr-midi/midi_config.h]
+static uint8_t midi_queue_usb[MIDI_USB_QUEUE_LENGTH];
+static uint8_t midi_queue_serial[MIDI_SERIAL_QUEUE_LENGTH];
+
+//serial output waits here for the uart, which takes a byte every 320us, so
+//the main loop doesn't have to
+#define MIDI_SERIAL_TX_LENGTH 64
+static uint8_t midi_serial_tx_data[MIDI_SERIAL_TX_LENGTH];
+static byteQueue_t midi_serial_tx;
+//the uart gives us a byte at a time, these are put together into whole
+//messages before they're queued
+static midi_input_framer_t midi_serial_framer;
+
+//which digital input each debounced port bit is, DIGITAL_NONE if unused
+const uint8_t digital_input_index[DEBOUNCE_PORTS][8] PROGMEM = {
+   //PORTC, TIN1 on PC7
+   {DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE,
+      DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE, 1},
+#ifndef MATRIX_ENABLE
+   //PORTD, HD1-3 on PD6, PD4, PD5
+   {DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE,
+      2, 3, 0, DIGITAL_NONE}
+#else
+   //PORTD is the matrix columns
+   {DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE,
+      DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE, DIGITAL_NONE}
+#endif
+};
 
 /** LUFA MIDI Class driver interface configuration and state information. This structure is
  *  passed to all MIDI Class driver functions, so that multiple instances of the same class
@@ -91,30 +134,95 @@ USB_ClassInfo_MIDI_Device_t USB_MIDI_Interface =
 #define MIDI_IN_GET_BYTE UDR1
 #define MIDI_CLOCK_16MHZ_OSC 31
 
+ISR(TIMER0_COMPA_vect) {
+   sched_tick();
+   //sample the input ports at a fixed rate, our inputs have pullups so they
+   //are active low
+   debounce_sample(DIGITAL_PORT_C, ~PINC);
+#ifndef MATRIX_ENABLE
+   debounce_sample(DIGITAL_PORT_D, ~PIND);
+#endif
+}
+
+//the uart is ready for another byte
+ISR(USART1_UDRE_vect) {
+   if (bytequeue_length(&midi_serial_tx)) {
+      UDR1 = bytequeue_get(&midi_serial_tx, 0);
+      bytequeue_remove(&midi_serial_tx, 1);
+   }
+   if (!bytequeue_length(&midi_serial_tx))
+      UCSR1B &= ~_BV(UDRIE1);
+}
+
 MIDI_IN_ISR {
    uint8_t b = MIDI_IN_GET_BYTE;
 
-   midi_device_input(&midi_device_serial, 1, b, 0, 0);
+   midi_device_input_byte(&midi_device_serial, &midi_serial_framer, b);
 
    if(b & MIDI_STATUSMASK)
       PORTC ^= _BV(LED_1);
 }
 
 
+//the cin of a usb midi packet holding a message [or 3 bytes of sysex] as
+//our devices hand them out
+static uint8_t usb_cin(uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   uint8_t last = (count == 3) ? byte2 : ((count == 2) ? byte1 : byte0);
+
+   //channel messages
+   if (midi_is_statusbyte(byte0) && byte0 < SYSEX_BEGIN)
+      return byte0 >> 4;
+   if (last == SYSEX_END && count)
+      return 0x4 + count;
+   if (byte0 == SYSEX_BEGIN || !midi_is_statusbyte(byte0))
+      return 0x4;
+   if (midi_is_realtime(byte0))
+      return 0xF;
+   //system common
+   return (count == 1) ? 0x5 : count;
+}
+
 void midi_send_usb(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
-   //we ignore count because usb midi always sends 4 bytes
+   //usb midi always sends 4 bytes, the cin says how many are used
    MIDI_EventPacket_t packet;
    packet.CableNumber = 0;
-   packet.Command = (byte0 >> 4);
+   packet.Command = usb_cin(count, byte0, byte1, byte2);
    packet.Data1 = byte0;
    packet.Data2 = byte1;
    packet.Data3 = byte2;
-   MIDI_Device_SendEventPacket(&USB_MIDI_Interface, &packet);
-   MIDI_Device_Flush(&USB_MIDI_Interface);
+   //queue it, the main loop sends it when the host is ready for it, this way
+   //a host that isn't reading can't stall us
+   usb_fifo_push(&packet);
 }
 
+//our sysex replies come ready packetized, the cin says how much of the
+//packet is used
+void sysex_output_usb(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   MIDI_EventPacket_t packet;
+   packet.CableNumber = 0;
+   packet.Command = cin;
+   packet.Data1 = byte0;
+   packet.Data2 = byte1;
+   packet.Data3 = byte2;
+   usb_fifo_push(&packet);
+}
+
+#ifdef MATRIX_ENABLE
+static void midi_send_none(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+}
+#endif
+
 void midi_init_device_serial(MidiDevice * device) {
-   midi_init_device(device);
+   midi_init_device_queue(device, midi_queue_serial, MIDI_SERIAL_QUEUE_LENGTH);
+   bytequeue_init(&midi_serial_tx, midi_serial_tx_data, MIDI_SERIAL_TX_LENGTH);
+   midi_input_framer_init(&midi_serial_framer);
+
+#ifdef MATRIX_ENABLE
+   //the uart pins [PD2/PD3] are matrix columns, so there is no serial midi in
+   //matrix builds: the uart stays off and what is sent to it goes nowhere
+   midi_device_set_send_func(device, midi_send_none);
+   return;
+#endif
 
    uint16_t clockScale = MIDI_CLOCK_16MHZ_OSC;
    UBRR1H = (uint8_t)(clockScale >> 8);
@@ -130,6 +238,20 @@ void midi_init_device_serial(MidiDevice * device) {
    UCSR1C = _BV(UCSZ11) | _BV(UCSZ10);
 }
 
+//queue a byte for the uart, if the queue is full we wait for the udre
+//interrupt to make room
+static void midi_serial_put(uint8_t b) {
+   while (!bytequeue_enqueue(&midi_serial_tx, b))
+      UCSR1B |= _BV(UDRIE1);
+}
+
+//the uart just sends bytes, so a whole span goes into the queue as it is
+void midi_send_serial_buffer(MidiDevice * device, const uint8_t * data, uint16_t length) {
+   while (length--)
+      midi_serial_put(*data++);
+   UCSR1B |= _BV(UDRIE1);
+}
+
 void midi_send_serial(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
    uint8_t out[3];
    out[0] = byte0;
@@ -138,136 +260,191 @@ void midi_send_serial(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t
    if (count > 3)
       count = 3;
 
-   uint8_t i;
-   for(i = 0; i < count; i++) {
-      while ( !( UCSR1A & _BV(UDRE1)) );
-      UDR1 = out[i];
-   }
+   midi_send_serial_buffer(device, out, count);
 }
 
-void midi_merge_usb_to_serial(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
-   midi_send_data(&midi_device_serial, count, byte0, byte1, byte2);
+//echo everything from each device to the other one
+void midi_merge(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   if (device == &midi_device_usb)
+      midi_send_data(&midi_device_serial, count, byte0, byte1, byte2);
+   else
+      midi_send_data(&midi_device_usb, count, byte0, byte1, byte2);
 }
 
-void midi_merge_serial_to_usb(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
-   midi_send_data(&midi_device_usb, count, byte0, byte1, byte2);
-}
+#if MIDI_OPS_TABLE
+//both devices share their callbacks, and the table lives in flash
+static const MidiDeviceOps midi_merge_ops MIDI_OPS_PROGMEM = {
+   .catchall = midi_merge,
+};
+#endif
 
-/** Main program entry point. This routine contains the overall program flow, including initial
- *  setup of all components and the main program loop.
- */
-int main(void)
-{
-   uint8_t i;
-   uint8_t digital_in[NUM_DIGITAL_INS];
-   bool digital_last[NUM_DIGITAL_INS];
+//hand over to the bootloader to update our firmware, this doesn't return
+void enter_bootloader(void) {
+   USB_ShutDown();
+   cli();
+   //the bootloader finds this after the watchdog reset
+   *BOOT_KEY_ADDRESS = BOOT_KEY;
+   wdt_enable(WDTO_15MS);
+   for (;;)
+      ;
+}
 
-   SetupHardware();
+void sysex_command(uint8_t command, const uint8_t * data, uint8_t length) {
+   switch (command) {
+      case SYSEX_CMD_MAP_SET:
+         if (length == 1 + sizeof(input_map_entry_t))
+            input_map_set(data[0], (const input_map_entry_t *)(data + 1));
+         break;
+      case SYSEX_CMD_MAP_SAVE:
+         //this waits on the eeprom, but it only happens when asked for
+         input_map_save();
+         break;
+      case SYSEX_CMD_MAP_RESET:
+         input_map_reset();
+         break;
+#ifndef MATRIX_ENABLE
+      case SYSEX_CMD_TINY_BEGIN:
+      case SYSEX_CMD_TINY_DATA:
+      case SYSEX_CMD_TINY_END:
+      case SYSEX_CMD_TINY_ABORT:
+         tiny_isp_command(command, data, length);
+         break;
+#endif
+      case SYSEX_CMD_BOOT_ENTER:
+         enter_bootloader();
+         break;
+      case SYSEX_CMD_CTL_STATS:
+      case SYSEX_CMD_CTL_MAP_READ:
+      case SYSEX_CMD_CTL_MAP_WRITE:
+      case SYSEX_CMD_CTL_HISTOGRAM:
+      case SYSEX_CMD_CTL_PANIC:
+         control_command(command, data, length);
+         break;
+      default:
+         break;
+   }
+}
 
-   //init the digital inputs
-   for(i = 0; i < NUM_DIGITAL_INS; i++){
-      digital_in[i] = 0;
-      digital_last[i] = false;
+void digital_input_task(void) {
+   uint8_t port;
+
+   //the debouncer hands us a mask of changed bits per port, we only do any
+   //work for the bits that are set
+   for(port = 0; port < DEBOUNCE_PORTS; port++){
+      uint8_t changes = debounce_changes(port);
+      uint8_t state, bit;
+      if (!changes)
+         continue;
+      state = debounce_state(port);
+      for(bit = 0; changes; bit++, changes >>= 1, state >>= 1){
+         uint8_t input;
+         if (!(changes & 0x1))
+            continue;
+         input = pgm_read_byte(&digital_input_index[port][bit]);
+         if (input != DIGITAL_NONE)
+            input_map_event(INPUT_MAP_DIGITAL(input), state & 0x1);
+      }
    }
+}
 
-   sei();
+//the usb fifo mustn't merge the ccs of relative encoders, every one counts
+static bool usb_keep_cc(uint8_t status, uint8_t num) {
+   return input_map_relative_cc(status & MIDI_CHANMASK, num);
+}
+
+//if the usb output is backing up the input map holds encoder messages for
+//it, the serial port still gets them
+static bool usb_backed_up(void) {
+   return usb_fifo_length() > USB_FIFO_LENGTH / 2;
+}
 
-#if 0
-   //THIS DOESNT WORK YET
-   while(1){
-      while(!(SPSR & (1<<SPIF))){ ; }
-      uint8_t val = SPDR;
-      SendUSBMIDICC( &USB_MIDI_Interface, 1, val & 0x7F, 1, 0);
-      MIDI_Device_USBTask(&USB_MIDI_Interface);
-      USB_USBTask();
+void encoder_task(void) {
+   uint8_t i;
+   for(i = 0; i < ENCODER_NUM; i++)
+      input_map_delta(INPUT_MAP_ENCODER(i), encoder_take(i));
+}
+
+//the bytes used by a usb midi packet, by its cin.  Sysex [and the single
+//byte cin, which is mostly the end of one] is only for us, it isn't passed
+//on to the serial port
+static midi_packet_length_t usb_packet_length(uint8_t cin) {
+   switch (cin) {
+      case 0x2:
+      case 0xC:
+      case 0xD:
+         return TWO;
+      case 0x3:
+      case 0x8:
+      case 0x9:
+      case 0xA:
+      case 0xB:
+      case 0xE:
+         return THREE;
+      case 0xF:
+         return ONE;
+      default:
+         return UNDEFINED;
+   }
+}
 
+void usb_receive_task(void) {
+   MIDI_EventPacket_t ReceivedMIDIEvent;
+   if (MIDI_Device_ReceiveEventPacket(&USB_MIDI_Interface, &ReceivedMIDIEvent)) {
+      //to process the usb midi input we first get its packet length and
+      //then pass the bytes through our device
+      midi_packet_length_t packet_len = usb_packet_length(ReceivedMIDIEvent.Command);
+      //look for sysex meant for us
+      sysex_usb_input(ReceivedMIDIEvent.Command,
+            ReceivedMIDIEvent.Data1, ReceivedMIDIEvent.Data2, ReceivedMIDIEvent.Data3);
+      if (packet_len != UNDEFINED)
+         midi_device_input(&midi_device_usb, packet_len, 
+               ReceivedMIDIEvent.Data1, ReceivedMIDIEvent.Data2, ReceivedMIDIEvent.Data3);
       //indicate that we got a packet
       PORTC ^= _BV(LED_2);
    }
+}
 
+void midi_process_task(void) {
+   //run the processing functions, bounded so a burst of input can't starve
+   //the other tasks, whatever is left waits in the queue for the next pass
+   midi_process_limited(&midi_device_usb, MIDI_PROCESS_BUDGET);
+   midi_process_limited(&midi_device_serial, MIDI_PROCESS_BUDGET);
+}
 
-   while(1){
-      //select the tiny select
-      PORTB &= ~(_BV(TINY_SS));
-      _delay_ms(1);
-      _delay_ms(50);
-
-      //send bogus data
-      SPDR = 1;
-      /* Wait for reception complete */
-      while(!(SPSR & (1<<SPIF))){
-         ;
-      }
-      uint8_t val = SPDR;
+void usb_task(void) {
+   //send whatever usb output the host has room for
+   usb_fifo_service(&USB_MIDI_Interface);
 
-      SendUSBMIDICC( &USB_MIDI_Interface, 1, val & 0x7F, 1, 0);
-      MIDI_Device_USBTask(&USB_MIDI_Interface);
-      USB_USBTask();
+   MIDI_Device_USBTask(&USB_MIDI_Interface);
+   USB_USBTask();
+}
 
-      //indicate that we got a packet
-      PORTC ^= _BV(LED_2);
+/** Main program entry point. This routine contains the overall program flow, including initial
+ *  setup of all components and the main program loop.
+ */
+int main(void)
+{
+   SetupHardware();
 
-      //select the tiny select
-      PORTB |= _BV(TINY_SS);
-      _delay_ms(50);
-   }
+   //set up our tasks, in the order they run in each pass
+   sched_add_task(digital_input_task, 1, SCHED_US(50));
+#ifdef MATRIX_ENABLE
+   sched_add_task(matrix_task, 1, SCHED_US(500));
+#else
+   sched_add_task(encoder_task, 5, SCHED_US(100));
+   sched_add_task(spi_link_service, 0, SCHED_US(300));
+   sched_add_task(expander_task, SPI_LINK_POLL_MIN, SCHED_US(20));
+   sched_add_task(tiny_isp_task, 0, SCHED_US(1200));
 #endif
+   sched_add_task(usb_receive_task, 0, SCHED_US(100));
+   sched_add_task(midi_process_task, 0, SCHED_US(2000));
+   sched_add_task(control_task, 0, SCHED_US(300));
+   sched_add_task(usb_task, 0, SCHED_US(500));
 
-   for (;;)
-   {
-      //shift the guys up
-      for(i = 0; i < NUM_DIGITAL_INS; i++)
-         digital_in[i] = digital_in[i] << 1;
-
-      //read the inputs
-      if(PIND & _BV(PIND6))
-         digital_in[0] |= 0x1;
-      if(PINC & _BV(PINC7))
-         digital_in[1] |= 0x1;
-      if(PIND & _BV(PIND4))
-         digital_in[2] |= 0x1;
-      if(PIND & _BV(PIND5))
-         digital_in[3] |= 0x1;
-
-      //check the inputs
-      for(i = 0; i < NUM_DIGITAL_INS; i++){
-         if(digital_in[i] == 0) {
-            if(digital_last[i] == true){
-               //send on to both midi devices
-               midi_send_cc(&midi_device_usb, 15, i, 127);
-               midi_send_cc(&midi_device_serial, 15, i, 127);
-            }
-            digital_last[i] = false;
-         } else if (digital_in[i] == 0xFF) {
-            if(digital_last[i] == false){
-               //send off to both midi devices
-               midi_send_cc(&midi_device_usb, 15, i, 0);
-               midi_send_cc(&midi_device_serial, 15, i, 0);
-            }
-            digital_last[i] = true;
-         }
-      }
-
-      MIDI_EventPacket_t ReceivedMIDIEvent;
-      if (MIDI_Device_ReceiveEventPacket(&USB_MIDI_Interface, &ReceivedMIDIEvent)) {
-         //to process the usb midi input we first get its packet length and
-         //then pass the bytes through our device
-         midi_packet_length_t packet_len = midi_packet_length(ReceivedMIDIEvent.Command << 4);
-         //TODO SYSEX
-         if (packet_len != UNDEFINED)
-            midi_device_input(&midi_device_usb, packet_len, 
-                  ReceivedMIDIEvent.Data1, ReceivedMIDIEvent.Data2, ReceivedMIDIEvent.Data3);
-         //indicate that we got a packet
-         PORTC ^= _BV(LED_2);
-      }
-
-      //run the processing functions
-      midi_process(&midi_device_usb);
-      midi_process(&midi_device_serial);
+   sei();
 
-      MIDI_Device_USBTask(&USB_MIDI_Interface);
-      USB_USBTask();
-   }
+   for (;;)
+      sched_run();
 }
 
 /** Configures the board hardware and chip peripherals for the demo's functionality. */
@@ -287,45 +464,77 @@ void SetupHardware(void)
 
    /* Hardware Initialization */
    USB_Init();
+   sched_init();
 
    //initialize our midi devices
-   midi_init_device(&midi_device_usb);
+   usb_fifo_init(USB_FIFO_COALESCE_CC);
+   midi_init_device_queue(&midi_device_usb, midi_queue_usb, MIDI_USB_QUEUE_LENGTH);
    midi_init_device_serial(&midi_device_serial);
 
    //set our output funcs
    midi_device_set_send_func(&midi_device_usb, midi_send_usb);
+#ifndef MATRIX_ENABLE
    midi_device_set_send_func(&midi_device_serial, midi_send_serial);
+   midi_device_set_send_buffer_func(&midi_device_serial, midi_send_serial_buffer);
+#endif
 
    //set our catchall callbacks for echoing
-   midi_register_catchall_callback(&midi_device_usb, midi_merge_usb_to_serial);
-   midi_register_catchall_callback(&midi_device_serial, midi_merge_serial_to_usb);
-
-   //spi
-   //PRR0 &= ~(_BV(PRSPI));
-   ///* Set SS, MOSI, SCK, TINY_SS, TINY_RESET to output, all others input */
-   //DDR_SPI = _BV(DD_SS) | _BV(DD_SCK) | _BV(DD_MOSI) | _BV(DD_SCK) | _BV(TINY_SS) | _BV(TINY_RESET) ;
-
-   DDR_SPI = _BV(DD_SS) | _BV(TINY_RESET) | _BV(DD_MISO);
+#if MIDI_OPS_TABLE
+   midi_device_set_ops(&midi_device_usb, &midi_merge_ops);
+   midi_device_set_ops(&midi_device_serial, &midi_merge_ops);
+#else
+   midi_register_catchall_callback(&midi_device_usb, midi_merge);
+   midi_register_catchall_callback(&midi_device_serial, midi_merge);
+#endif
 
-   //reset the tiny
+   //our inputs send through the mapping table, which can be edited over sysex
+   input_map_init();
+   input_map_set_dest(0, &midi_device_usb);
+   input_map_set_dest(1, &midi_device_serial);
+   input_map_set_dest_busy(0, usb_backed_up);
+   usb_fifo_set_keep_func(usb_keep_cc);
+   sysex_init(sysex_command);
+   sysex_set_output(sysex_output_usb);
+   //runtime queries and panic, also over sysex
+   control_init();
+   control_set_dest(0, &midi_device_usb);
+   control_set_dest(1, &midi_device_serial);
+
+#ifndef MATRIX_ENABLE
+   //reset the tiny, then talk to it over spi [the matrix uses these pins]
+   DDRB |= _BV(TINY_RESET);
    PORTB &= ~(_BV(TINY_RESET));
    _delay_ms(2);
-   //PORTB |= _BV(TINY_RESET);
+   PORTB |= _BV(TINY_RESET);
+   spi_link_init();
+   //the tiny48 on the board, more expanders get their own select lines
+   spi_link_add_slave(&PORTB, &DDRB, TINY_SS);
+   //the tiny48 scans most of our inputs and reports changes over the link
+   expander_init();
+#endif
 
-   /* Enable SPI, Master, set clock rate fck/64 */
-   //SPCR = (1<<SPE) | (1<<MSTR) | (1<<SPR1);
-   //SPCR = (1<<SPE);
+   //set inputs with pullups
 
+#ifndef MATRIX_ENABLE
+   //encoders, these set up their own pins and pin change interrupts [the
+   //matrix rows drive PB6/PB7, encoder 0's pins]
+   encoder_init();
+#endif
 
-   //set inputs with pullups
+#ifdef MATRIX_ENABLE
+   //key matrix, notes from 36 [C2] up on channel 1
+   matrix_init(&midi_device_usb, 0, 36);
+#endif
 
    //TIN1
    DDRC &= ~(_BV(PINC7));
    PORTC |= _BV(PINC7);
 
-   //HD1-3
+#ifndef MATRIX_ENABLE
+   //HD1-3 [matrix columns in matrix builds]
    DDRD &= ~(_BV(PIND6) | _BV(PIND5) | _BV(PIND4));
    PORTD |= (_BV(PIND6) | _BV(PIND5) | _BV(PIND4));
+#endif
 }
 
 /** Event handler for the library USB Connection event. */
@@ -0,0 +1,311 @@
+//parser throughput, the C parser [midi_process_buffer and the host
+//scanner, midi_scan_process] next to midi::Parser
+//
+//both parse the same generated stream: notes with running status, cc,
+//pitchbend, program changes, clock in the middle of messages and now and
+//then a sysex.  Each counts the messages it gets and sums their bytes, the
+//two have to agree or the numbers mean nothing.
+//
+//with dense the stream is long controller, aftertouch and pitchbend sweeps
+//in running status with a clock about every 20 messages instead, like a
+//capture of a busy serial port.
+//
+//or give it a capture [see host/midi_capture.h], its records go to the
+//parsers straight from the mapped file.
+//
+//or the fuzz corpus [test/corpus, see test/parser_fuzz.c], its cases one
+//after the other, over and over to make a megabyte.  Those are the streams
+//the parsers have got wrong before, so the three have to agree on them too.
+//
+//   ./bench [megabytes|capture|corpus directory] [passes] [dense]
+
+#include "midi_parser.hpp"
+extern "C" {
+#include "midi_scan.h"
+#include "midi_capture.h"
+}
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+struct Totals {
+   uint64_t messages;
+   uint64_t notes;
+   uint64_t sum;
+
+   bool operator==(const Totals & other) const {
+      return messages == other.messages && notes == other.notes && sum == other.sum;
+   }
+};
+
+Totals c_totals;
+
+void c_catchall(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   c_totals.messages++;
+   c_totals.sum += cnt + byte0 + byte1 + byte2;
+}
+
+void c_noteon(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   c_totals.notes++;
+}
+
+struct CountHandler : midi::Handler {
+   Totals totals;
+
+   void noteon(uint8_t, uint8_t, uint8_t) {
+      totals.notes++;
+   }
+   void catchall(uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+      totals.messages++;
+      totals.sum += cnt + byte0 + byte1 + byte2;
+   }
+};
+
+//xorshift, so every run parses the same stream
+uint32_t rand_state = 0x12345678;
+uint32_t next_rand() {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+std::vector<uint8_t> make_stream(size_t size) {
+   std::vector<uint8_t> out;
+   uint8_t running = 0;
+
+   out.reserve(size + 64);
+   while (out.size() < size) {
+      uint32_t r = next_rand();
+      uint8_t chan = r & 0x0F;
+      uint8_t a = (r >> 8) & 0x7F;
+      uint8_t b = (r >> 16) & 0x7F;
+
+      switch ((r >> 24) % 16) {
+         case 0: case 1: case 2: case 3: case 4: case 5:
+            //notes, mostly running status
+            if (running != (MIDI_NOTEON | chan) || (r & 0x80)) {
+               running = MIDI_NOTEON | chan;
+               out.push_back(running);
+            }
+            out.push_back(a);
+            if (r & 0x40)
+               out.push_back(MIDI_CLOCK);
+            out.push_back(b);
+            break;
+         case 6: case 7: case 8:
+            running = MIDI_CC | chan;
+            out.push_back(running);
+            out.push_back(a);
+            out.push_back(b);
+            break;
+         case 9: case 10:
+            running = MIDI_PITCHBEND | chan;
+            out.push_back(running);
+            out.push_back(a);
+            out.push_back(b);
+            break;
+         case 11:
+            running = MIDI_PROGCHANGE | chan;
+            out.push_back(running);
+            out.push_back(a);
+            break;
+         case 12: case 13: case 14:
+            out.push_back(MIDI_CLOCK);
+            break;
+         default:
+            {
+               uint8_t i, n = 4 + (a & 0x1F);
+               running = 0;
+               out.push_back(SYSEX_BEGIN);
+               out.push_back(SYSEX_EDUMANUFID);
+               for (i = 0; i < n; i++)
+                  out.push_back(next_rand() & 0x7F);
+               out.push_back(SYSEX_END);
+            }
+            break;
+      }
+   }
+   return out;
+}
+
+std::vector<uint8_t> make_dense_stream(size_t size) {
+   std::vector<uint8_t> out;
+
+   out.reserve(size + 1024);
+   while (out.size() < size) {
+      uint32_t r = next_rand();
+      static const uint8_t kinds[] = {MIDI_CC, MIDI_AFTERTOUCH, MIDI_PITCHBEND, MIDI_CHANPRESSURE};
+      uint8_t status = kinds[r & 0x03] | ((r >> 2) & 0x0F);
+      uint8_t length = midi_packet_length(status);
+      int i, n = 20 + (r >> 8) % 200;
+
+      out.push_back(status);
+      for (i = 0; i < n; i++) {
+         r = next_rand();
+         out.push_back(r & 0x7F);
+         if (length == 3)
+            out.push_back((r >> 8) & 0x7F);
+         if (!((r >> 16) % 20))
+            out.push_back(MIDI_CLOCK);
+      }
+   }
+   return out;
+}
+
+//every file in a directory, one after the other
+bool read_corpus(const char * path, std::vector<uint8_t> & out) {
+   DIR * dir = opendir(path);
+   if (!dir)
+      return false;
+   while (struct dirent * entry = readdir(dir)) {
+      char name[1024];
+      uint8_t data[4096];
+      size_t got;
+      if (entry->d_name[0] == '.')
+         continue;
+      snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+      FILE * file = fopen(name, "rb");
+      if (!file)
+         continue;
+      while ((got = fread(data, 1, sizeof(data), file)))
+         out.insert(out.end(), data, data + got);
+      fclose(file);
+   }
+   closedir(dir);
+   return !out.empty();
+}
+
+double now() {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+//the input, generated or a capture
+struct Input {
+   std::vector<uint8_t> stream;
+   midi_capture_t capture;
+   bool from_capture;
+   size_t bytes;
+
+   //call f with each span of the input in turn
+   template <typename F>
+   void each(F f) const {
+      if (!from_capture) {
+         f(stream.data(), stream.size());
+         return;
+      }
+      midi_capture_cursor_t cursor;
+      uint64_t time;
+      const uint8_t * data;
+      size_t length;
+      midi_capture_rewind(&cursor, &capture);
+      while (midi_capture_next(&cursor, &time, &data, &length))
+         f(data, length);
+   }
+};
+
+void report(const char * name, double seconds, size_t bytes, const Totals & totals) {
+   printf("%-12s %8.1f MB/s %8.2f M messages/s\n", name,
+         bytes / seconds / 1e6, totals.messages / seconds / 1e6);
+}
+
+}
+
+int main(int argc, char * argv[]) {
+   const char * source = (argc > 1) ? argv[1] : "64";
+   int passes = (argc > 2) ? atoi(argv[2]) : 3;
+   bool dense = (argc > 3) && strcmp(argv[3], "dense") == 0;
+   Input input = {};
+   double c_best = 0, scan_best = 0, cpp_best = 0;
+   Totals byte_totals = {}, scan_totals = {}, cpp_totals = {};
+   MidiDevice device;
+   int pass;
+
+   struct stat info;
+   if (stat(source, &info) == 0 && S_ISDIR(info.st_mode)) {
+      std::vector<uint8_t> corpus;
+      if (!read_corpus(source, corpus)) {
+         fprintf(stderr, "%s: nothing in the corpus\n", source);
+         return 1;
+      }
+      while (input.stream.size() < (1 << 20))
+         input.stream.insert(input.stream.end(), corpus.begin(), corpus.end());
+      input.bytes = input.stream.size();
+   } else if (source[strspn(source, "0123456789")]) {
+      if (!midi_capture_open(&input.capture, source)) {
+         fprintf(stderr, "%s: not a capture\n", source);
+         return 1;
+      }
+      input.from_capture = true;
+      input.each([&](const uint8_t *, size_t length) { input.bytes += length; });
+   } else {
+      size_t megabytes = strtoul(source, NULL, 0);
+      input.stream = dense ? make_dense_stream(megabytes << 20) : make_stream(megabytes << 20);
+      input.bytes = input.stream.size();
+   }
+
+   printf("%zu bytes, best of %d passes\n", input.bytes, passes);
+
+   for (pass = 0; pass < passes; pass++) {
+      double start;
+
+      memset(&c_totals, 0, sizeof(c_totals));
+      midi_init_device(&device);
+      midi_register_noteon_callback(&device, c_noteon);
+      midi_register_catchall_callback(&device, c_catchall);
+      start = now();
+      input.each([&](const uint8_t * data, size_t length) { midi_process_buffer(&device, data, length); });
+      start = now() - start;
+      if (!pass || start < c_best)
+         c_best = start;
+      byte_totals = c_totals;
+
+      memset(&c_totals, 0, sizeof(c_totals));
+      midi_init_device(&device);
+      midi_register_noteon_callback(&device, c_noteon);
+      midi_register_catchall_callback(&device, c_catchall);
+      start = now();
+      input.each([&](const uint8_t * data, size_t length) { midi_scan_process(&device, data, length); });
+      start = now() - start;
+      if (!pass || start < scan_best)
+         scan_best = start;
+      scan_totals = c_totals;
+
+      CountHandler handler = {};
+      midi::Parser<CountHandler> parser(handler);
+      start = now();
+      input.each([&](const uint8_t * data, size_t length) { parser.process(data, length); });
+      start = now() - start;
+      if (!pass || start < cpp_best)
+         cpp_best = start;
+      cpp_totals = handler.totals;
+   }
+
+   report("C", c_best, input.bytes, byte_totals);
+   report(midi_scan_impl(), scan_best, input.bytes, scan_totals);
+   report("midi::Parser", cpp_best, input.bytes, cpp_totals);
+
+   if (!(byte_totals == scan_totals)) {
+      fprintf(stderr, "the scanner disagrees: C %llu messages %llu notes, scanned %llu messages %llu notes\n",
+            (unsigned long long)byte_totals.messages, (unsigned long long)byte_totals.notes,
+            (unsigned long long)scan_totals.messages, (unsigned long long)scan_totals.notes);
+      return 1;
+   }
+   if (!(byte_totals == cpp_totals)) {
+      fprintf(stderr, "the parsers disagree: C %llu messages %llu notes, C++ %llu messages %llu notes\n",
+            (unsigned long long)byte_totals.messages, (unsigned long long)byte_totals.notes,
+            (unsigned long long)cpp_totals.messages, (unsigned long long)cpp_totals.notes);
+      return 1;
+   }
+   if (input.from_capture)
+      midi_capture_close(&input.capture);
+   return 0;
+}
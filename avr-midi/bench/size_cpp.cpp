@@ -0,0 +1,26 @@
+//midi::Parser with the handlers firmware would use, for make sizes
+#include "midi_parser.hpp"
+
+//like the midi monster merge, everything goes to one callback
+struct Merge : midi::Handler {
+   void catchall(uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+};
+
+//only notes
+struct Notes : midi::Handler {
+   void noteon(uint8_t status, uint8_t num, uint8_t vel);
+   void noteoff(uint8_t status, uint8_t num, uint8_t vel);
+};
+
+Merge merge;
+midi::Parser<Merge> merge_parser(merge);
+Notes notes;
+midi::Parser<Notes> notes_parser(notes);
+
+void parse_merge(const uint8_t * data, size_t length) {
+   merge_parser.process(data, length);
+}
+
+void parse_notes(const uint8_t * data, size_t length) {
+   notes_parser.process(data, length);
+}
@@ -0,0 +1,169 @@
+//midi file player throughput, events a second out of midi_send_events
+//
+//makes a format 1 file with many tracks in memory: notes in running status
+//with cc and pitchbend now and then, each track on its own channel and
+//rhythm, and plays it as fast as it can with the clock jumping to each due
+//time.  The player only ever holds its tracks, never the file.
+//
+//   ./smf_bench [tracks] [events per track] [passes]
+
+#include "smf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+   uint8_t * data;
+   uint32_t length;
+} file_t;
+
+static uint64_t sent_events;
+
+static uint16_t file_read(void * context, uint32_t offset, uint8_t * data, uint16_t length) {
+   file_t * file = (file_t *)context;
+   if (offset >= file->length)
+      return 0;
+   if (length > file->length - offset)
+      length = file->length - offset;
+   memcpy(data, file->data + offset, length);
+   return length;
+}
+
+static void count_send(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   sent_events++;
+}
+
+static uint32_t rand_state = 0x2545F491;
+static uint32_t next_rand(void) {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+static uint8_t * put_be(uint8_t * out, uint32_t value, uint8_t bytes) {
+   while (bytes--)
+      *out++ = value >> (8 * bytes);
+   return out;
+}
+
+static uint8_t * put_vlq(uint8_t * out, uint32_t value) {
+   uint8_t bytes[4];
+   int n = 0;
+   do {
+      bytes[n++] = value & 0x7F;
+      value >>= 7;
+   } while (value);
+   while (n--)
+      *out++ = bytes[n] | (n ? 0x80 : 0);
+   return out;
+}
+
+static void make_file(file_t * file, uint16_t tracks, uint32_t events) {
+   //at most 4 delta bytes and 3 event bytes an event
+   uint8_t * out = file->data = malloc(14 + tracks * (8 + 7 * (size_t)events + 16));
+   uint16_t t;
+   uint32_t e;
+
+   out = put_be(out, 0x4D546864, 4);
+   out = put_be(out, 6, 4);
+   out = put_be(out, 1, 2);
+   out = put_be(out, tracks, 2);
+   out = put_be(out, 480, 2);
+
+   for (t = 0; t < tracks; t++) {
+      uint8_t * length = out + 4;
+      uint8_t * start = out + 8;
+      uint8_t chan = t & 0x0F, running = 0;
+      out = start;
+      for (e = 0; e < events; e++) {
+         uint32_t r = next_rand();
+         uint8_t status;
+         out = put_vlq(out, (t % 3 == 0) ? 120 : (r >> 20) % 240);
+         switch (r % 8) {
+            case 0:
+               status = MIDI_CC | chan;
+               break;
+            case 1:
+               status = MIDI_PITCHBEND | chan;
+               break;
+            default:
+               status = MIDI_NOTEON | chan;
+               break;
+         }
+         if (status != running)
+            *out++ = running = status;
+         *out++ = (r >> 8) & 0x7F;
+         *out++ = (r >> 16) & 0x7F;
+      }
+      *out++ = 0;
+      *out++ = 0xFF;
+      *out++ = 0x2F;
+      *out++ = 0;
+      put_be(start - 8, 0x4D54726B, 4);
+      put_be(length, out - start, 4);
+   }
+   file->length = out - file->data;
+}
+
+static double now_s(void) {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char * argv[]) {
+   uint16_t tracks = (argc > 1) ? atoi(argv[1]) : 64;
+   uint32_t events = (argc > 2) ? strtoul(argv[2], NULL, 0) : 20000;
+   int passes = (argc > 3) ? atoi(argv[3]) : 3;
+   smf_track_t * track_memory;
+   smf_player_t player;
+   MidiDevice device;
+   file_t file;
+   double best = 0;
+   int pass;
+
+   if (tracks < 1 || tracks > 255) {
+      fprintf(stderr, "1 to 255 tracks\n");
+      return 2;
+   }
+   make_file(&file, tracks, events);
+   track_memory = malloc(tracks * sizeof(smf_track_t));
+   midi_init_device(&device);
+   midi_device_set_send_func(&device, count_send);
+
+   for (pass = 0; pass < passes; pass++) {
+      double start = now_s();
+      uint32_t due;
+      sent_events = 0;
+      if (!smf_open(&player, track_memory, tracks, file_read, &file)) {
+         fprintf(stderr, "can't open the file we made\n");
+         return 1;
+      }
+      while (1) {
+         smf_fill(&player);
+         if (!smf_next_due(&player, &due))
+            break;
+         smf_send_due(&player, &device, due);
+      }
+      start = now_s() - start;
+      if (!pass || start < best)
+         best = start;
+   }
+
+   if (sent_events != (uint64_t)tracks * events) {
+      fprintf(stderr, "sent %llu events, expected %llu\n",
+            (unsigned long long)sent_events, (unsigned long long)tracks * events);
+      return 1;
+   }
+   printf("%u tracks, %llu events, %u byte file, best of %d passes\n", tracks,
+         (unsigned long long)sent_events, file.length, passes);
+   printf("player memory %zu bytes [%zu + %zu a track]\n",
+         sizeof(player) + tracks * sizeof(smf_track_t), sizeof(player), sizeof(smf_track_t));
+   printf("%.2f M events/s\n", sent_events / best / 1e6);
+
+   free(track_memory);
+   free(file.data);
+   return 0;
+}
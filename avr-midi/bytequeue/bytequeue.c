@@ -18,39 +18,106 @@
 //along with avr-bytequeue.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "bytequeue.h"
+#ifdef __AVR__
 #include <avr/interrupt.h>
+#endif
+
+//the writers' state, in one word so that it changes all at once
+#define BYTEQUEUE_END(state) ((byteQueueIndex_t)(state))
+#define BYTEQUEUE_RESERVED(state) ((byteQueueIndex_t)((state) >> 8))
+#define BYTEQUEUE_WRITERS(state) ((uint8_t)((state) >> 16))
+#define BYTEQUEUE_STATE(end, reserved, writers) \
+	((uint32_t)(end) | ((uint32_t)(reserved) << 8) | ((uint32_t)(writers) << 16))
+
+#ifdef __AVR__
+//one core, so with interrupts off nothing else can get in.  Reading the
+//state isn't atomic, but a torn read only makes the swap fail and try again.
+static bool bytequeue_swap(volatile uint32_t * state, uint32_t * expected, uint32_t desired){
+	uint8_t sreg = SREG;
+	bool same;
+	cli();
+	same = (*state == *expected);
+	if (same)
+		*state = desired;
+	else
+		*expected = *state;
+	SREG = sreg;
+	return same;
+}
+#define bytequeue_load_state(queue) ((queue)->state)
+#define bytequeue_load_start(queue) ((queue)->start)
+#define bytequeue_store_start(queue, value) ((queue)->start = (value))
+#else
+//threads on a host, the bytes of a reservation are written before it is
+//published and read before they are removed
+static bool bytequeue_swap(volatile uint32_t * state, uint32_t * expected, uint32_t desired){
+	return __atomic_compare_exchange_n(state, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#define bytequeue_load_state(queue) __atomic_load_n(&(queue)->state, __ATOMIC_ACQUIRE)
+#define bytequeue_load_start(queue) __atomic_load_n(&(queue)->start, __ATOMIC_ACQUIRE)
+#define bytequeue_store_start(queue, value) __atomic_store_n(&(queue)->start, (value), __ATOMIC_RELEASE)
+#endif
 
 void bytequeue_init(byteQueue_t * queue, uint8_t * dataArray, byteQueueIndex_t arrayLen){
 	queue->length = arrayLen;
 	queue->data = dataArray;
-	queue->start = queue->end = 0;
+	queue->start = 0;
+	queue->state = BYTEQUEUE_STATE(0, 0, 0);
 }
 
 bool bytequeue_enqueue(byteQueue_t * queue, uint8_t item){
-	uint8_t sreg = SREG;
-	cli();
-	//full
-	if(((queue->end + 1) % queue->length) == queue->start){
-		SREG = sreg;
+	byteQueueIndex_t at;
+	if (!bytequeue_reserve(queue, 1, &at))
 		return false;
-	} else {
-		queue->data[queue->end] = item;
-		queue->end = (queue->end + 1) % queue->length;
-		SREG = sreg;
-		return true;
-	}
+	queue->data[at] = item;
+	bytequeue_publish(queue);
+	return true;
+}
+
+bool bytequeue_reserve(byteQueue_t * queue, byteQueueIndex_t count, byteQueueIndex_t * at){
+	uint32_t state = bytequeue_load_state(queue);
+	uint32_t next;
+	do {
+		byteQueueIndex_t reserved = BYTEQUEUE_RESERVED(state);
+		byteQueueIndex_t start = bytequeue_load_start(queue);
+		byteQueueIndex_t used;
+		if(reserved >= start)
+			used = reserved - start;
+		else
+			used = (queue->length - start) + reserved;
+		//one byte is always left free, so that full and empty differ
+		if (count > queue->length - 1 - used)
+			return false;
+		next = BYTEQUEUE_STATE(BYTEQUEUE_END(state),
+				(reserved + count) % queue->length, BYTEQUEUE_WRITERS(state) + 1);
+		*at = reserved;
+	} while (!bytequeue_swap(&queue->state, &state, next));
+	return true;
 }
 
+void bytequeue_set(byteQueue_t * queue, byteQueueIndex_t at, byteQueueIndex_t index, uint8_t item){
+	queue->data[(at + index) % queue->length] = item;
+}
+
+void bytequeue_publish(byteQueue_t * queue){
+	uint32_t state = bytequeue_load_state(queue);
+	uint32_t next;
+	do {
+		uint8_t writers = BYTEQUEUE_WRITERS(state) - 1;
+		//the last writer out publishes everything reserved so far
+		next = BYTEQUEUE_STATE(writers ? BYTEQUEUE_END(state) : BYTEQUEUE_RESERVED(state),
+				BYTEQUEUE_RESERVED(state), writers);
+	} while (!bytequeue_swap(&queue->state, &state, next));
+}
+
+//the reader is the only one that moves start, so it can read it as it likes
 byteQueueIndex_t bytequeue_length(byteQueue_t * queue){
-	byteQueueIndex_t len;
-	uint8_t sreg = SREG;
-	cli();
-	if(queue->end >= queue->start)
-		len = queue->end - queue->start;
+	byteQueueIndex_t end = BYTEQUEUE_END(bytequeue_load_state(queue));
+	byteQueueIndex_t start = queue->start;
+	if(end >= start)
+		return end - start;
 	else
-		len = (queue->length - queue->start) + queue->end;
-	SREG = sreg;
-	return len;
+		return (queue->length - start) + end;
 }
 
 //we don't need to avoid interrupts if there is only one reader
@@ -60,9 +127,5 @@ uint8_t bytequeue_get(byteQueue_t * queue, byteQueueIndex_t index){
 
 //we just update the start index to remove elements
 void bytequeue_remove(byteQueue_t * queue, byteQueueIndex_t numToRemove){
-	uint8_t sreg = SREG;
-	cli();
-	queue->start = (queue->start + numToRemove) % queue->length;
-	SREG = sreg;
+	bytequeue_store_start(queue, (queue->start + numToRemove) % queue->length);
 }
-
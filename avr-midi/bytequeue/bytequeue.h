@@ -1,4 +1,4 @@
-//this is a single reader [maybe multiple writer?] byte queue
+//this is a single reader, multiple writer byte queue
 //Copyright 2008 Alex Norman
 //writen by Alex Norman 
 //
@@ -21,13 +21,34 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+//one reader, any number of writers: the main loop reading what interrupts
+//[which may interrupt each other] write, or on a host one thread reading
+//what others write.
+//
+//a writer reserves the bytes it needs, all at once or not at all, writes
+//them and publishes them.  Reserving and publishing are a compare and swap
+//on the writers' state, with interrupts off for it on the avr, writing is
+//done with interrupts on.  The reader sees nothing of a reservation until
+//every reservation made so far has been published, so the bytes of one
+//reservation are never mixed up with anyone else's: to the reader they
+//arrive all together, in the order they were reserved.
+//
+//a writer that interrupts another one publishes its bytes, but the reader
+//only gets them [and the interrupted writer's] once the interrupted writer
+//has published.  So hold a reservation for as short as you can, and never
+//across a wait.
+
 typedef uint8_t byteQueueIndex_t;
 
 typedef struct {
-	byteQueueIndex_t start;
-	byteQueueIndex_t end;
+	//the reader's, the first byte not yet removed
+	volatile byteQueueIndex_t start;
 	byteQueueIndex_t length;
 	uint8_t * data;
+	//the writers', all changed at once: the end of what has been published,
+	//the end of what has been reserved and how many reservations are still
+	//being written, see BYTEQUEUE_END and friends in bytequeue.c
+	volatile uint32_t state;
 } byteQueue_t;
 
 //you must have a queue, an array of data which the queue will use, and the length of that array
@@ -36,6 +57,17 @@ void bytequeue_init(byteQueue_t * queue, uint8_t * dataArray, byteQueueIndex_t a
 //add an item to the queue, returns false if the queue is full
 bool bytequeue_enqueue(byteQueue_t * queue, uint8_t item);
 
+//reserve count bytes at the end of the queue, returns false and reserves
+//nothing if there isn't room for all of them.  at is where they start, for
+//bytequeue_set, and every reservation has to be published.
+bool bytequeue_reserve(byteQueue_t * queue, byteQueueIndex_t count, byteQueueIndex_t * at);
+
+//set a byte of a reservation, index counts from its start
+void bytequeue_set(byteQueue_t * queue, byteQueueIndex_t at, byteQueueIndex_t index, uint8_t item);
+
+//done writing a reservation
+void bytequeue_publish(byteQueue_t * queue);
+
 //get the length of the queue
 byteQueueIndex_t bytequeue_length(byteQueue_t * queue);
 
@@ -46,4 +78,3 @@ uint8_t bytequeue_get(byteQueue_t * queue, byteQueueIndex_t index);
 void bytequeue_remove(byteQueue_t * queue, byteQueueIndex_t numToRemove);
 
 #endif
-
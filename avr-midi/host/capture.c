@@ -0,0 +1,177 @@
+//record, convert and look at midi captures [see midi_capture.h]
+//
+//usage: capture command...
+//
+//commands:
+//   record device file        record a midi port until interrupted
+//   import raw file [rate]    timestamp a raw byte dump as if it came in at
+//                             rate bytes a second [3125, serial midi]
+//   info file                 blocks, records, bytes and times
+//   dump file [from]          the records from time from on [microseconds]
+//
+//device is the midi port as a raw byte stream, /dev/snd/midiC1D0 for
+//instance [see amidi -l].  Each read from it becomes a record with the time
+//it returned.
+
+#include "midi_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CAPTURE_DEFAULT_RATE 3125
+
+static volatile sig_atomic_t stop;
+
+static void usage(const char * name) {
+   fprintf(stderr,
+         "usage: %s command...\n"
+         "commands:\n"
+         "   record device file\n"
+         "   import raw file [rate]\n"
+         "   info file\n"
+         "   dump file [from]\n", name);
+   exit(2);
+}
+
+static void interrupted(int sig) {
+   stop = 1;
+}
+
+static uint64_t now_us(void) {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static int record(const char * device_path, const char * path) {
+   static midi_capture_writer_t writer;
+   uint8_t data[256];
+   uint64_t start, bytes = 0;
+   int device = open(device_path, O_RDONLY);
+
+   if (device < 0) {
+      perror(device_path);
+      return 1;
+   }
+   if (!midi_capture_create(&writer, path)) {
+      perror(path);
+      return 1;
+   }
+   signal(SIGINT, interrupted);
+   signal(SIGTERM, interrupted);
+
+   start = now_us();
+   while (!stop) {
+      ssize_t got = read(device, data, sizeof(data));
+      if (got <= 0)
+         break;
+      if (!midi_capture_append(&writer, now_us() - start, data, got)) {
+         perror(path);
+         break;
+      }
+      bytes += got;
+   }
+   close(device);
+   if (!midi_capture_finish(&writer)) {
+      perror(path);
+      return 1;
+   }
+   fprintf(stderr, "%llu bytes in %.1f s\n", (unsigned long long)bytes, (now_us() - start) / 1e6);
+   return 0;
+}
+
+//a record for each status byte and the data after it
+static int import(const char * raw_path, const char * path, unsigned long rate) {
+   static midi_capture_writer_t writer;
+   uint8_t data[4096];
+   uint64_t offset = 0;
+   size_t got;
+   FILE * raw = fopen(raw_path, "rb");
+
+   if (!raw) {
+      perror(raw_path);
+      return 1;
+   }
+   if (!rate || !midi_capture_create(&writer, path)) {
+      perror(path);
+      fclose(raw);
+      return 1;
+   }
+   while ((got = fread(data, 1, sizeof(data), raw)) > 0) {
+      size_t start = 0, i;
+      for (i = 1; i <= got; i++) {
+         if (i == got || (data[i] & 0x80)) {
+            if (!midi_capture_append(&writer, (offset + start) * 1000000 / rate, data + start, i - start)) {
+               perror(path);
+               fclose(raw);
+               return 1;
+            }
+            start = i;
+         }
+      }
+      offset += got;
+   }
+   fclose(raw);
+   return midi_capture_finish(&writer) ? 0 : 1;
+}
+
+static int info(const midi_capture_t * capture) {
+   midi_capture_cursor_t cursor;
+   uint64_t time = 0, records = 0;
+   const uint8_t * data;
+   size_t length;
+
+   midi_capture_rewind(&cursor, capture);
+   while (midi_capture_next(&cursor, &time, &data, &length))
+      records++;
+   printf("block size %u, %zu blocks\n", capture->block_size, capture->blocks);
+   printf("%llu records, %llu bytes\n", (unsigned long long)records, (unsigned long long)cursor.offset);
+   printf("%.6f s to %.6f s\n", midi_capture_start(capture) / 1e6, time / 1e6);
+   return 0;
+}
+
+static int dump(const midi_capture_t * capture, uint64_t from) {
+   midi_capture_cursor_t cursor;
+   uint64_t time;
+   const uint8_t * data;
+   size_t length, i;
+
+   midi_capture_seek(&cursor, capture, from);
+   while (midi_capture_next(&cursor, &time, &data, &length)) {
+      printf("%12.6f %10llu:", time / 1e6, (unsigned long long)(cursor.offset - length));
+      for (i = 0; i < length; i++)
+         printf(" %02x", data[i]);
+      printf("\n");
+   }
+   return 0;
+}
+
+int main(int argc, char * argv[]) {
+   midi_capture_t capture;
+   int result;
+
+   if (argc < 3)
+      usage(argv[0]);
+
+   if (strcmp(argv[1], "record") == 0 && argc == 4)
+      return record(argv[2], argv[3]);
+   if (strcmp(argv[1], "import") == 0 && (argc == 4 || argc == 5))
+      return import(argv[2], argv[3], (argc == 5) ? strtoul(argv[4], NULL, 0) : CAPTURE_DEFAULT_RATE);
+
+   if (strcmp(argv[1], "info") != 0 && strcmp(argv[1], "dump") != 0)
+      usage(argv[0]);
+   if (!midi_capture_open(&capture, argv[2])) {
+      fprintf(stderr, "%s: not a capture\n", argv[2]);
+      return 1;
+   }
+   if (strcmp(argv[1], "info") == 0)
+      result = info(&capture);
+   else
+      result = dump(&capture, (argc > 3) ? strtoull(argv[3], NULL, 0) : 0);
+   midi_capture_close(&capture);
+   return result;
+}
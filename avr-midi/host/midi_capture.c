@@ -0,0 +1,295 @@
+#include "midi_capture.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint8_t midi_capture_magic[8] = {'M', 'I', 'D', 'I', 'C', 'A', 'P', 0};
+
+//the biggest record we put in a block, leaving room for the two varints
+#define MIDI_CAPTURE_MAX_CHUNK (MIDI_CAPTURE_BLOCK_SIZE - MIDI_CAPTURE_BLOCK_HEADER - 16)
+
+static void put_le(uint8_t * out, uint64_t value, uint8_t bytes) {
+   uint8_t i;
+   for (i = 0; i < bytes; i++) {
+      out[i] = value & 0xFF;
+      value >>= 8;
+   }
+}
+
+static uint64_t get_le(const uint8_t * in, uint8_t bytes) {
+   uint64_t value = 0;
+   while (bytes--)
+      value = (value << 8) | in[bytes];
+   return value;
+}
+
+static uint8_t varint_size(uint64_t value) {
+   uint8_t size = 1;
+   while (value >= 0x80) {
+      value >>= 7;
+      size++;
+   }
+   return size;
+}
+
+static uint8_t * put_varint(uint8_t * out, uint64_t value) {
+   while (value >= 0x80) {
+      *out++ = (value & 0x7F) | 0x80;
+      value >>= 7;
+   }
+   *out++ = value;
+   return out;
+}
+
+//returns NULL if the varint runs past end
+static const uint8_t * get_varint(const uint8_t * in, const uint8_t * end, uint64_t * value) {
+   uint8_t shift = 0;
+   *value = 0;
+   while (in < end && shift < 64) {
+      uint8_t b = *in++;
+      *value |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+         return in;
+      shift += 7;
+   }
+   return NULL;
+}
+
+//writing ******************
+
+bool midi_capture_create(midi_capture_writer_t * writer, const char * path) {
+   uint8_t header[MIDI_CAPTURE_FILE_HEADER];
+
+   memcpy(header, midi_capture_magic, sizeof(midi_capture_magic));
+   put_le(header + 8, MIDI_CAPTURE_VERSION, 2);
+   put_le(header + 10, 0, 2);
+   put_le(header + 12, MIDI_CAPTURE_BLOCK_SIZE, 4);
+
+   writer->used = 0;
+   writer->records = 0;
+   writer->last_time = 0;
+   writer->offset = 0;
+   writer->file = fopen(path, "wb");
+   if (!writer->file)
+      return false;
+   if (fwrite(header, sizeof(header), 1, writer->file) != 1) {
+      fclose(writer->file);
+      writer->file = NULL;
+      return false;
+   }
+   return true;
+}
+
+//write out the block, full size unless it is the last one
+static bool midi_capture_write_block(midi_capture_writer_t * writer, bool last) {
+   size_t size = MIDI_CAPTURE_BLOCK_HEADER + writer->used;
+
+   put_le(writer->block + 16, writer->used, 4);
+   put_le(writer->block + 20, writer->records, 4);
+   if (!last) {
+      memset(writer->block + size, 0, MIDI_CAPTURE_BLOCK_SIZE - size);
+      size = MIDI_CAPTURE_BLOCK_SIZE;
+   }
+   writer->used = 0;
+   writer->records = 0;
+   return fwrite(writer->block, size, 1, writer->file) == 1;
+}
+
+bool midi_capture_append(midi_capture_writer_t * writer, uint64_t time, const uint8_t * data, size_t length) {
+   if (!writer->file || time < writer->last_time)
+      return false;
+
+   while (length) {
+      size_t chunk = (length > MIDI_CAPTURE_MAX_CHUNK) ? MIDI_CAPTURE_MAX_CHUNK : length;
+      uint64_t delta = writer->records ? time - writer->last_time : 0;
+      size_t need = varint_size(delta) + varint_size(chunk) + chunk;
+      uint8_t * out;
+
+      if (writer->records && need > MIDI_CAPTURE_BLOCK_SIZE - MIDI_CAPTURE_BLOCK_HEADER - writer->used) {
+         if (!midi_capture_write_block(writer, false))
+            return false;
+         continue;
+      }
+      if (!writer->records) {
+         //a new block starts at this record
+         put_le(writer->block, time, 8);
+         put_le(writer->block + 8, writer->offset, 8);
+      }
+
+      out = writer->block + MIDI_CAPTURE_BLOCK_HEADER + writer->used;
+      out = put_varint(out, delta);
+      out = put_varint(out, chunk);
+      memcpy(out, data, chunk);
+      writer->used += need;
+      writer->records++;
+      writer->last_time = time;
+      writer->offset += chunk;
+      data += chunk;
+      length -= chunk;
+   }
+   return true;
+}
+
+bool midi_capture_finish(midi_capture_writer_t * writer) {
+   bool ok = true;
+   if (!writer->file)
+      return false;
+   if (writer->records)
+      ok = midi_capture_write_block(writer, true);
+   if (fclose(writer->file) != 0)
+      ok = false;
+   writer->file = NULL;
+   return ok;
+}
+
+//reading ******************
+
+bool midi_capture_open(midi_capture_t * capture, const char * path) {
+   struct stat st;
+   void * map;
+   int fd = open(path, O_RDONLY);
+
+   capture->map = NULL;
+   capture->size = 0;
+   capture->blocks = 0;
+   if (fd < 0)
+      return false;
+   if (fstat(fd, &st) != 0 || (size_t)st.st_size < MIDI_CAPTURE_FILE_HEADER) {
+      close(fd);
+      return false;
+   }
+   map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   //the mapping keeps the file
+   close(fd);
+   if (map == MAP_FAILED)
+      return false;
+
+   capture->map = map;
+   capture->size = st.st_size;
+   capture->block_size = get_le(capture->map + 12, 4);
+   if (memcmp(capture->map, midi_capture_magic, sizeof(midi_capture_magic)) != 0 ||
+         get_le(capture->map + 8, 2) != MIDI_CAPTURE_VERSION ||
+         capture->block_size <= MIDI_CAPTURE_BLOCK_HEADER) {
+      midi_capture_close(capture);
+      return false;
+   }
+   capture->blocks = (capture->size - MIDI_CAPTURE_FILE_HEADER + capture->block_size - 1) / capture->block_size;
+   //a last block cut off in its header is no good
+   if (capture->blocks &&
+         (capture->size - MIDI_CAPTURE_FILE_HEADER) % capture->block_size != 0 &&
+         (capture->size - MIDI_CAPTURE_FILE_HEADER) % capture->block_size < MIDI_CAPTURE_BLOCK_HEADER)
+      capture->blocks--;
+   return true;
+}
+
+void midi_capture_close(midi_capture_t * capture) {
+   if (capture->map)
+      munmap((void *)capture->map, capture->size);
+   capture->map = NULL;
+   capture->size = 0;
+   capture->blocks = 0;
+}
+
+static const uint8_t * midi_capture_block(const midi_capture_t * capture, size_t block) {
+   return capture->map + MIDI_CAPTURE_FILE_HEADER + block * capture->block_size;
+}
+
+static uint64_t midi_capture_block_time(const midi_capture_t * capture, size_t block) {
+   return get_le(midi_capture_block(capture, block), 8);
+}
+
+uint64_t midi_capture_start(const midi_capture_t * capture) {
+   return capture->blocks ? midi_capture_block_time(capture, 0) : 0;
+}
+
+uint64_t midi_capture_last_block(const midi_capture_t * capture) {
+   return capture->blocks ? midi_capture_block_time(capture, capture->blocks - 1) : 0;
+}
+
+//put the cursor at the start of a block, it is at the end if there isn't one
+static void midi_capture_enter(midi_capture_cursor_t * cursor, size_t block) {
+   const midi_capture_t * capture = cursor->capture;
+   const uint8_t * header;
+   size_t room;
+
+   cursor->block = block;
+   if (block >= capture->blocks) {
+      cursor->at = cursor->end = NULL;
+      return;
+   }
+   header = midi_capture_block(capture, block);
+   room = capture->size - (header - capture->map);
+   if (room > capture->block_size)
+      room = capture->block_size;
+   room -= MIDI_CAPTURE_BLOCK_HEADER;
+
+   cursor->time = get_le(header, 8);
+   cursor->offset = get_le(header + 8, 8);
+   cursor->at = header + MIDI_CAPTURE_BLOCK_HEADER;
+   cursor->end = cursor->at + ((get_le(header + 16, 4) < room) ? get_le(header + 16, 4) : room);
+}
+
+void midi_capture_rewind(midi_capture_cursor_t * cursor, const midi_capture_t * capture) {
+   cursor->capture = capture;
+   cursor->time = cursor->offset = 0;
+   midi_capture_enter(cursor, 0);
+}
+
+void midi_capture_seek(midi_capture_cursor_t * cursor, const midi_capture_t * capture, uint64_t time) {
+   //the last block that starts before time, records at time can end the
+   //block before one that starts at it
+   size_t low = 0, high = capture->blocks;
+   while (low < high) {
+      size_t middle = low + (high - low) / 2;
+      if (midi_capture_block_time(capture, middle) < time)
+         low = middle + 1;
+      else
+         high = middle;
+   }
+
+   cursor->capture = capture;
+   cursor->time = cursor->offset = 0;
+   midi_capture_enter(cursor, low ? low - 1 : 0);
+   while (1) {
+      midi_capture_cursor_t before = *cursor;
+      uint64_t at;
+      const uint8_t * data;
+      size_t length;
+      if (!midi_capture_next(cursor, &at, &data, &length))
+         break;
+      if (at >= time) {
+         *cursor = before;
+         break;
+      }
+   }
+}
+
+bool midi_capture_next(midi_capture_cursor_t * cursor, uint64_t * time, const uint8_t ** data, size_t * length) {
+   while (cursor->at) {
+      uint64_t delta, size;
+      const uint8_t * in = cursor->at;
+
+      if (in < cursor->end)
+         in = get_varint(in, cursor->end, &delta);
+      else
+         in = NULL;
+      if (in)
+         in = get_varint(in, cursor->end, &size);
+      if (!in || size > (uint64_t)(cursor->end - in)) {
+         //the end of the block, or a broken record which ends it too
+         midi_capture_enter(cursor, cursor->block + 1);
+         continue;
+      }
+
+      cursor->time += delta;
+      cursor->offset += size;
+      cursor->at = in + size;
+      *time = cursor->time;
+      *data = in;
+      *length = size;
+      return true;
+   }
+   return false;
+}
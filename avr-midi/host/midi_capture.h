@@ -0,0 +1,94 @@
+//timestamped captures of raw midi input, host only
+//
+//a capture is a 16 byte file header followed by blocks of block_size bytes,
+//all numbers little endian:
+//
+//   file header   "MIDICAP" 0, version [uint16], 0 [uint16],
+//                 block_size [uint32]
+//   block header  time [uint64], offset [uint64], used [uint32],
+//                 records [uint32]
+//   record        delta time [varint], length [varint], length midi bytes
+//
+//times are in microseconds.  A block's header holds the absolute time of
+//its first record and the offset of its first midi byte in the whole
+//stream, each record's delta is from the record before it [the first one's
+//from the block time, so it is 0].  used is the number of record bytes
+//after the block header, the rest of the block is padding, except for the
+//last block which ends with the file.  Varints are 7 bits a byte, low bits
+//first, the top bit set on all but the last byte.
+//
+//because every block starts at 16 + n * block_size the block headers are
+//the index: a reader can mmap the file and binary search them for a time
+//without reading anything else.  A writer only ever needs one block of
+//memory and a capture that was cut short is good up to its last full block.
+
+#ifndef MIDI_CAPTURE_H
+#define MIDI_CAPTURE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define MIDI_CAPTURE_VERSION 1
+#define MIDI_CAPTURE_FILE_HEADER 16
+#define MIDI_CAPTURE_BLOCK_HEADER 24
+
+//block size of new captures, readers take it from the file
+#ifndef MIDI_CAPTURE_BLOCK_SIZE
+#define MIDI_CAPTURE_BLOCK_SIZE 4096
+#endif
+
+typedef struct {
+   FILE * file;
+   uint8_t block[MIDI_CAPTURE_BLOCK_SIZE];
+   //record bytes in block after its header
+   uint32_t used;
+   uint32_t records;
+   uint64_t last_time;
+   uint64_t offset;
+} midi_capture_writer_t;
+
+typedef struct {
+   const uint8_t * map;
+   size_t size;
+   uint32_t block_size;
+   size_t blocks;
+} midi_capture_t;
+
+//a position in a capture
+typedef struct {
+   const midi_capture_t * capture;
+   size_t block;
+   const uint8_t * at;
+   const uint8_t * end;
+   //time of the last record read and the stream offset after it
+   uint64_t time;
+   uint64_t offset;
+} midi_capture_cursor_t;
+
+//writing, all return false on a write error or bad arguments
+bool midi_capture_create(midi_capture_writer_t * writer, const char * path);
+//time can't go backwards, a record too big for a block is split into
+//several with the same time
+bool midi_capture_append(midi_capture_writer_t * writer, uint64_t time, const uint8_t * data, size_t length);
+//write out the last block and close the file
+bool midi_capture_finish(midi_capture_writer_t * writer);
+
+//reading, open returns false if the file isn't a capture
+bool midi_capture_open(midi_capture_t * capture, const char * path);
+void midi_capture_close(midi_capture_t * capture);
+//times of the first record and the start of the last block, 0 if empty
+uint64_t midi_capture_start(const midi_capture_t * capture);
+uint64_t midi_capture_last_block(const midi_capture_t * capture);
+
+//put the cursor at the first record
+void midi_capture_rewind(midi_capture_cursor_t * cursor, const midi_capture_t * capture);
+//put the cursor at the first record at or after time, a binary search for
+//the block and then a walk through it
+void midi_capture_seek(midi_capture_cursor_t * cursor, const midi_capture_t * capture, uint64_t time);
+//the record at the cursor, data points into the capture itself.  Moves the
+//cursor on, returns false at the end of the capture.
+bool midi_capture_next(midi_capture_cursor_t * cursor, uint64_t * time, const uint8_t ** data, size_t * length);
+
+#endif
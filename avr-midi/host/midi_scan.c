@@ -0,0 +1,143 @@
+#include "midi_scan.h"
+
+#if !defined(MIDI_SCAN_SCALAR) && defined(__AVX2__)
+#include <immintrin.h>
+#define MIDI_SCAN_AVX2
+#elif !defined(MIDI_SCAN_SCALAR) && defined(__SSE2__)
+#include <emmintrin.h>
+#define MIDI_SCAN_SSE2
+#endif
+
+//in midi_device.c
+void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+void midi_process_byte(MidiDevice * device, uint8_t input);
+
+const char * midi_scan_impl(void) {
+#if defined(MIDI_SCAN_AVX2)
+   return "avx2";
+#elif defined(MIDI_SCAN_SSE2)
+   return "sse2";
+#else
+   return "scalar";
+#endif
+}
+
+size_t midi_scan_data_length(const uint8_t * data, size_t length) {
+   size_t i = 0;
+   //movemask gives us the top bit of each byte, which is set for exactly
+   //the status and realtime bytes
+#if defined(MIDI_SCAN_AVX2)
+   for (; i + 32 <= length; i += 32) {
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *)(data + i)));
+      if (mask)
+         return i + __builtin_ctz(mask);
+   }
+#endif
+#if defined(MIDI_SCAN_AVX2) || defined(MIDI_SCAN_SSE2)
+   for (; i + 16 <= length; i += 16) {
+      uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(data + i)));
+      if (mask)
+         return i + __builtin_ctz(mask);
+   }
+#endif
+   for (; i < length; i++) {
+      if (midi_is_statusbyte(data[i]))
+         return i;
+   }
+   return length;
+}
+
+//take as much of a run of data bytes as we can without the byte parser,
+//returns how many bytes that was.  What is left is less than a message and
+//goes through midi_process_byte.
+static size_t midi_scan_frame(MidiDevice * device, const uint8_t * data, size_t run) {
+   uint8_t status = device->input_buffer[0];
+   bool channel = midi_is_statusbyte(status) && status < SYSEX_BEGIN;
+   size_t per, count, i;
+
+#if MIDI_SYSEX
+   if (device->input_state == SYSEX_MESSAGE) {
+      //whole 3 byte pieces of sysex, once the parser has finished the one
+      //it is in the middle of
+      if (device->input_count)
+         return 0;
+      count = run / 3;
+      for (i = 0; i < count; i++)
+         midi_input_callbacks(device, 3, data[3 * i], data[3 * i + 1], data[3 * i + 2]);
+      if (count) {
+         device->input_buffer[0] = data[3 * count - 3];
+         device->input_buffer[1] = data[3 * count - 2];
+         device->input_buffer[2] = data[3 * count - 1];
+      }
+      return count * 3;
+   }
+#endif
+
+   if (device->input_state == IDLE) {
+#if MIDI_RUNNING_STATUS
+      if (!channel)
+         return run;
+#else
+      //without running status data outside a message is dropped
+      return run;
+#endif
+   } else if (!channel || device->input_count != 1 ||
+         (device->input_state != TWO_BYTE_MESSAGE && device->input_state != THREE_BYTE_MESSAGE)) {
+      //in the middle of a message, leave it to the parser
+      return 0;
+   }
+
+   per = midi_packet_length(status) - 1;
+   count = run / per;
+   if (!count)
+      return 0;
+#if !MIDI_RUNNING_STATUS
+   //only the message the status byte started, the rest is dropped
+   count = 1;
+#endif
+
+   if (per == 1) {
+      for (i = 0; i < count; i++)
+         midi_input_callbacks(device, 2, status, data[i], 0);
+      device->input_buffer[1] = data[count - 1];
+   } else {
+      for (i = 0; i < count; i++)
+         midi_input_callbacks(device, 3, status, data[2 * i], data[2 * i + 1]);
+      device->input_buffer[1] = data[2 * count - 2];
+      device->input_buffer[2] = data[2 * count - 1];
+   }
+   device->input_state = IDLE;
+   device->input_count = 0;
+
+#if MIDI_RUNNING_STATUS
+   return count * per;
+#else
+   return run;
+#endif
+}
+
+void midi_scan_process(MidiDevice * device, const uint8_t * data, size_t length) {
+   //keep the input in order
+   if (bytequeue_length(&device->input_queue))
+      midi_process(device);
+
+   //data bytes from here to the next status byte, so that a run is only
+   //scanned once however it ends up being parsed
+   size_t run = 0;
+   while (length) {
+      if (!run && !midi_is_statusbyte(*data))
+         run = midi_scan_data_length(data, length);
+      if (run) {
+         size_t used = midi_scan_frame(device, data, run);
+         data += used;
+         length -= used;
+         run -= used;
+         if (!length)
+            break;
+      }
+      midi_process_byte(device, *data++);
+      length--;
+      if (run)
+         run--;
+   }
+}
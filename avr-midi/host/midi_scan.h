@@ -0,0 +1,31 @@
+//bulk input parsing for big captures, host only
+//
+//midi_scan_process takes the same input and makes the same callbacks in the
+//same order as midi_process_buffer, but it looks for status and realtime
+//bytes 16 or 32 at a time [sse2 or avx2 movemask, whatever the compiler
+//targets].  The data bytes between them that continue a channel message,
+//running status or not, are framed into messages straight from the span and
+//only the bytes at message boundaries go through the byte at a time parser.
+//Sysex data goes out in 3 byte pieces the same way, and data bytes the
+//parser would ignore are skipped.
+//
+//build with -mavx2 [or -march=native] for the 32 byte scanner, define
+//MIDI_SCAN_SCALAR to use neither.
+
+#ifndef MIDI_SCAN_H
+#define MIDI_SCAN_H
+
+#include "midi.h"
+
+//like midi_process_buffer, the parser state carries over between calls and
+//anything already queued in the device is processed first
+void midi_scan_process(MidiDevice * device, const uint8_t * data, size_t length);
+
+//the number of data bytes at the start of data, that is the offset of the
+//first status or realtime byte or length if there is none
+size_t midi_scan_data_length(const uint8_t * data, size_t length);
+
+//"avx2", "sse2" or "scalar"
+const char * midi_scan_impl(void);
+
+#endif
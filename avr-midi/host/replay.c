@@ -0,0 +1,265 @@
+//replay a capture through the parser and see how the input queue copes
+//
+//usage: replay [options] file
+//
+//options:
+//   -r          real time, wait for each record's time [default is as fast
+//               as possible, on a simulated clock]
+//   -q length   input queue length [MIDI_INPUT_QUEUE_LENGTH]
+//   -p us       how often the main loop processes input [2000]
+//   -b bytes    most bytes processed each time, 0 for all [32]
+//   -s us       start at this time in the capture
+//   -e us       stop at this time
+//   -o file     write the queue depth before each processing pass, a
+//               "time depth" line each
+//
+//the records go into a device with midi_device_input as they would from
+//the uart interrupt, and midi_process_limited runs every period like
+//midi_process_task in the midi monster.  The defaults are its period and
+//budget.  The latency of a message is from the arrival of its last byte to
+//its callback, on the simulated clock plus the time the processing
+//actually took, or on the real clock with -r.  This is built with
+//MIDI_STATS, the peak queue and the dropped bytes come from there.  It
+//exits with 3 if any input was dropped.
+
+#include "midi.h"
+#include "midi_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_DEFAULT_PERIOD 2000
+#define REPLAY_DEFAULT_BUDGET 32
+//records with bytes still in the queue, each has at least one
+#define REPLAY_PENDING 256
+
+//latencies in ns, 32 buckets for each power of two so a percentile is good
+//to about 3%
+#define HISTOGRAM_SUB 32
+#define HISTOGRAM_BUCKETS (48 * HISTOGRAM_SUB)
+
+static uint64_t histogram[HISTOGRAM_BUCKETS];
+static uint64_t messages;
+static uint64_t latency_max;
+
+//arrival times of the queued bytes, by record
+static struct {
+   uint64_t end;
+   uint64_t time;
+} pending[REPLAY_PENDING];
+static size_t pending_first, pending_count;
+//bytes that made it into the queue so far and the ones that didn't
+static uint64_t queued_bytes;
+static uint64_t dropped_bytes;
+
+static MidiDevice device;
+static uint8_t queue_data[255];
+
+static int realtime;
+//simulated clock at the start of the processing pass and the real one then
+static uint64_t pass_time;
+static uint64_t pass_start;
+static uint64_t real_start;
+
+static void usage(const char * name) {
+   fprintf(stderr,
+         "usage: %s [-r] [-q length] [-p us] [-b bytes] [-s us] [-e us] [-o file] file\n", name);
+   exit(2);
+}
+
+static uint64_t now_ns(void) {
+   struct timespec t;
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static size_t bucket(uint64_t ns) {
+   size_t power = 0;
+   if (ns < HISTOGRAM_SUB)
+      return ns;
+   while ((ns >> power) >= 2 * HISTOGRAM_SUB)
+      power++;
+   if ((power + 1) * HISTOGRAM_SUB + (ns >> power) - HISTOGRAM_SUB >= HISTOGRAM_BUCKETS)
+      return HISTOGRAM_BUCKETS - 1;
+   return (power + 1) * HISTOGRAM_SUB + (ns >> power) - HISTOGRAM_SUB;
+}
+
+//the smallest latency in the bucket
+static uint64_t bucket_value(size_t index) {
+   size_t power;
+   if (index < HISTOGRAM_SUB)
+      return index;
+   power = index / HISTOGRAM_SUB - 1;
+   return (uint64_t)(index % HISTOGRAM_SUB + HISTOGRAM_SUB) << power;
+}
+
+static uint64_t percentile(double fraction) {
+   uint64_t want = (uint64_t)(messages * fraction), seen = 0;
+   size_t i;
+   for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+      seen += histogram[i];
+      if (seen > want)
+         return bucket_value(i);
+   }
+   return latency_max;
+}
+
+//every message ends up here
+static void replay_catchall(MidiDevice * d, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   //the byte being processed is still at the head of the queue
+   uint64_t index = queued_bytes - bytequeue_length(&d->input_queue);
+   uint64_t latency, arrival;
+
+   while (pending_count && pending[pending_first].end <= index) {
+      pending_first = (pending_first + 1) % REPLAY_PENDING;
+      pending_count--;
+   }
+   arrival = pending_count ? pending[pending_first].time * 1000 : pass_time * 1000;
+
+   if (realtime)
+      latency = now_ns() - real_start - arrival;
+   else
+      latency = pass_time * 1000 - arrival + (now_ns() - pass_start);
+   if (latency > latency_max)
+      latency_max = latency;
+   histogram[bucket(latency)]++;
+   messages++;
+}
+
+static void inject(uint64_t time, const uint8_t * data, size_t length) {
+   uint16_t dropped = midi_device_stats(&device)->dropped;
+   size_t i, got;
+
+   for (i = 0; i < length; i += 3) {
+      size_t n = (length - i > 3) ? 3 : length - i;
+      midi_device_input(&device, n, data[i], (n > 1) ? data[i + 1] : 0, (n > 2) ? data[i + 2] : 0);
+   }
+   got = length - (uint16_t)(midi_device_stats(&device)->dropped - dropped);
+   dropped_bytes += length - got;
+   if (!got)
+      return;
+   queued_bytes += got;
+   //can't overflow, there are never more records queued than bytes
+   pending[(pending_first + pending_count) % REPLAY_PENDING].end = queued_bytes;
+   pending[(pending_first + pending_count) % REPLAY_PENDING].time = time;
+   pending_count++;
+}
+
+static void sleep_until(uint64_t time) {
+   struct timespec t;
+   uint64_t ns = real_start + time * 1000;
+   t.tv_sec = ns / 1000000000;
+   t.tv_nsec = ns % 1000000000;
+   while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+      ;
+}
+
+int main(int argc, char * argv[]) {
+   midi_capture_t capture;
+   midi_capture_cursor_t cursor;
+   unsigned long queue_length = MIDI_INPUT_QUEUE_LENGTH;
+   uint64_t period = REPLAY_DEFAULT_PERIOD, budget = REPLAY_DEFAULT_BUDGET;
+   uint64_t from = 0, to = UINT64_MAX, tick, time = 0;
+   uint64_t bytes = 0, first = 0, last = 0;
+   const uint8_t * data = NULL;
+   size_t length = 0;
+   bool have_record, started = false;
+   FILE * depth_file = NULL;
+   double wall;
+   int option;
+
+   while ((option = getopt(argc, argv, "rq:p:b:s:e:o:")) != -1) {
+      switch (option) {
+         case 'r':
+            realtime = 1;
+            break;
+         case 'q':
+            queue_length = strtoul(optarg, NULL, 0);
+            break;
+         case 'p':
+            period = strtoull(optarg, NULL, 0);
+            break;
+         case 'b':
+            budget = strtoull(optarg, NULL, 0);
+            break;
+         case 's':
+            from = strtoull(optarg, NULL, 0);
+            break;
+         case 'e':
+            to = strtoull(optarg, NULL, 0);
+            break;
+         case 'o':
+            depth_file = fopen(optarg, "w");
+            if (!depth_file) {
+               perror(optarg);
+               return 1;
+            }
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+   if (optind != argc - 1 || queue_length < 2 || queue_length > sizeof(queue_data) || !period)
+      usage(argv[0]);
+   if (!budget || budget > queue_length)
+      budget = queue_length;
+   if (!midi_capture_open(&capture, argv[optind])) {
+      fprintf(stderr, "%s: not a capture\n", argv[optind]);
+      return 1;
+   }
+
+   midi_init_device_queue(&device, queue_data, queue_length);
+   midi_register_catchall_callback(&device, replay_catchall);
+
+   midi_capture_seek(&cursor, &capture, from);
+   have_record = midi_capture_next(&cursor, &time, &data, &length) && time <= to;
+   //the clocks start at the first record, so does the first pass
+   tick = first = have_record ? time : from;
+   real_start = now_ns() - first * 1000;
+   wall = now_ns();
+
+   while (have_record || bytequeue_length(&device.input_queue)) {
+      //everything that arrives before the next pass, then the pass
+      if (have_record && time <= tick) {
+         if (realtime)
+            sleep_until(time);
+         inject(time, data, length);
+         bytes += length;
+         last = time;
+         started = true;
+         have_record = midi_capture_next(&cursor, &time, &data, &length) && time <= to;
+         continue;
+      }
+      if (!bytequeue_length(&device.input_queue) && time > tick + period) {
+         //nothing to do until the next record, skip the passes in between
+         tick += (time - tick) / period * period;
+         continue;
+      }
+      if (realtime)
+         sleep_until(tick);
+      if (depth_file)
+         fprintf(depth_file, "%llu %u\n", (unsigned long long)tick, bytequeue_length(&device.input_queue));
+      pass_time = tick;
+      pass_start = now_ns();
+      midi_process_limited(&device, budget);
+      tick += period;
+   }
+   wall = (now_ns() - wall) / 1e9;
+
+   printf("%s: %.3f s, %llu bytes, %llu messages, replayed in %.3f s\n", argv[optind],
+         started ? (last - first) / 1e6 : 0.0, (unsigned long long)bytes, (unsigned long long)messages, wall);
+   printf("queue %lu bytes, processing %llu bytes every %llu us\n",
+         queue_length, (unsigned long long)budget, (unsigned long long)period);
+   printf("peak queue %u bytes, %llu dropped%s\n", midi_device_stats(&device)->max_queued,
+         (unsigned long long)dropped_bytes, dropped_bytes ? ", OVERFLOWED" : "");
+   if (messages)
+      printf("latency p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+            percentile(0.5) / 1e3, percentile(0.99) / 1e3, percentile(0.999) / 1e3, latency_max / 1e3);
+
+   if (depth_file)
+      fclose(depth_file);
+   midi_capture_close(&capture);
+   return dropped_bytes ? 3 : 0;
+}
@@ -35,30 +35,38 @@ bool midi_is_realtime(uint8_t theByte){
 }
 
 midi_packet_length_t midi_packet_length(uint8_t status){
-   switch(status & MIDI_STATUSMASK){
+   //channel messages go by the high nibble, system ones by the whole byte
+   switch(status & 0xF0){
       case MIDI_CC:
       case MIDI_NOTEON:
       case MIDI_NOTEOFF:
       case MIDI_AFTERTOUCH:
       case MIDI_PITCHBEND:
-      case MIDI_SONGPOSITION:
          return THREE;
       case MIDI_PROGCHANGE:
       case MIDI_CHANPRESSURE:
-      case MIDI_SONGSELECT:
-      case MIDI_TC_QUATERFRAME:
          return TWO;
-      case MIDI_CLOCK:
-      case MIDI_TICK:
-      case MIDI_START:
-      case MIDI_CONTINUE:
-      case MIDI_STOP:
-      case MIDI_ACTIVESENSE:
-      case MIDI_RESET:
-      case MIDI_TUNEREQUEST:
-         return ONE;
-      case SYSEX_END:
-      case SYSEX_BEGIN:
+      case 0xF0:
+         switch(status){
+            case MIDI_SONGPOSITION:
+               return THREE;
+            case MIDI_SONGSELECT:
+            case MIDI_TC_QUATERFRAME:
+               return TWO;
+            case MIDI_CLOCK:
+            case MIDI_TICK:
+            case MIDI_START:
+            case MIDI_CONTINUE:
+            case MIDI_STOP:
+            case MIDI_ACTIVESENSE:
+            case MIDI_RESET:
+            case MIDI_TUNEREQUEST:
+               return ONE;
+            case SYSEX_END:
+            case SYSEX_BEGIN:
+            default:
+               return UNDEFINED;
+         }
       default:
          return UNDEFINED;
    }
@@ -194,7 +202,99 @@ void midi_send_data(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t b
    device->send_func(device, count, byte0, byte1, byte2);
 }
 
+//split data into messages for send_func, running status is expanded and
+//sysex goes 3 bytes at a time, like the input callbacks get them
+static void midi_send_split(MidiDevice * device, const uint8_t * data, uint16_t length){
+   uint8_t msg[3];
+   uint8_t count = 0;
+   //bytes in the current message [a sysex chunk], 0 if we have no status
+   uint8_t want = 0;
+   bool sysex = false;
+
+   for (; length; length--, data++) {
+      uint8_t b = *data;
+      if (midi_is_realtime(b)) {
+         //goes out on its own, even in the middle of a message
+         device->send_func(device, 1, b, 0, 0);
+         continue;
+      }
+      if (midi_is_statusbyte(b)) {
+         if (b == SYSEX_END && sysex) {
+            msg[count++] = b;
+            device->send_func(device, count, msg[0], msg[1], msg[2]);
+            count = want = 0;
+            sysex = false;
+            continue;
+         }
+         sysex = (b == SYSEX_BEGIN);
+         want = sysex ? 3 : midi_packet_length(b);
+         msg[0] = b;
+         count = 1;
+      } else {
+         //data with no status to go with it
+         if (!want)
+            continue;
+         //running status
+         if (count == 0 && !sysex)
+            msg[count++] = msg[0];
+         msg[count++] = b;
+      }
+
+      if (want && count == want) {
+         device->send_func(device, count, msg[0], msg[1], msg[2]);
+         count = 0;
+         //only channel messages have running status
+         if (!sysex && msg[0] >= SYSEX_BEGIN)
+            want = 0;
+      }
+   }
+}
+
+void midi_send_buffer(MidiDevice * device, const uint8_t * data, uint16_t length){
+   if (device->send_buffer_func)
+      device->send_buffer_func(device, data, length);
+   else
+      midi_send_split(device, data, length);
+}
+
+void midi_send_events(MidiDevice * device, const midi_event_t * events, uint8_t count){
+   //gather the events up and hand them over a buffer at a time
+   uint8_t buffer[MIDI_SEND_EVENTS_BUFFER];
+   uint8_t length = 0;
+   uint8_t i;
+
+   if (!device->send_buffer_func) {
+      for (i = 0; i < count; i++)
+         midi_send_data(device, events[i].length, events[i].data[0], events[i].data[1], events[i].data[2]);
+      return;
+   }
+
+   for (i = 0; i < count; i++) {
+      uint8_t n = events[i].length;
+      if (n > 3)
+         n = 3;
+      if (length + n > MIDI_SEND_EVENTS_BUFFER) {
+         device->send_buffer_func(device, buffer, length);
+         length = 0;
+      }
+      buffer[length++] = events[i].data[0];
+      if (n > 1)
+         buffer[length++] = events[i].data[1];
+      if (n > 2)
+         buffer[length++] = events[i].data[2];
+   }
+   if (length)
+      device->send_buffer_func(device, buffer, length);
+}
+
 
+#if MIDI_OPS_TABLE
+void midi_device_set_ops(MidiDevice * device, const MidiDeviceOps * ops){
+   device->ops = ops;
+}
+#else
+
+#if MIDI_CHANNEL_CALLBACKS
 void midi_register_cc_callback(MidiDevice * device, midi_three_byte_func_t func){
    device->input_cc_callback = func;
 }
@@ -215,10 +315,6 @@ void midi_register_pitchbend_callback(MidiDevice * device, midi_three_byte_func_
    device->input_pitchbend_callback = func;
 }
 
-void midi_register_songposition_callback(MidiDevice * device, midi_three_byte_func_t func){
-   device->input_songposition_callback = func;
-}
-
 void midi_register_progchange_callback(MidiDevice * device, midi_two_byte_func_t func) {
    device->input_progchange_callback = func;
 }
@@ -226,6 +322,12 @@ void midi_register_progchange_callback(MidiDevice * device, midi_two_byte_func_t
 void midi_register_chanpressure_callback(MidiDevice * device, midi_two_byte_func_t func) {
    device->input_chanpressure_callback = func;
 }
+#endif
+
+#if MIDI_SYSCOMMON_CALLBACKS
+void midi_register_songposition_callback(MidiDevice * device, midi_three_byte_func_t func){
+   device->input_songposition_callback = func;
+}
 
 void midi_register_songselect_callback(MidiDevice * device, midi_two_byte_func_t func) {
    device->input_songselect_callback = func;
@@ -235,19 +337,27 @@ void midi_register_tc_quarterframe_callback(MidiDevice * device, midi_two_byte_f
    device->input_tc_quaterframe_callback = func;
 }
 
-void midi_register_realtime_callback(MidiDevice * device, midi_one_byte_func_t func){
-   device->input_realtime_callback = func;
-}
-
 void midi_register_tunerequest_callback(MidiDevice * device, midi_one_byte_func_t func){
    device->input_tunerequest_callback = func;
 }
+#endif
 
+#if MIDI_REALTIME_CALLBACKS
+void midi_register_realtime_callback(MidiDevice * device, midi_one_byte_func_t func){
+   device->input_realtime_callback = func;
+}
+#endif
+
+#if MIDI_FALLTHROUGH_CALLBACK
 void midi_register_fallthrough_callback(MidiDevice * device, midi_var_byte_func_t func){
    device->input_fallthrough_callback = func;
 }
+#endif
 
+#if MIDI_CATCHALL_CALLBACK
 void midi_register_catchall_callback(MidiDevice * device, midi_var_byte_func_t func){
    device->input_catchall_callback = func;
 }
+#endif
 
+#endif
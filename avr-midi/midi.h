@@ -24,6 +24,7 @@
 
 #include "midi_device.h"
 #include "midi_function_types.h"
+#include <stddef.h>
 
 typedef enum {
    UNDEFINED = 0,
@@ -31,6 +32,12 @@ typedef enum {
    TWO = 2,
    THREE = 3} midi_packet_length_t;
 
+//a message for midi_send_events, only the first length bytes are used
+typedef struct {
+   uint8_t length;
+   uint8_t data[3];
+} midi_event_t;
+
 //general information [device independent] ****************
 //returns true if the byte given is a midi status byte
 bool midi_is_statusbyte(uint8_t theByte);
@@ -41,11 +48,23 @@ midi_packet_length_t midi_packet_length(uint8_t status);
 
 
 //initialize midi device
+#if MIDI_INPUT_QUEUE_LENGTH > 0
 void midi_init_device(MidiDevice * device); // [implementation in midi_device.c]
+#endif
+//initialize midi device with an input queue of its own, queue_data must
+//be length bytes and stay around as long as the device does
+void midi_init_device_queue(MidiDevice * device, uint8_t * queue_data, byteQueueIndex_t length); // [implementation in midi_device.c]
 
 //process input data
 //you need to call this if you expect your input callbacks to be called
 void midi_process(MidiDevice * device); // [implementation in midi_device.c]
+//process at most max_bytes of input data, returns the number of bytes processed
+//use this to bound the time spent in processing, the rest stays queued
+byteQueueIndex_t midi_process_limited(MidiDevice * device, byteQueueIndex_t max_bytes); // [implementation in midi_device.c]
+//process a span of input bytes straight away, without queueing them.  The
+//parser state carries over between calls so the span can start or end in
+//the middle of a message.  Anything already queued is processed first.
+void midi_process_buffer(MidiDevice * device, const uint8_t * data, size_t length); // [implementation in midi_device.c]
 
 
 //send functions **********************
@@ -74,31 +93,59 @@ void midi_send_tunerequest(MidiDevice * device);
 void midi_send_byte(MidiDevice * device, uint8_t b);
 void midi_send_data(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2);
 
+//bulk sends, for devices with a send buffer function these go out in as few
+//calls as we can [see midi_device_set_send_buffer_func], otherwise they are
+//split into messages for send_func.
+//data holds whole messages, running status and sysex are fine, realtime
+//bytes can be anywhere.  A message cut short by the next status byte or the
+//end of the data is dropped by the split.
+void midi_send_buffer(MidiDevice * device, const uint8_t * data, uint16_t length);
+void midi_send_events(MidiDevice * device, const midi_event_t * events, uint8_t count);
+
 
 //input callback registration ***********************
+//only the ones midi_config.h leaves in are declared
+
+#if MIDI_OPS_TABLE
+//with MIDI_OPS_TABLE the callbacks come from a table [see MidiDeviceOps in
+//midi_device.h] instead of being registered one at a time, the table must
+//stay around as long as the device does
+void midi_device_set_ops(MidiDevice * device, const MidiDeviceOps * ops);
+#else
 
+#if MIDI_CHANNEL_CALLBACKS
 //three byte funcs
 void midi_register_cc_callback(MidiDevice * device, midi_three_byte_func_t func);
 void midi_register_noteon_callback(MidiDevice * device, midi_three_byte_func_t func);
 void midi_register_noteoff_callback(MidiDevice * device, midi_three_byte_func_t func);
 void midi_register_aftertouch_callback(MidiDevice * device, midi_three_byte_func_t func);
 void midi_register_pitchbend_callback(MidiDevice * device, midi_three_byte_func_t func);
-void midi_register_songposition_callback(MidiDevice * device, midi_three_byte_func_t func);
 
 //two byte funcs
 void midi_register_progchange_callback(MidiDevice * device, midi_two_byte_func_t func);
 void midi_register_chanpressure_callback(MidiDevice * device, midi_two_byte_func_t func);
+#endif
+
+#if MIDI_SYSCOMMON_CALLBACKS
+void midi_register_songposition_callback(MidiDevice * device, midi_three_byte_func_t func);
 void midi_register_songselect_callback(MidiDevice * device, midi_two_byte_func_t func);
 void midi_register_tc_quarterframe_callback(MidiDevice * device, midi_two_byte_func_t func);
+void midi_register_tunerequest_callback(MidiDevice * device, midi_one_byte_func_t func);
+#endif
 
-//one byte funcs
+#if MIDI_REALTIME_CALLBACKS
 void midi_register_realtime_callback(MidiDevice * device, midi_one_byte_func_t func);
-void midi_register_tunerequest_callback(MidiDevice * device, midi_one_byte_func_t func);
+#endif
 
+#if MIDI_FALLTHROUGH_CALLBACK
 //fall through, only called if a more specific callback isn't matched and called
 void midi_register_fallthrough_callback(MidiDevice * device, midi_var_byte_func_t func);
+#endif
+#if MIDI_CATCHALL_CALLBACK
 //catch all, always called if registered, independent of a more specific or fallthrough call
 void midi_register_catchall_callback(MidiDevice * device, midi_var_byte_func_t func);
+#endif
+#endif
 
 #define SYSEX_BEGIN 0xF0
 #define SYSEX_END 0xF7
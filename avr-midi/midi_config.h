@@ -0,0 +1,103 @@
+//compile time configuration for avr-midi
+//
+//every setting has a default here, override them with -D in your makefile.
+//Features that are turned off are compiled out completely: their fields
+//leave MidiDevice, their code leaves the parser and their register
+//functions aren't declared, so using one is a compile error rather than a
+//callback that is never called.
+//
+//the switches are 0 or 1:
+//MIDI_CHANNEL_CALLBACKS    cc, noteon, noteoff, aftertouch, pitchbend,
+//                          progchange and chanpressure callbacks
+//MIDI_SYSCOMMON_CALLBACKS  songposition, songselect, tc quarterframe and
+//                          tunerequest callbacks
+//MIDI_REALTIME_CALLBACKS   the realtime callback
+//MIDI_FALLTHROUGH_CALLBACK the fallthrough callback
+//MIDI_CATCHALL_CALLBACK    the catchall callback
+//MIDI_OPS_TABLE            take the callbacks from a const table that devices
+//                          can share [in flash on the avr, see MidiDeviceOps]
+//                          instead of registering them in each device
+//MIDI_SYSEX                parse sysex and pass it to the callbacks 3 bytes
+//                          at a time, without it sysex is dropped
+//MIDI_RUNNING_STATUS       data bytes without a status byte before them
+//                          reuse the last channel status
+//MIDI_STATS                count messages and dropped input per device, see
+//                          midi_device_stats
+//
+//MIDI_SEND_EVENTS_BUFFER   bytes midi_send_events gathers on the stack before
+//                          each call to a device's send buffer function
+//
+//for the midi file player [smf.h]:
+//SMF_TRACK_BUFFER          bytes each track reads from the file at a time
+//SMF_SEND_QUEUE            events decoded ahead of their time, a power of two
+//                          up to 128
+//
+//queue lengths are in bytes, at most 255:
+//MIDI_INPUT_QUEUE_LENGTH   the queue inside every MidiDevice, used by
+//                          midi_init_device.  Set it to 0 to leave the queue
+//                          out of the device and give each device a queue
+//                          of its own length with midi_init_device_queue.
+//MIDI_USB_QUEUE_LENGTH     suggested lengths for those queues, by the kind
+//MIDI_SERIAL_QUEUE_LENGTH  of port the device is
+//
+//the midi monster makefile picks these with MIDI_CONFIG, and make sizes
+//there reports the flash and ram each of its configurations takes.
+
+#ifndef MIDI_CONFIG_H
+#define MIDI_CONFIG_H
+
+#ifndef MIDI_INPUT_QUEUE_LENGTH
+#define MIDI_INPUT_QUEUE_LENGTH 192
+#endif
+
+//a usb device gets up to 3 bytes a packet and 16 packets a frame, serial
+//only gets a byte every 320us at 31250 baud
+#ifndef MIDI_USB_QUEUE_LENGTH
+#define MIDI_USB_QUEUE_LENGTH 192
+#endif
+#ifndef MIDI_SERIAL_QUEUE_LENGTH
+#define MIDI_SERIAL_QUEUE_LENGTH 64
+#endif
+
+#ifndef MIDI_CHANNEL_CALLBACKS
+#define MIDI_CHANNEL_CALLBACKS 1
+#endif
+#ifndef MIDI_SYSCOMMON_CALLBACKS
+#define MIDI_SYSCOMMON_CALLBACKS 1
+#endif
+#ifndef MIDI_REALTIME_CALLBACKS
+#define MIDI_REALTIME_CALLBACKS 1
+#endif
+#ifndef MIDI_FALLTHROUGH_CALLBACK
+#define MIDI_FALLTHROUGH_CALLBACK 1
+#endif
+#ifndef MIDI_CATCHALL_CALLBACK
+#define MIDI_CATCHALL_CALLBACK 1
+#endif
+
+#ifndef MIDI_OPS_TABLE
+#define MIDI_OPS_TABLE 0
+#endif
+
+#ifndef MIDI_SYSEX
+#define MIDI_SYSEX 1
+#endif
+#ifndef MIDI_RUNNING_STATUS
+#define MIDI_RUNNING_STATUS 1
+#endif
+#ifndef MIDI_STATS
+#define MIDI_STATS 0
+#endif
+
+#ifndef MIDI_SEND_EVENTS_BUFFER
+#define MIDI_SEND_EVENTS_BUFFER 24
+#endif
+
+#ifndef SMF_TRACK_BUFFER
+#define SMF_TRACK_BUFFER 16
+#endif
+#ifndef SMF_SEND_QUEUE
+#define SMF_SEND_QUEUE 8
+#endif
+
+#endif
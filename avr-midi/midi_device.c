@@ -9,54 +9,194 @@
 #include <stdio.h>
 #endif
 
+#if MIDI_OPS_TABLE
+//devices without a table of their own get this one
+static const MidiDeviceOps midi_no_ops MIDI_OPS_PROGMEM = {};
+
+//get a callback from the device's table, on the avr that is a single read
+//from flash
+#ifdef __AVR__
+#define MIDI_CALLBACK(device, type, name) ((type)(uintptr_t)pgm_read_word(&(device)->ops->name))
+#else
+#define MIDI_CALLBACK(device, type, name) ((device)->ops->name)
+#endif
+#else
+#define MIDI_CALLBACK(device, type, name) ((device)->input_##name##_callback)
+#endif
+
 //forward declarations, internally used to call the callbacks
 void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2);
 void midi_process_byte(MidiDevice * device, uint8_t input);
 
+#if MIDI_INPUT_QUEUE_LENGTH > 0
 void midi_init_device(MidiDevice * device){
+   midi_init_device_queue(device, device->input_queue_data, MIDI_INPUT_QUEUE_LENGTH);
+}
+#endif
+
+void midi_init_device_queue(MidiDevice * device, uint8_t * queue_data, byteQueueIndex_t length){
    device->input_state = IDLE;
    device->input_count = 0;
-   bytequeue_init(&device->input_queue, device->input_queue_data, MIDI_INPUT_QUEUE_LENGTH);
+   //no running status until we've seen a channel message
+   device->input_buffer[0] = 0;
+   bytequeue_init(&device->input_queue, queue_data, length);
+   device->send_buffer_func = NULL;
 
+#if MIDI_OPS_TABLE
+   device->ops = &midi_no_ops;
+#else
+#if MIDI_CHANNEL_CALLBACKS
    //three byte funcs
    device->input_cc_callback = NULL;
    device->input_noteon_callback = NULL;
    device->input_noteoff_callback = NULL;
    device->input_aftertouch_callback = NULL;
    device->input_pitchbend_callback = NULL;
-   device->input_songposition_callback = NULL;
 
    //two byte funcs
    device->input_progchange_callback = NULL;
    device->input_chanpressure_callback = NULL;
+#endif
+
+#if MIDI_SYSCOMMON_CALLBACKS
+   device->input_songposition_callback = NULL;
    device->input_songselect_callback = NULL;
    device->input_tc_quaterframe_callback = NULL;
+   device->input_tunerequest_callback = NULL;
+#endif
 
-   //one byte funcs
+#if MIDI_REALTIME_CALLBACKS
    device->input_realtime_callback = NULL;
-   device->input_tunerequest_callback = NULL;
+#endif
 
+#if MIDI_FALLTHROUGH_CALLBACK
    device->input_fallthrough_callback = NULL;
+#endif
+#if MIDI_CATCHALL_CALLBACK
    device->input_catchall_callback = NULL;
+#endif
+#endif
+
+#if MIDI_STATS
+   midi_device_reset_stats(device);
+#endif
 }
 
 void midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
-   //temp storage so we can loop over the bytes
-   uint8_t input[3];
-   input[0] = byte0;
-   input[1] = byte1;
-   input[2] = byte2;
-   
+   byteQueueIndex_t at;
+
    //clamp range
    if (cnt > 3)
       cnt = 3;
 
-   uint8_t i;
-   for (i = 0; i < cnt; i++) {
 #ifdef DEBUG
-      printf("queueing %x\n", input[i]);
+   printf("queueing %d: %x %x %x\n", cnt, byte0, byte1, byte2);
+#endif
+   //all of it or none of it, so that input from an interrupt that
+   //interrupts another one never lands in the middle of its message
+   if (!bytequeue_reserve(&device->input_queue, cnt, &at)) {
+#if MIDI_STATS
+      device->stats.dropped += cnt;
 #endif
-      bytequeue_enqueue(&device->input_queue, input[i]);
+      return;
+   }
+   bytequeue_set(&device->input_queue, at, 0, byte0);
+   if (cnt > 1)
+      bytequeue_set(&device->input_queue, at, 1, byte1);
+   if (cnt > 2)
+      bytequeue_set(&device->input_queue, at, 2, byte2);
+   bytequeue_publish(&device->input_queue);
+
+#if MIDI_STATS
+   if (bytequeue_length(&device->input_queue) > device->stats.max_queued)
+      device->stats.max_queued = bytequeue_length(&device->input_queue);
+#endif
+}
+
+void midi_input_framer_init(midi_input_framer_t * framer) {
+   framer->count = 0;
+   framer->state = IDLE;
+#if MIDI_RUNNING_STATUS
+   framer->running = 0;
+#endif
+}
+
+static void midi_input_framer_queue(MidiDevice * device, midi_input_framer_t * framer) {
+   midi_device_input(device, framer->count, framer->bytes[0], framer->bytes[1], framer->bytes[2]);
+   framer->count = 0;
+}
+
+//this follows midi_process_byte, so that what the parser makes of the
+//messages we queue is what it would have made of the bytes
+void midi_device_input_byte(MidiDevice * device, midi_input_framer_t * framer, uint8_t input) {
+   if (midi_is_realtime(input)) {
+      //it can go anywhere, so it doesn't wait for the message it is in
+      midi_device_input(device, 1, input, 0, 0);
+      return;
+   }
+
+   if (midi_is_statusbyte(input)) {
+#if MIDI_SYSEX
+      //the rest of the sysex, an end without a sysex is dropped
+      if (input == SYSEX_END && framer->state == SYSEX_MESSAGE) {
+         framer->bytes[framer->count++] = input;
+         midi_input_framer_queue(device, framer);
+      }
+#endif
+      //whatever came before is over, an unfinished message is dropped
+      framer->state = IDLE;
+      framer->count = 0;
+#if MIDI_RUNNING_STATUS
+      framer->running = (input < SYSEX_BEGIN) ? input : 0;
+#endif
+      switch (midi_packet_length(input)) {
+         case ONE:
+            midi_device_input(device, 1, input, 0, 0);
+            return;
+         case TWO:
+            framer->state = TWO_BYTE_MESSAGE;
+            break;
+         case THREE:
+            framer->state = THREE_BYTE_MESSAGE;
+            break;
+         default:
+#if MIDI_SYSEX
+            if (input == SYSEX_BEGIN) {
+               framer->state = SYSEX_MESSAGE;
+               break;
+            }
+#endif
+            //undefined, nothing to queue
+            return;
+      }
+      framer->bytes[framer->count++] = input;
+      return;
+   }
+
+#if MIDI_RUNNING_STATUS
+   if (framer->state == IDLE && framer->running) {
+      framer->state = (input_state_t)midi_packet_length(framer->running);
+      framer->bytes[framer->count++] = framer->running;
+   }
+#endif
+   switch (framer->state) {
+      case IDLE:
+         //no message to put it in
+         break;
+#if MIDI_SYSEX
+      case SYSEX_MESSAGE:
+         framer->bytes[framer->count++] = input;
+         if (framer->count == 3)
+            midi_input_framer_queue(device, framer);
+         break;
+#endif
+      default:
+         framer->bytes[framer->count++] = input;
+         if (framer->count == (uint8_t)framer->state) {
+            framer->state = IDLE;
+            midi_input_framer_queue(device, framer);
+         }
+         break;
    }
 }
 
@@ -64,11 +204,32 @@ void midi_device_set_send_func(MidiDevice * device, midi_var_byte_func_t send_fu
    device->send_func = send_func;
 }
 
+void midi_device_set_send_buffer_func(MidiDevice * device, midi_buffer_func_t send_buffer_func){
+   device->send_buffer_func = send_buffer_func;
+}
+
+#if MIDI_STATS
+const midi_device_stats_t * midi_device_stats(MidiDevice * device) {
+   return &device->stats;
+}
+
+void midi_device_reset_stats(MidiDevice * device) {
+   device->stats.messages = 0;
+   device->stats.dropped = 0;
+   device->stats.max_queued = 0;
+}
+#endif
+
 void midi_process(MidiDevice * device) {
+   midi_process_limited(device, bytequeue_length(&device->input_queue));
+}
+
+byteQueueIndex_t midi_process_limited(MidiDevice * device, byteQueueIndex_t max_bytes) {
    //pull stuff off the queue and process
    byteQueueIndex_t len = bytequeue_length(&device->input_queue);
-   uint16_t i;
-   //TODO limit number of bytes processed?
+   byteQueueIndex_t i;
+   if (len > max_bytes)
+      len = max_bytes;
    for(i = 0; i < len; i++) {
       uint8_t val = bytequeue_get(&device->input_queue, 0);
 #ifdef DEBUG
@@ -77,6 +238,15 @@ void midi_process(MidiDevice * device) {
       midi_process_byte(device, val);
       bytequeue_remove(&device->input_queue, 1);
    }
+   return len;
+}
+
+void midi_process_buffer(MidiDevice * device, const uint8_t * data, size_t length) {
+   //keep the input in order
+   if (bytequeue_length(&device->input_queue))
+      midi_process(device);
+   while (length--)
+      midi_process_byte(device, *data++);
 }
 
 void midi_process_byte(MidiDevice * device, uint8_t input) {
@@ -84,11 +254,28 @@ void midi_process_byte(MidiDevice * device, uint8_t input) {
       //call callback, don't change any state
       midi_input_callbacks(device, 1, input, 0, 0);
    } else if (midi_is_statusbyte(input)) {
-      //store the byte
-      if (device->input_state != SYSEX_MESSAGE) {
+#if MIDI_SYSEX
+      if (input == SYSEX_END) {
+         //send what is left of the sysex, an end without a sysex is dropped.
+         //Either way there is no running status after it.
+         uint8_t cnt = device->input_count;
+         bool sysex = device->input_state == SYSEX_MESSAGE;
+         device->input_state = IDLE;
+         device->input_count = 0;
+         if (sysex) {
+            device->input_buffer[cnt++] = input;
+            midi_input_callbacks(device, cnt,
+                  device->input_buffer[0], device->input_buffer[1], device->input_buffer[2]);
+         }
          device->input_buffer[0] = input;
-         device->input_count = 1;
+         return;
       }
+#endif
+      //any other status byte ends what came before it, a sysex that isn't
+      //ended with SYSEX_END loses the bytes it hasn't sent yet.  The byte is
+      //kept as the running status, anything but a channel status cancels it.
+      device->input_buffer[0] = input;
+      device->input_count = 1;
       switch (midi_packet_length(input)) {
          case ONE:
             device->input_state = IDLE;
@@ -99,104 +286,105 @@ void midi_process_byte(MidiDevice * device, uint8_t input) {
             break;
          case THREE:
             device->input_state = THREE_BYTE_MESSAGE;
-            break;
-         case UNDEFINED:
-            switch(input) {
-               case SYSEX_BEGIN:
-                  device->input_state = SYSEX_MESSAGE;
-                  device->input_buffer[0] = input;
-                  device->input_count = 1;
-                  break;
-               case SYSEX_END:
-                  //failsafe, should never happen
-                  if(device->input_count > 2) {
-                     device->input_state = IDLE;
-                     device->input_count = 2;
-                  }
-                  //send what is left in the input buffer, set idle
-                  device->input_buffer[device->input_count] = input;
-                  device->input_state = IDLE;
-                  device->input_count += 1;
-                  //call the callback
-                  midi_input_callbacks(device, device->input_count, 
-                        device->input_buffer[0], device->input_buffer[1], device->input_buffer[2]);
-                  break;
-               default:
-                  device->input_state = IDLE;
-                  device->input_count = 0;
-            }
-
             break;
          default:
+#if MIDI_SYSEX
+            if (input == SYSEX_BEGIN) {
+               device->input_state = SYSEX_MESSAGE;
+               break;
+            }
+#endif
+            //undefined, or sysex when we don't parse it
             device->input_state = IDLE;
             device->input_count = 0;
             break;
       }
    } else {
-      //failsafe, should never happen
-      if(device->input_count > 2)
-         device->input_state = IDLE;
+#if MIDI_RUNNING_STATUS
+      //a data byte after a complete channel message starts another one with
+      //the same status, anything else in input_buffer[0] means there is no
+      //running status: system messages cancel it
+      if (device->input_state == IDLE &&
+            midi_is_statusbyte(device->input_buffer[0]) && device->input_buffer[0] < SYSEX_BEGIN) {
+         device->input_state = (input_state_t)midi_packet_length(device->input_buffer[0]);
+         device->input_count = 1;
+      }
+#endif
 
-      if (device->input_state != IDLE) {
-         //store the byte
-         device->input_buffer[device->input_count] = input;
-         //increment count
-         device->input_count += 1;
-         switch(device->input_count) {
-            case 3:
-               if (device->input_state != SYSEX_MESSAGE)
-                  device->input_state = IDLE;
+      //input_count is always less than the length of the message we're in,
+      //or 3 for sysex, so the byte fits
+      switch (device->input_state) {
+         case IDLE:
+            //no message to put it in
+            break;
+#if MIDI_SYSEX
+         case SYSEX_MESSAGE:
+            //sysex goes out 3 bytes at a time, the way usb carries it
+            device->input_buffer[device->input_count++] = input;
+            if (device->input_count == 3) {
                device->input_count = 0;
-               //call callback
                midi_input_callbacks(device, 3,
                      device->input_buffer[0], device->input_buffer[1], device->input_buffer[2]);
-               break;
-            case 2:
-               if (device->input_state == TWO_BYTE_MESSAGE) {
-                  device->input_state = IDLE;
-                  //call callback
-                  midi_input_callbacks(device, 2, device->input_buffer[0], device->input_buffer[1], 0);
-               }
-               break;
-            case 1:
-            default:
-               //shouldn't happen
+            }
+            break;
+#endif
+         default:
+            device->input_buffer[device->input_count++] = input;
+            if (device->input_count == (uint8_t)device->input_state) {
+               uint8_t cnt = device->input_count;
                device->input_state = IDLE;
-               break;
-         }
+               device->input_count = 0;
+               midi_input_callbacks(device, cnt, device->input_buffer[0], device->input_buffer[1],
+                     (cnt == 3) ? device->input_buffer[2] : 0);
+            }
+            break;
       }
    }
 }
 
+//what to switch on to find the callback for a message: the status without
+//its channel for channel messages, all of it for system messages
+static inline uint8_t midi_input_kind(uint8_t byte0) {
+   return (byte0 < SYSEX_BEGIN) ? (byte0 & 0xF0) : byte0;
+}
+
 void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
 #ifdef DEBUG
       printf("callback func %d %x %x %x\n", cnt, byte0, byte1, byte2);
+#endif
+#if MIDI_STATS
+   device->stats.messages++;
 #endif
    //did we end up calling a callback?
    bool called = false;
    switch (cnt) {
+#if MIDI_CHANNEL_CALLBACKS || MIDI_SYSCOMMON_CALLBACKS
       case 3:
          {
             midi_three_byte_func_t func = NULL;
-            switch (byte0 & 0xF0) {
+            switch (midi_input_kind(byte0)) {
+#if MIDI_CHANNEL_CALLBACKS
                case MIDI_CC:
-                  func = device->input_cc_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, cc);
                   break;
                case MIDI_NOTEON:
-                  func = device->input_noteon_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, noteon);
                   break;
                case MIDI_NOTEOFF:
-                  func = device->input_noteoff_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, noteoff);
                   break;
                case MIDI_AFTERTOUCH:
-                  func = device->input_aftertouch_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, aftertouch);
                   break;
                case MIDI_PITCHBEND:
-                  func = device->input_pitchbend_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, pitchbend);
                   break;
+#endif
+#if MIDI_SYSCOMMON_CALLBACKS
                case MIDI_SONGPOSITION:
-                  func = device->input_songposition_callback;
+                  func = MIDI_CALLBACK(device, midi_three_byte_func_t, songposition);
                   break;
+#endif
                default:
                   break;
             }
@@ -209,19 +397,23 @@ void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8
       case 2:
          {
             midi_two_byte_func_t func = NULL;
-            switch (byte0 & 0xF0) {
+            switch (midi_input_kind(byte0)) {
+#if MIDI_CHANNEL_CALLBACKS
                case MIDI_PROGCHANGE:
-                  func = device->input_progchange_callback;
+                  func = MIDI_CALLBACK(device, midi_two_byte_func_t, progchange);
                   break;
                case MIDI_CHANPRESSURE:
-                  func = device->input_chanpressure_callback;
+                  func = MIDI_CALLBACK(device, midi_two_byte_func_t, chanpressure);
                   break;
+#endif
+#if MIDI_SYSCOMMON_CALLBACKS
                case MIDI_SONGSELECT:
-                  func = device->input_songselect_callback;
+                  func = MIDI_CALLBACK(device, midi_two_byte_func_t, songselect);
                   break;
                case MIDI_TC_QUATERFRAME:
-                  func = device->input_tc_quaterframe_callback;
+                  func = MIDI_CALLBACK(device, midi_two_byte_func_t, tc_quaterframe);
                   break;
+#endif
                default:
                   break;
             }
@@ -231,19 +423,26 @@ void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8
             }
          }
          break;
+#endif
+#if MIDI_REALTIME_CALLBACKS || MIDI_SYSCOMMON_CALLBACKS
       case 1:
          {
             midi_one_byte_func_t func = NULL;
+#if MIDI_REALTIME_CALLBACKS
             if (midi_is_realtime(byte0))
-               func = device->input_realtime_callback;
-            else if (byte0 == MIDI_TUNEREQUEST)
-               func = device->input_tunerequest_callback;
+               func = MIDI_CALLBACK(device, midi_one_byte_func_t, realtime);
+#endif
+#if MIDI_SYSCOMMON_CALLBACKS
+            if (byte0 == MIDI_TUNEREQUEST)
+               func = MIDI_CALLBACK(device, midi_one_byte_func_t, tunerequest);
+#endif
             if (func) {
                func(device, byte0);
                called = true;
             }
          }
          break;
+#endif
       default:
          //just in case
          if (cnt > 3)
@@ -251,12 +450,23 @@ void midi_input_callbacks(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8
          break;
    }
 
+#if MIDI_FALLTHROUGH_CALLBACK
    //if there is fallthrough default callback and we haven't called a more specific one, 
    //call the fallthrough
-   if (!called && device->input_fallthrough_callback)
-      device->input_fallthrough_callback(device, cnt, byte0, byte1, byte2);
+   if (!called) {
+      midi_var_byte_func_t func = MIDI_CALLBACK(device, midi_var_byte_func_t, fallthrough);
+      if (func)
+         func(device, cnt, byte0, byte1, byte2);
+   }
+#else
+   (void)called;
+#endif
+#if MIDI_CATCHALL_CALLBACK
    //always call the catch all if it exists
-   if (device->input_catchall_callback)
-      device->input_catchall_callback(device, cnt, byte0, byte1, byte2);
+   {
+      midi_var_byte_func_t func = MIDI_CALLBACK(device, midi_var_byte_func_t, catchall);
+      if (func)
+         func(device, cnt, byte0, byte1, byte2);
+   }
+#endif
 }
-
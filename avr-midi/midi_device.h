@@ -1,9 +1,9 @@
 #ifndef MIDI_DEVICE_H
 #define MIDI_DEVICE_H
 
+#include "midi_config.h"
 #include "midi_function_types.h"
 #include "bytequeue/bytequeue.h"
-#define MIDI_INPUT_QUEUE_LENGTH 192
 
 typedef enum {
    IDLE, 
@@ -11,6 +11,58 @@ typedef enum {
    THREE_BYTE_MESSAGE = 3,
    SYSEX_MESSAGE} input_state_t;
 
+#if MIDI_STATS
+typedef struct {
+   //messages passed to the callbacks, sysex counts once per 3 bytes
+   uint16_t messages;
+   //input bytes lost to a full queue
+   uint16_t dropped;
+   //the most bytes the queue has held
+   byteQueueIndex_t max_queued;
+} midi_device_stats_t;
+#endif
+
+#if MIDI_OPS_TABLE
+//a device's input callbacks, set once and shared by any number of devices.
+//Declare tables MIDI_OPS_PROGMEM const so that on the avr they stay in
+//flash, leave the callbacks you don't want NULL.
+//The callbacks are the same as the midi_register_*_callback ones, see
+//midi.h, and only the ones midi_config.h leaves in exist.
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define MIDI_OPS_PROGMEM PROGMEM
+#else
+#define MIDI_OPS_PROGMEM
+#endif
+
+struct _midi_device_ops {
+#if MIDI_CHANNEL_CALLBACKS
+   midi_three_byte_func_t cc;
+   midi_three_byte_func_t noteon;
+   midi_three_byte_func_t noteoff;
+   midi_three_byte_func_t aftertouch;
+   midi_three_byte_func_t pitchbend;
+   midi_two_byte_func_t progchange;
+   midi_two_byte_func_t chanpressure;
+#endif
+#if MIDI_SYSCOMMON_CALLBACKS
+   midi_three_byte_func_t songposition;
+   midi_two_byte_func_t songselect;
+   midi_two_byte_func_t tc_quaterframe;
+   midi_one_byte_func_t tunerequest;
+#endif
+#if MIDI_REALTIME_CALLBACKS
+   midi_one_byte_func_t realtime;
+#endif
+#if MIDI_FALLTHROUGH_CALLBACK
+   midi_var_byte_func_t fallthrough;
+#endif
+#if MIDI_CATCHALL_CALLBACK
+   midi_var_byte_func_t catchall;
+#endif
+};
+#endif
+
 //this structure represents the input and output functions and processing data
 //for a midi device.
 //A device can represent an actual physical device [serial port, usb port] or
@@ -19,28 +71,44 @@ typedef enum {
 struct _midi_device {
    //output send function
 	midi_var_byte_func_t send_func;
+   //output for whole spans of bytes, NULL if the device only has send_func
+   midi_buffer_func_t send_buffer_func;
 
-   //********input callbacks
+#if MIDI_OPS_TABLE
+   //********input callbacks, in a table that can be shared
+   const MidiDeviceOps * ops;
+#else
+   //********input callbacks, see midi_config.h for which of these exist
+#if MIDI_CHANNEL_CALLBACKS
    //three byte funcs
    midi_three_byte_func_t input_cc_callback;
    midi_three_byte_func_t input_noteon_callback;
    midi_three_byte_func_t input_noteoff_callback;
    midi_three_byte_func_t input_aftertouch_callback;
    midi_three_byte_func_t input_pitchbend_callback;
-   midi_three_byte_func_t input_songposition_callback;
    //two byte funcs
    midi_two_byte_func_t input_progchange_callback;
    midi_two_byte_func_t input_chanpressure_callback;
+#endif
+#if MIDI_SYSCOMMON_CALLBACKS
+   midi_three_byte_func_t input_songposition_callback;
    midi_two_byte_func_t input_songselect_callback;
    midi_two_byte_func_t input_tc_quaterframe_callback;
-   //one byte funcs
-   midi_one_byte_func_t input_realtime_callback;
    midi_one_byte_func_t input_tunerequest_callback;
+#endif
+#if MIDI_REALTIME_CALLBACKS
+   midi_one_byte_func_t input_realtime_callback;
+#endif
 
+#if MIDI_FALLTHROUGH_CALLBACK
    //only called if more specific callback is not matched
    midi_var_byte_func_t input_fallthrough_callback;
+#endif
+#if MIDI_CATCHALL_CALLBACK
    //called if registered, independent of other callbacks
    midi_var_byte_func_t input_catchall_callback;
+#endif
+#endif
 
    //for internal input processing
    uint8_t input_buffer[3];
@@ -48,16 +116,60 @@ struct _midi_device {
    uint8_t input_count;
 
    //for queueing data between the input and the processing functions
+#if MIDI_INPUT_QUEUE_LENGTH > 0
    uint8_t input_queue_data[MIDI_INPUT_QUEUE_LENGTH];
+#endif
    byteQueue_t input_queue;
+
+#if MIDI_STATS
+   midi_device_stats_t stats;
+#endif
 };
 
-//input processing, only used if you're creating a custom device
+//a stream of input that comes a byte at a time [a uart] put together into
+//whole messages, so that it can share a device with other input.  One for
+//each stream, see midi_device_input_byte.
+typedef struct {
+   uint8_t bytes[3];
+   uint8_t count;
+   //the kind of message we're putting together
+   input_state_t state;
+#if MIDI_RUNNING_STATUS
+   //the last channel status, 0 for none
+   uint8_t running;
+#endif
+} midi_input_framer_t;
+
+//input processing, only used if you're creating a custom device.
+//Any number of interrupts can queue input at once, each call is queued
+//whole, or dropped whole if the queue doesn't have room for it.  So each
+//call has to be a whole message, with its status byte [or up to 3 bytes of
+//sysex], or another interrupt's input can land inside it and the parser
+//makes garbage of both.
 void midi_device_input(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+//input that comes a byte at a time, held in the framer until it makes a
+//whole message, which is then queued with midi_device_input.  Running status
+//is filled in, so that another producer's messages don't change it.
+//Realtime bytes are queued straight away.  Sysex is still queued 3 bytes at
+//a time: another producer's message in the middle of one ends it, as it
+//would on the wire.
+void midi_input_framer_init(midi_input_framer_t * framer);
+void midi_device_input_byte(MidiDevice * device, midi_input_framer_t * framer, uint8_t input);
 //set send function, only used if you're creating a custom device
 //you'll most likely want the function that this calls to disable interrupts so
 //that you can call the various midi send functions without worrying about
 //locking.
 void midi_device_set_send_func(MidiDevice * device, midi_var_byte_func_t send_func);
+//set the bulk send function, optional, only used if you're creating a custom
+//device that can do better with many messages at once than with one
+//send_func call for each [see midi_send_buffer].  It gets whole messages,
+//possibly with running status.
+void midi_device_set_send_buffer_func(MidiDevice * device, midi_buffer_func_t send_buffer_func);
+
+#if MIDI_STATS
+//counters since the device was initialized or the last reset
+const midi_device_stats_t * midi_device_stats(MidiDevice * device);
+void midi_device_reset_stats(MidiDevice * device);
+#endif
 
 #endif
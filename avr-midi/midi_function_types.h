@@ -6,11 +6,14 @@
 
 //forward declaration
 typedef struct _midi_device MidiDevice;
+typedef struct _midi_device_ops MidiDeviceOps;
 
 typedef void (* midi_one_byte_func_t)(MidiDevice * device, uint8_t byte);
 typedef void (* midi_two_byte_func_t)(MidiDevice * device, uint8_t byte0, uint8_t byte1);
 typedef void (* midi_three_byte_func_t)(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2);
 //all bytes after count bytes should be ignored
 typedef void (* midi_var_byte_func_t)(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+//a span of raw midi bytes
+typedef void (* midi_buffer_func_t)(MidiDevice * device, const uint8_t * data, uint16_t length);
 
 #endif
@@ -0,0 +1,301 @@
+//header only c++ midi parser with compile time callbacks
+//
+//midi::Parser<Handler> is the state machine of midi_process_byte
+//[midi_device.c], it splits the input into the same messages in the same
+//order, but it calls methods of a handler type it knows at compile time
+//instead of function pointers it finds in a MidiDevice.  The calls can be
+//inlined and the ones the handler doesn't have compile away.
+//
+//derive your handler from midi::Handler and declare the callbacks you want,
+//with the same names and arguments as the MidiDevice ones [without the
+//device]:
+//
+//   struct Notes : midi::Handler {
+//      void noteon(uint8_t status, uint8_t num, uint8_t vel) { ... }
+//      void noteoff(uint8_t status, uint8_t num, uint8_t vel) { ... }
+//   };
+//   Notes notes;
+//   midi::Parser<Notes> parser(notes);
+//   parser.process(data, length);
+//
+//a callback the handler declares counts as registered: like with the C
+//parser, fallthrough is only called for messages that don't have one, and
+//catchall for every message.
+//
+//MIDI_SYSEX and MIDI_RUNNING_STATUS from midi_config.h apply here too.  It
+//needs c++17 and nothing from the c++ library, so avr-g++ builds it as well
+//as g++.
+
+#ifndef MIDI_PARSER_HPP
+#define MIDI_PARSER_HPP
+
+#include <stddef.h>
+#include <inttypes.h>
+
+extern "C" {
+#include "midi.h"
+}
+
+namespace midi {
+
+//the callbacks a handler can have, these do nothing and count as missing
+struct Handler {
+   void cc(uint8_t, uint8_t, uint8_t) {}
+   void noteon(uint8_t, uint8_t, uint8_t) {}
+   void noteoff(uint8_t, uint8_t, uint8_t) {}
+   void aftertouch(uint8_t, uint8_t, uint8_t) {}
+   void pitchbend(uint8_t, uint8_t, uint8_t) {}
+   void songposition(uint8_t, uint8_t, uint8_t) {}
+   void progchange(uint8_t, uint8_t) {}
+   void chanpressure(uint8_t, uint8_t) {}
+   void songselect(uint8_t, uint8_t) {}
+   void tc_quaterframe(uint8_t, uint8_t) {}
+   void realtime(uint8_t) {}
+   void tunerequest(uint8_t) {}
+   void fallthrough(uint8_t, uint8_t, uint8_t, uint8_t) {}
+   void catchall(uint8_t, uint8_t, uint8_t, uint8_t) {}
+};
+
+namespace detail {
+   template <typename A, typename B> struct same { static constexpr bool value = false; };
+   template <typename A> struct same<A, A> { static constexpr bool value = true; };
+}
+
+//true if H declares the callback itself rather than getting Handler's
+#define MIDI_HANDLER_HAS(H, name) \
+   (!midi::detail::same<decltype(&H::name), decltype(&midi::Handler::name)>::value)
+
+//the same lengths as midi_packet_length
+constexpr uint8_t packet_length(uint8_t status) {
+   switch (status & 0xF0) {
+      case MIDI_CC:
+      case MIDI_NOTEON:
+      case MIDI_NOTEOFF:
+      case MIDI_AFTERTOUCH:
+      case MIDI_PITCHBEND:
+         return 3;
+      case MIDI_PROGCHANGE:
+      case MIDI_CHANPRESSURE:
+         return 2;
+      case 0xF0:
+         switch (status) {
+            case MIDI_SONGPOSITION:
+               return 3;
+            case MIDI_SONGSELECT:
+            case MIDI_TC_QUATERFRAME:
+               return 2;
+            case MIDI_CLOCK:
+            case MIDI_TICK:
+            case MIDI_START:
+            case MIDI_CONTINUE:
+            case MIDI_STOP:
+            case MIDI_ACTIVESENSE:
+            case MIDI_RESET:
+            case MIDI_TUNEREQUEST:
+               return 1;
+            default:
+               return 0;
+         }
+      default:
+         return 0;
+   }
+}
+
+template <typename H>
+class Parser {
+   public:
+      explicit Parser(H & handler) : mHandler(handler) { reset(); }
+
+      //forget any message we're in the middle of, and the running status
+      void reset() {
+         mState = IDLE;
+         mCount = 0;
+         mBuffer[0] = 0;
+      }
+
+      void process(const uint8_t * data, size_t length) {
+         while (length--)
+            process(*data++);
+      }
+
+      void process(uint8_t input) {
+         if (input >= MIDI_CLOCK) {
+            //realtime, don't change any state
+            dispatch(1, input, 0, 0);
+         } else if (input & MIDI_STATUSMASK) {
+#if MIDI_SYSEX
+            if (input == SYSEX_END) {
+               //the rest of the sysex, dropped if there isn't one
+               uint8_t cnt = mCount;
+               bool sysex = mState == SYSEX_MESSAGE;
+               mState = IDLE;
+               mCount = 0;
+               if (sysex) {
+                  mBuffer[cnt++] = input;
+                  dispatch(cnt, mBuffer[0], mBuffer[1], mBuffer[2]);
+               }
+               mBuffer[0] = input;
+               return;
+            }
+#endif
+            //ends whatever came before it, and is the running status if it
+            //is a channel status
+            mBuffer[0] = input;
+            mCount = 1;
+            switch (packet_length(input)) {
+               case 1:
+                  mState = IDLE;
+                  dispatch(1, input, 0, 0);
+                  break;
+               case 2:
+                  mState = TWO_BYTE_MESSAGE;
+                  break;
+               case 3:
+                  mState = THREE_BYTE_MESSAGE;
+                  break;
+               default:
+#if MIDI_SYSEX
+                  if (input == SYSEX_BEGIN) {
+                     mState = SYSEX_MESSAGE;
+                     break;
+                  }
+#endif
+                  mState = IDLE;
+                  mCount = 0;
+                  break;
+            }
+         } else {
+#if MIDI_RUNNING_STATUS
+            if (mState == IDLE && (mBuffer[0] & MIDI_STATUSMASK) && mBuffer[0] < SYSEX_BEGIN) {
+               mState = static_cast<input_state_t>(packet_length(mBuffer[0]));
+               mCount = 1;
+            }
+#endif
+            switch (mState) {
+               case IDLE:
+                  break;
+#if MIDI_SYSEX
+               case SYSEX_MESSAGE:
+                  mBuffer[mCount++] = input;
+                  if (mCount == 3) {
+                     mCount = 0;
+                     dispatch(3, mBuffer[0], mBuffer[1], mBuffer[2]);
+                  }
+                  break;
+#endif
+               default:
+                  mBuffer[mCount++] = input;
+                  if (mCount == static_cast<uint8_t>(mState)) {
+                     uint8_t cnt = mCount;
+                     mState = IDLE;
+                     mCount = 0;
+                     dispatch(cnt, mBuffer[0], mBuffer[1], (cnt == 3) ? mBuffer[2] : 0);
+                  }
+                  break;
+            }
+         }
+      }
+
+   private:
+      //the callbacks, as midi_input_callbacks picks them
+      void dispatch(uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+         bool called = true;
+         switch (cnt) {
+            case 3:
+               switch (byte0 & 0xF0) {
+                  case MIDI_CC:
+                     if constexpr (MIDI_HANDLER_HAS(H, cc)) { mHandler.cc(byte0, byte1, byte2); break; }
+                     called = false;
+                     break;
+                  case MIDI_NOTEON:
+                     if constexpr (MIDI_HANDLER_HAS(H, noteon)) { mHandler.noteon(byte0, byte1, byte2); break; }
+                     called = false;
+                     break;
+                  case MIDI_NOTEOFF:
+                     if constexpr (MIDI_HANDLER_HAS(H, noteoff)) { mHandler.noteoff(byte0, byte1, byte2); break; }
+                     called = false;
+                     break;
+                  case MIDI_AFTERTOUCH:
+                     if constexpr (MIDI_HANDLER_HAS(H, aftertouch)) { mHandler.aftertouch(byte0, byte1, byte2); break; }
+                     called = false;
+                     break;
+                  case MIDI_PITCHBEND:
+                     if constexpr (MIDI_HANDLER_HAS(H, pitchbend)) { mHandler.pitchbend(byte0, byte1, byte2); break; }
+                     called = false;
+                     break;
+                  default:
+                     if constexpr (MIDI_HANDLER_HAS(H, songposition)) {
+                        if (byte0 == MIDI_SONGPOSITION) {
+                           mHandler.songposition(byte0, byte1, byte2);
+                           break;
+                        }
+                     }
+                     called = false;
+                     break;
+               }
+               break;
+            case 2:
+               switch (byte0 & 0xF0) {
+                  case MIDI_PROGCHANGE:
+                     if constexpr (MIDI_HANDLER_HAS(H, progchange)) { mHandler.progchange(byte0, byte1); break; }
+                     called = false;
+                     break;
+                  case MIDI_CHANPRESSURE:
+                     if constexpr (MIDI_HANDLER_HAS(H, chanpressure)) { mHandler.chanpressure(byte0, byte1); break; }
+                     called = false;
+                     break;
+                  default:
+                     if constexpr (MIDI_HANDLER_HAS(H, songselect)) {
+                        if (byte0 == MIDI_SONGSELECT) {
+                           mHandler.songselect(byte0, byte1);
+                           break;
+                        }
+                     }
+                     if constexpr (MIDI_HANDLER_HAS(H, tc_quaterframe)) {
+                        if (byte0 == MIDI_TC_QUATERFRAME) {
+                           mHandler.tc_quaterframe(byte0, byte1);
+                           break;
+                        }
+                     }
+                     called = false;
+                     break;
+               }
+               break;
+            case 1:
+               if constexpr (MIDI_HANDLER_HAS(H, realtime)) {
+                  if (byte0 >= MIDI_CLOCK) {
+                     mHandler.realtime(byte0);
+                     break;
+                  }
+               }
+               if constexpr (MIDI_HANDLER_HAS(H, tunerequest)) {
+                  if (byte0 == MIDI_TUNEREQUEST) {
+                     mHandler.tunerequest(byte0);
+                     break;
+                  }
+               }
+               called = false;
+               break;
+            default:
+               called = false;
+               break;
+         }
+
+         if constexpr (MIDI_HANDLER_HAS(H, fallthrough)) {
+            if (!called)
+               mHandler.fallthrough(cnt, byte0, byte1, byte2);
+         }
+         if constexpr (MIDI_HANDLER_HAS(H, catchall))
+            mHandler.catchall(cnt, byte0, byte1, byte2);
+         (void)called;
+      }
+
+      H & mHandler;
+      uint8_t mBuffer[3];
+      input_state_t mState;
+      uint8_t mCount;
+};
+
+}
+
+#endif
@@ -0,0 +1,165 @@
+//typed ring buffers, generated for each element type
+//
+//RING_DEFINE(name, type, index_t, capacity) makes name_t, a ring of
+//capacity elements of type counted with index_t, and these functions for
+//it, all static inline so that the compiler sees through them:
+//
+//   void name_init(name_t * ring)
+//   index_t name_length(const name_t * ring)   elements in it
+//   index_t name_space(const name_t * ring)    room left
+//   bool name_push(name_t * ring, const type * item)
+//   bool name_pop(name_t * ring, type * item)  item can be NULL to drop one
+//   type * name_peek(name_t * ring, index_t index)
+//                                              the index'th oldest element,
+//                                              index less than the length
+//   index_t name_push_many(name_t * ring, const type * items, index_t count)
+//   index_t name_pop_many(name_t * ring, type * items, index_t count)
+//                                              as many as there are, or
+//                                              room for, returns how many
+//
+//and to work on the elements where they are, a span is as many elements as
+//are next to each other in memory before the end of the ring wraps around:
+//
+//   type * name_read_span(name_t * ring, index_t * length)
+//   void name_consume(name_t * ring, index_t count)
+//                                              the oldest elements, and
+//                                              taking count of them out
+//   type * name_write_span(name_t * ring, index_t * length)
+//   void name_commit(name_t * ring, index_t count)
+//                                              free room, and putting count
+//                                              elements written there in
+//
+//capacity has to be a power of two, at most half of what index_t counts to
+//[128 for uint8_t, 32768 for uint16_t], the in and out counts run freely
+//and their difference tells full from empty without a wasted element.
+//
+//one writer and one reader, which can be an interrupt if index_t is read
+//and written in one go [uint8_t on the avr].  Each side only writes its own
+//count, after it is done with the elements.
+
+#ifndef RING_H
+#define RING_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+//keeps the compiler from moving element accesses past a count update
+#define RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+#define RING_DEFINE(name, type, index_t, capacity) \
+   typedef char name##_capacity_check[ \
+      ((capacity) > 0 && ((capacity) & ((capacity) - 1)) == 0 && \
+       (unsigned long)(capacity) - 1 <= (unsigned long)(index_t)~(index_t)0 / 2) ? 1 : -1]; \
+   \
+   typedef struct { \
+      type data[capacity]; \
+      volatile index_t in; \
+      volatile index_t out; \
+   } name##_t; \
+   \
+   static inline void name##_init(name##_t * ring) { \
+      ring->in = ring->out = 0; \
+   } \
+   \
+   static inline index_t name##_length(const name##_t * ring) { \
+      return (index_t)(ring->in - ring->out); \
+   } \
+   \
+   static inline index_t name##_space(const name##_t * ring) { \
+      return (index_t)((capacity) - name##_length(ring)); \
+   } \
+   \
+   static inline type * name##_read_span(name##_t * ring, index_t * length) { \
+      index_t out = ring->out; \
+      index_t at = out & ((capacity) - 1); \
+      index_t count = (index_t)(ring->in - out); \
+      RING_BARRIER(); \
+      if (count > (capacity) - at) \
+         count = (capacity) - at; \
+      *length = count; \
+      return &ring->data[at]; \
+   } \
+   \
+   static inline void name##_consume(name##_t * ring, index_t count) { \
+      RING_BARRIER(); \
+      ring->out = (index_t)(ring->out + count); \
+   } \
+   \
+   static inline type * name##_write_span(name##_t * ring, index_t * length) { \
+      index_t in = ring->in; \
+      index_t at = in & ((capacity) - 1); \
+      index_t count = (index_t)((capacity) - (index_t)(in - ring->out)); \
+      RING_BARRIER(); \
+      if (count > (capacity) - at) \
+         count = (capacity) - at; \
+      *length = count; \
+      return &ring->data[at]; \
+   } \
+   \
+   static inline void name##_commit(name##_t * ring, index_t count) { \
+      RING_BARRIER(); \
+      ring->in = (index_t)(ring->in + count); \
+   } \
+   \
+   static inline bool name##_push(name##_t * ring, const type * item) { \
+      index_t in = ring->in; \
+      if ((index_t)(in - ring->out) == (capacity)) \
+         return false; \
+      RING_BARRIER(); \
+      ring->data[in & ((capacity) - 1)] = *item; \
+      RING_BARRIER(); \
+      ring->in = (index_t)(in + 1); \
+      return true; \
+   } \
+   \
+   static inline bool name##_pop(name##_t * ring, type * item) { \
+      index_t out = ring->out; \
+      if (out == ring->in) \
+         return false; \
+      RING_BARRIER(); \
+      if (item) \
+         *item = ring->data[out & ((capacity) - 1)]; \
+      RING_BARRIER(); \
+      ring->out = (index_t)(out + 1); \
+      return true; \
+   } \
+   \
+   static inline type * name##_peek(name##_t * ring, index_t index) { \
+      return &ring->data[(index_t)(ring->out + index) & ((capacity) - 1)]; \
+   } \
+   \
+   static inline index_t name##_push_many(name##_t * ring, const type * items, index_t count) { \
+      index_t done = 0; \
+      while (done < count) { \
+         index_t length; \
+         type * span = name##_write_span(ring, &length); \
+         if (!length) \
+            break; \
+         if (length > count - done) \
+            length = count - done; \
+         memcpy(span, items + done, length * sizeof(type)); \
+         name##_commit(ring, length); \
+         done += length; \
+      } \
+      return done; \
+   } \
+   \
+   static inline index_t name##_pop_many(name##_t * ring, type * items, index_t count) { \
+      index_t done = 0; \
+      while (done < count) { \
+         index_t length; \
+         type * span = name##_read_span(ring, &length); \
+         if (!length) \
+            break; \
+         if (length > count - done) \
+            length = count - done; \
+         memcpy(items + done, span, length * sizeof(type)); \
+         name##_consume(ring, length); \
+         done += length; \
+      } \
+      return done; \
+   }
+
+#endif
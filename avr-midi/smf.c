@@ -0,0 +1,329 @@
+#include "smf.h"
+
+//most events smf_send_due hands to midi_send_events at once
+#define SMF_SEND_BATCH 8
+
+//file access ******************
+
+static uint32_t smf_be(const uint8_t * data, uint8_t bytes) {
+   uint32_t value = 0;
+   while (bytes--)
+      value = (value << 8) | *data++;
+   return value;
+}
+
+//the next byte of a track, false at its end
+static bool smf_track_byte(smf_player_t * player, smf_track_t * track, uint8_t * b) {
+   if (track->buffer_at == track->buffer_length) {
+      uint32_t left = track->end - track->offset;
+      uint16_t got;
+      if (!left)
+         return false;
+      got = player->read(player->context, track->offset, track->buffer,
+            (left > SMF_TRACK_BUFFER) ? SMF_TRACK_BUFFER : left);
+      if (!got)
+         return false;
+      track->offset += got;
+      track->buffer_at = 0;
+      track->buffer_length = got;
+   }
+   *b = track->buffer[track->buffer_at++];
+   return true;
+}
+
+static void smf_track_skip(smf_track_t * track, uint32_t length) {
+   uint8_t buffered = track->buffer_length - track->buffer_at;
+   if (length <= buffered) {
+      track->buffer_at += length;
+      return;
+   }
+   length -= buffered;
+   track->buffer_at = track->buffer_length;
+   if (length > track->end - track->offset)
+      length = track->end - track->offset;
+   track->offset += length;
+}
+
+//a variable length quantity, at most 4 bytes
+static bool smf_track_vlq(smf_player_t * player, smf_track_t * track, uint32_t * value) {
+   uint8_t i, b;
+   *value = 0;
+   for (i = 0; i < 4; i++) {
+      if (!smf_track_byte(player, track, &b))
+         return false;
+      *value = (*value << 7) | (b & 0x7F);
+      if (!(b & 0x80))
+         return true;
+   }
+   return false;
+}
+
+//the heap ******************
+
+//which of two tracks plays first
+static bool smf_before(const smf_player_t * player, uint8_t a, uint8_t b) {
+   const smf_track_t * tracks = player->tracks;
+   return tracks[a].tick < tracks[b].tick || (tracks[a].tick == tracks[b].tick && a < b);
+}
+
+static void smf_sift_down(smf_player_t * player, uint8_t at) {
+   smf_track_t * tracks = player->tracks;
+   uint8_t track = tracks[at].heap;
+   while (1) {
+      uint16_t child = 2 * at + 1;
+      if (child >= player->heap_length)
+         break;
+      if (child + 1 < player->heap_length && smf_before(player, tracks[child + 1].heap, tracks[child].heap))
+         child++;
+      if (!smf_before(player, tracks[child].heap, track))
+         break;
+      tracks[at].heap = tracks[child].heap;
+      at = child;
+   }
+   tracks[at].heap = track;
+}
+
+static void smf_sift_up(smf_player_t * player, uint8_t at) {
+   smf_track_t * tracks = player->tracks;
+   uint8_t track = tracks[at].heap;
+   while (at) {
+      uint8_t parent = (at - 1) / 2;
+      if (!smf_before(player, track, tracks[parent].heap))
+         break;
+      tracks[at].heap = tracks[parent].heap;
+      at = parent;
+   }
+   tracks[at].heap = track;
+}
+
+//read the delta time of the track on top of the heap and put it back in
+//its place, or take it out if it has ended
+static void smf_advance(smf_player_t * player) {
+   smf_track_t * track = &player->tracks[player->tracks[0].heap];
+   uint32_t delta;
+   if (smf_track_vlq(player, track, &delta)) {
+      track->tick += delta;
+   } else {
+      player->heap_length--;
+      player->tracks[0].heap = player->tracks[player->heap_length].heap;
+   }
+   smf_sift_down(player, 0);
+}
+
+//time ******************
+
+static uint32_t smf_time(smf_player_t * player, uint32_t tick) {
+   return player->tempo_time +
+      (uint32_t)((uint64_t)(tick - player->tempo_tick) * player->tempo / player->division);
+}
+
+//opening ******************
+
+bool smf_open(smf_player_t * player, smf_track_t * tracks, uint8_t max_tracks,
+      smf_read_func_t read, void * context) {
+   uint8_t header[14];
+   uint32_t offset;
+   uint16_t format, count, found = 0;
+   uint8_t i;
+
+   player->read = read;
+   player->context = context;
+   player->tracks = tracks;
+   player->track_count = 0;
+   player->heap_length = 0;
+   player->sysex_left = 0;
+   player->sysex_begin = false;
+   smf_queue_init(&player->queue);
+
+   if (read(context, 0, header, 14) != 14 ||
+         header[0] != 'M' || header[1] != 'T' || header[2] != 'h' || header[3] != 'd')
+      return false;
+   format = smf_be(header + 8, 2);
+   count = smf_be(header + 10, 2);
+   player->division = smf_be(header + 12, 2);
+   if (format > 1 || !count || count > max_tracks || !player->division)
+      return false;
+
+   player->tempo = 500000;
+   player->tempo_tick = 0;
+   player->tempo_time = 0;
+   player->smpte = (player->division & 0x8000) != 0;
+   if (player->smpte) {
+      //smpte, frames a second times ticks a frame is ticks a second and the
+      //tempo stays at a second.  30 drop frame counts as 30.
+      uint8_t fps = -(int8_t)(player->division >> 8);
+      if (fps == 29)
+         fps = 30;
+      player->division = fps * (player->division & 0xFF);
+      player->tempo = 1000000;
+      if (!player->division)
+         return false;
+   }
+
+   //find the tracks, skipping any other chunks
+   offset = 8 + smf_be(header + 4, 4);
+   while (found < count) {
+      uint32_t length;
+      if (read(context, offset, header, 8) != 8)
+         break;
+      length = smf_be(header + 4, 4);
+      if (header[0] == 'M' && header[1] == 'T' && header[2] == 'r' && header[3] == 'k') {
+         smf_track_t * track = &tracks[found++];
+         track->offset = offset + 8;
+         track->end = offset + 8 + length;
+         track->tick = 0;
+         track->running = 0;
+         track->buffer_at = track->buffer_length = 0;
+      }
+      offset += 8 + length;
+   }
+   player->track_count = found;
+
+   for (i = 0; i < found; i++) {
+      if (smf_track_vlq(player, &tracks[i], &tracks[i].tick)) {
+         tracks[player->heap_length].heap = i;
+         smf_sift_up(player, player->heap_length++);
+      }
+   }
+   return true;
+}
+
+//playing ******************
+
+//only called when there is room
+static void smf_queue_event(smf_player_t * player, uint32_t due, uint8_t length, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   smf_queued_t queued;
+   queued.due = due;
+   queued.event.length = length;
+   queued.event.data[0] = byte0;
+   queued.event.data[1] = byte1;
+   queued.event.data[2] = byte2;
+   smf_queue_push(&player->queue, &queued);
+}
+
+bool smf_fill(smf_player_t * player) {
+   while (smf_queue_space(&player->queue)) {
+      smf_track_t * track;
+      uint8_t b, data[3] = {0, 0, 0}, length = 0;
+      uint32_t size;
+
+      if (player->sysex_left || player->sysex_begin) {
+         //a sysex, 3 bytes at a time like usb carries it
+         track = &player->tracks[player->tracks[0].heap];
+         if (player->sysex_begin) {
+            data[length++] = SYSEX_BEGIN;
+            player->sysex_begin = false;
+         }
+         while (length < 3 && player->sysex_left) {
+            if (!smf_track_byte(player, track, &data[length]))
+               player->sysex_left = 1;
+            else
+               length++;
+            player->sysex_left--;
+         }
+         if (length)
+            smf_queue_event(player, player->sysex_due, length, data[0], data[1], data[2]);
+         if (!player->sysex_left)
+            smf_advance(player);
+         continue;
+      }
+
+      if (!player->heap_length)
+         return false;
+      track = &player->tracks[player->tracks[0].heap];
+      if (!smf_track_byte(player, track, &b)) {
+         smf_advance(player);
+         continue;
+      }
+
+      if (b < 0x80 && track->running) {
+         //running status
+         data[length++] = track->running;
+         data[length++] = b;
+      } else if (b >= 0x80 && b < 0xF0) {
+         track->running = b;
+         data[length++] = b;
+      }
+
+      if (length) {
+         //a channel message
+         uint8_t want = midi_packet_length(data[0]);
+         while (length < want && smf_track_byte(player, track, &data[length]))
+            length++;
+         if (length == want)
+            smf_queue_event(player, smf_time(player, track->tick), length, data[0], data[1], data[2]);
+         smf_advance(player);
+         continue;
+      }
+
+      //sysex and meta events cancel running status
+      track->running = 0;
+      if ((b == SYSEX_BEGIN || b == SYSEX_END) && smf_track_vlq(player, track, &size)) {
+         //sysex, with F0 in front unless it is an escape, queued from the top
+         //of the loop
+         player->sysex_left = size;
+         player->sysex_due = smf_time(player, track->tick);
+         player->sysex_begin = (b == SYSEX_BEGIN);
+         if (!size && !player->sysex_begin)
+            smf_advance(player);
+      } else if (b == 0xFF && smf_track_byte(player, track, &b) && smf_track_vlq(player, track, &size)) {
+         if (b == 0x2F) {
+            //end of track
+            track->offset = track->end;
+            track->buffer_at = track->buffer_length;
+         } else if (b == 0x51 && size == 3 && !player->smpte) {
+            //tempo, from this tick on
+            uint8_t i;
+            uint32_t tempo = 0;
+            for (i = 0; i < 3 && smf_track_byte(player, track, &b); i++)
+               tempo = (tempo << 8) | b;
+            player->tempo_time = smf_time(player, track->tick);
+            player->tempo_tick = track->tick;
+            if (tempo)
+               player->tempo = tempo;
+         } else {
+            smf_track_skip(track, size);
+         }
+         smf_advance(player);
+      } else {
+         //not something a track can have, it must be broken, end it
+         track->offset = track->end;
+         track->buffer_at = track->buffer_length;
+         smf_advance(player);
+      }
+   }
+   return true;
+}
+
+uint8_t smf_send_due(smf_player_t * player, MidiDevice * device, uint32_t now) {
+   midi_event_t events[SMF_SEND_BATCH];
+   uint8_t count = 0, sent = 0;
+
+   while (smf_queue_length(&player->queue)) {
+      smf_queued_t * queued = smf_queue_peek(&player->queue, 0);
+      if ((int32_t)(now - queued->due) < 0)
+         break;
+      events[count++] = queued->event;
+      smf_queue_pop(&player->queue, NULL);
+      if (count == SMF_SEND_BATCH) {
+         midi_send_events(device, events, count);
+         sent += count;
+         count = 0;
+      }
+   }
+   if (count)
+      midi_send_events(device, events, count);
+   return sent + count;
+}
+
+bool smf_next_due(smf_player_t * player, uint32_t * due) {
+   if (!smf_queue_length(&player->queue))
+      return false;
+   *due = smf_queue_peek(&player->queue, 0)->due;
+   return true;
+}
+
+bool smf_done(smf_player_t * player) {
+   return !player->heap_length && !player->sysex_left && !player->sysex_begin &&
+      !smf_queue_length(&player->queue);
+}
@@ -0,0 +1,93 @@
+//streaming standard midi file player
+//
+//the file is never loaded, it is read a few bytes at a time through a read
+//function so it can be in flash, on a card or on disk.  Each track has a
+//cursor with its position, running status and the absolute tick of its
+//next event, and the cursors sit in a min heap on that tick so that the
+//tracks of a format 0 or 1 file come out merged in time order [the lower
+//track first on the same tick].  Memory is the player plus an smf_track_t
+//per track, whatever the length of the file.
+//
+//playing is two halves:
+//   smf_fill      decode events into the send queue until it is full, call
+//                 it from the main loop
+//   smf_send_due  send the queued events that are due with
+//                 midi_send_events, call it from a timer [a scheduler task
+//                 for instance]
+//one of each can run at the same time, the queue has a single writer and a
+//single reader.  Times are in microseconds from the start of the file,
+//tempo changes are followed, and the sysex in the file is sent in 3 byte
+//pieces.  SMF_TRACK_BUFFER and SMF_SEND_QUEUE are in midi_config.h.
+
+#ifndef SMF_H
+#define SMF_H
+
+#include "midi.h"
+#include "ring.h"
+
+//copy up to length bytes from offset in the file to data, return how many
+typedef uint16_t (* smf_read_func_t)(void * context, uint32_t offset, uint8_t * data, uint16_t length);
+
+typedef struct {
+   //file offset of the next byte after the buffer, and of the track's end
+   uint32_t offset;
+   uint32_t end;
+   //absolute tick of the next event
+   uint32_t tick;
+   uint8_t running;
+   //the track at this place in the heap [not this track's place]
+   uint8_t heap;
+   uint8_t buffer_at;
+   uint8_t buffer_length;
+   uint8_t buffer[SMF_TRACK_BUFFER];
+} smf_track_t;
+
+typedef struct {
+   uint32_t due;
+   midi_event_t event;
+} smf_queued_t;
+
+RING_DEFINE(smf_queue, smf_queued_t, uint8_t, SMF_SEND_QUEUE)
+
+typedef struct {
+   smf_read_func_t read;
+   void * context;
+   smf_track_t * tracks;
+   uint8_t track_count;
+   //tracks that haven't ended
+   uint8_t heap_length;
+
+   //ticks per quarter note [or per second for smpte files, which have no
+   //tempo], microseconds per quarter note and where the tempo last changed
+   bool smpte;
+   uint16_t division;
+   uint32_t tempo;
+   uint32_t tempo_tick;
+   uint32_t tempo_time;
+
+   //what is left of a sysex event we're in the middle of queueing, F0 is
+   //still to go in front of it if sysex_begin is set
+   uint32_t sysex_left;
+   uint32_t sysex_due;
+   bool sysex_begin;
+
+   //written by smf_fill, read by smf_send_due
+   smf_queue_t queue;
+} smf_player_t;
+
+//read the header and find the tracks, tracks must have room for
+//max_tracks and stay around as long as the player does.  Returns false if
+//it isn't a format 0 or 1 midi file or it has more tracks than that.
+bool smf_open(smf_player_t * player, smf_track_t * tracks, uint8_t max_tracks,
+      smf_read_func_t read, void * context);
+
+//queue decoded events, returns false once everything is queued
+bool smf_fill(smf_player_t * player);
+//send the queued events due at now, returns how many were sent
+uint8_t smf_send_due(smf_player_t * player, MidiDevice * device, uint32_t now);
+//time of the next queued event, false if none is queued
+bool smf_next_due(smf_player_t * player, uint32_t * due);
+//true when every event has been sent
+bool smf_done(smf_player_t * player);
+
+#endif
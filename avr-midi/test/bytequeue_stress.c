@@ -0,0 +1,186 @@
+//several writers on one bytequeue, threads standing in for interrupts that
+//interrupt each other
+//
+//each writer queues messages of 2 to 6 bytes: a byte with its number and
+//the length, then its count of messages so far in every other byte.  Now
+//and then it gives up the cpu while it holds a reservation, so that the
+//others get in.  The reader checks that every message comes out whole, that
+//each writer's come out in order and that it never sees part of a message.
+//
+//then noteons through midi_device_input and midi_process, where messages
+//that don't fit are dropped: the ones that get through have to be whole
+//and in order.  Writer 0 stands in for a uart, it queues a byte at a time
+//through midi_device_input_byte and mostly leaves out the status.
+//
+//   ./bytequeue_test [writers] [messages each]
+#include "midi.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_WRITERS 8
+#define QUEUE_LENGTH 255
+
+static byteQueue_t queue;
+static uint8_t queue_data[QUEUE_LENGTH];
+static unsigned writers = 4;
+static unsigned long messages = 50000;
+static volatile unsigned writers_done;
+
+static void * raw_writer(void * arg) {
+   unsigned id = (unsigned)(size_t)arg;
+   unsigned long m;
+   uint32_t rand_state = 0x9E3779B9u * (id + 1);
+   for (m = 0; m < messages; m++) {
+      byteQueueIndex_t at, i, length;
+      rand_state ^= rand_state << 13;
+      rand_state ^= rand_state >> 17;
+      rand_state ^= rand_state << 5;
+      length = 2 + rand_state % 5;
+      while (!bytequeue_reserve(&queue, length, &at))
+         sched_yield();
+      bytequeue_set(&queue, at, 0, 0x80 | (id << 3) | length);
+      for (i = 1; i < length; i++) {
+         bytequeue_set(&queue, at, i, m & 0x7F);
+         if (!(rand_state & 0x700))
+            sched_yield();
+      }
+      bytequeue_publish(&queue);
+   }
+   __atomic_add_fetch(&writers_done, 1, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+static void raw_test(void) {
+   pthread_t threads[MAX_WRITERS];
+   unsigned long expected[MAX_WRITERS] = {0}, total = 0;
+   unsigned t;
+
+   bytequeue_init(&queue, queue_data, QUEUE_LENGTH);
+   writers_done = 0;
+   for (t = 0; t < writers; t++)
+      pthread_create(&threads[t], NULL, raw_writer, (void *)(size_t)t);
+
+   while (1) {
+      bool done = __atomic_load_n(&writers_done, __ATOMIC_ACQUIRE) == writers;
+      byteQueueIndex_t length = bytequeue_length(&queue), at = 0;
+      while (at < length) {
+         uint8_t head = bytequeue_get(&queue, at);
+         unsigned id = (head >> 3) & 0x0F, size = head & 0x07, i;
+         assert(head & 0x80);
+         assert(id < writers && size >= 2 && size <= 6);
+         //what we can see always ends at the end of a message
+         assert(at + size <= length);
+         for (i = 1; i < size; i++)
+            assert(bytequeue_get(&queue, at + i) == (expected[id] & 0x7F));
+         expected[id]++;
+         total++;
+         at += size;
+      }
+      bytequeue_remove(&queue, length);
+      if (done && !length)
+         break;
+      if (!length)
+         sched_yield();
+   }
+
+   for (t = 0; t < writers; t++) {
+      pthread_join(threads[t], NULL);
+      assert(expected[t] == messages);
+   }
+   assert(total == writers * messages);
+   printf("%u writers, %lu messages through reserve and publish\n", writers, total);
+}
+
+static MidiDevice device;
+static long last[MAX_WRITERS];
+static unsigned long received;
+
+//an 11 bit count, with the writer in the top of the last byte as well as
+//in the channel, so that a message made of two writers' bytes shows
+#define DEVICE_ROUND 2048
+
+static void * device_writer(void * arg) {
+   unsigned id = (unsigned)(size_t)arg;
+   unsigned m;
+   midi_input_framer_t framer;
+   midi_input_framer_init(&framer);
+   for (m = 0; m < DEVICE_ROUND; m++) {
+      if (id == 0) {
+         //running status, apart from every 4th
+         if (!(m & 0x3))
+            midi_device_input_byte(&device, &framer, MIDI_NOTEON);
+         midi_device_input_byte(&device, &framer, m & 0x7F);
+         if (!(m & 0x7))
+            sched_yield();
+         midi_device_input_byte(&device, &framer, m >> 7);
+      } else {
+         midi_device_input(&device, 3, MIDI_NOTEON | id, m & 0x7F, (m >> 7) | (id << 4));
+      }
+      if (!(m & 0x1F))
+         sched_yield();
+   }
+   __atomic_add_fetch(&writers_done, 1, __ATOMIC_RELEASE);
+   return NULL;
+}
+
+static void device_noteon(MidiDevice * d, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   unsigned id = byte0 & 0x0F;
+   long count = byte1 | ((long)(byte2 & 0x0F) << 7);
+   assert(id < writers && (byte2 >> 4) == id);
+   //dropped ones leave gaps, but nothing goes backwards
+   assert(count > last[id]);
+   last[id] = count;
+   received++;
+}
+
+static void device_fallthrough(MidiDevice * d, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   fprintf(stderr, "a message no writer sent: %d %x %x %x\n", cnt, byte0, byte1, byte2);
+   assert(0);
+}
+
+static void device_test(void) {
+   pthread_t threads[MAX_WRITERS];
+   unsigned long round, rounds = messages / DEVICE_ROUND + 1;
+   unsigned t;
+
+   midi_init_device(&device);
+   midi_register_noteon_callback(&device, device_noteon);
+   midi_register_fallthrough_callback(&device, device_fallthrough);
+   received = 0;
+   for (round = 0; round < rounds; round++) {
+      writers_done = 0;
+      for (t = 0; t < writers; t++) {
+         last[t] = -1;
+         pthread_create(&threads[t], NULL, device_writer, (void *)(size_t)t);
+      }
+      while (__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE) != writers ||
+            bytequeue_length(&device.input_queue)) {
+         if (!bytequeue_length(&device.input_queue))
+            sched_yield();
+         midi_process(&device);
+      }
+      for (t = 0; t < writers; t++)
+         pthread_join(threads[t], NULL);
+   }
+   printf("%u writers, %lu of %lu messages through midi_device_input, the rest dropped\n",
+         writers, received, rounds * writers * DEVICE_ROUND);
+}
+
+int main(int argc, char * argv[]) {
+   if (argc > 1)
+      writers = atoi(argv[1]);
+   if (argc > 2)
+      messages = strtoul(argv[2], NULL, 0);
+   //the writer has to fit in 3 bits for the device test
+   assert(writers >= 1 && writers <= 8);
+
+   raw_test();
+   device_test();
+
+   printf("\n\nBYTEQUEUE TEST PASSED!\n\n");
+   return 0;
+}
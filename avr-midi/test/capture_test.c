@@ -0,0 +1,136 @@
+//midi_capture write, read back and seek
+#include "midi_capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#define RECORDS 20000
+#define DATA_SIZE (RECORDS * 16 + 3 * MIDI_CAPTURE_BLOCK_SIZE)
+
+//what went in, to check what comes out
+uint64_t times[RECORDS];
+size_t offsets[RECORDS + 1];
+uint8_t data[DATA_SIZE];
+
+uint32_t rand_state = 7;
+uint32_t next_rand(void) {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+//the index of the first record at or after time
+size_t first_at(uint64_t time) {
+   size_t i;
+   for (i = 0; i < RECORDS; i++) {
+      if (times[i] >= time)
+         break;
+   }
+   return i;
+}
+
+//read everything from the cursor on, it has to be the records from first
+//on, big records come back split but with the same bytes and times
+void check_from(midi_capture_cursor_t * cursor, size_t first) {
+   uint64_t time;
+   const uint8_t * got;
+   size_t length, at = offsets[first], record = first;
+
+   while (midi_capture_next(cursor, &time, &got, &length)) {
+      while (record < RECORDS && offsets[record + 1] <= at)
+         record++;
+      assert(record < RECORDS);
+      assert(time == times[record]);
+      assert(at + length <= offsets[record + 1]);
+      assert(memcmp(got, data + at, length) == 0);
+      at += length;
+      assert(cursor->offset == at);
+   }
+   assert(at == offsets[RECORDS]);
+}
+
+int main(void) {
+   static midi_capture_writer_t writer;
+   midi_capture_t capture;
+   midi_capture_cursor_t cursor;
+   char path[] = "/tmp/capture_testXXXXXX";
+   uint64_t time = 1000;
+   size_t i, at = 0;
+   int fd = mkstemp(path);
+   FILE * file;
+
+   assert(fd >= 0);
+   close(fd);
+
+   for (i = 0; i < RECORDS; i++) {
+      uint32_t r = next_rand();
+      size_t length = 1 + r % 12;
+      //now and then the same time, a long gap or a record bigger than a block
+      if (r & 0x300)
+         time += (r >> 12) % 2000;
+      if (!((r >> 4) % 500))
+         time += 1ull << 33;
+      if (!((r >> 8) % 4000))
+         length = MIDI_CAPTURE_BLOCK_SIZE * 2 + r % 100;
+      times[i] = time;
+      offsets[i] = at;
+      while (length--)
+         data[at++] = next_rand();
+   }
+   offsets[RECORDS] = at;
+
+   assert(midi_capture_create(&writer, path));
+   for (i = 0; i < RECORDS; i++)
+      assert(midi_capture_append(&writer, times[i], data + offsets[i], offsets[i + 1] - offsets[i]));
+   //time can't go backwards
+   assert(!midi_capture_append(&writer, times[RECORDS - 1] - 1, data, 1));
+   assert(midi_capture_finish(&writer));
+
+   assert(midi_capture_open(&capture, path));
+   assert(capture.blocks > 10);
+   assert(midi_capture_start(&capture) == times[0]);
+
+   midi_capture_rewind(&cursor, &capture);
+   check_from(&cursor, 0);
+
+   //seek to times of records, between records, before and after everything
+   for (i = 0; i < 200; i++) {
+      uint64_t to = times[next_rand() % RECORDS] + (next_rand() % 3) - 1;
+      midi_capture_seek(&cursor, &capture, to);
+      check_from(&cursor, first_at(to));
+   }
+   midi_capture_seek(&cursor, &capture, 0);
+   check_from(&cursor, 0);
+   midi_capture_seek(&cursor, &capture, times[RECORDS - 1] + 1);
+   check_from(&cursor, RECORDS);
+   midi_capture_close(&capture);
+
+   //cut off in the middle of a block, the full blocks before it still read
+   assert(truncate(path, MIDI_CAPTURE_FILE_HEADER + 3 * MIDI_CAPTURE_BLOCK_SIZE + 10) == 0);
+   assert(midi_capture_open(&capture, path));
+   assert(capture.blocks == 3);
+   midi_capture_rewind(&cursor, &capture);
+   {
+      uint64_t t;
+      const uint8_t * got;
+      size_t length, records = 0;
+      while (midi_capture_next(&cursor, &t, &got, &length))
+         records++;
+      assert(records > 0 && cursor.offset > 0 && cursor.offset < offsets[RECORDS]);
+   }
+   midi_capture_close(&capture);
+
+   //and anything else isn't a capture
+   file = fopen(path, "wb");
+   assert(file);
+   fputs("MThd not a capture", file);
+   fclose(file);
+   assert(!midi_capture_open(&capture, path));
+
+   unlink(path);
+   printf("\n\nCAPTURE TEST PASSED!\n\n");
+   return 0;
+}
@@ -2,6 +2,7 @@
 #include "midi.h"
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 MidiDevice test_device;
 
@@ -34,6 +35,36 @@ void send_func(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, u
    printf("\n");
 }
 
+//what the send functions were given, for the bulk send tests
+uint8_t log_data[64];
+uint8_t log_counts[16];
+uint8_t log_messages;
+uint8_t log_length;
+uint8_t buffer_calls;
+
+void log_send_func(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   log_counts[log_messages++] = cnt;
+   log_data[log_length++] = byte0;
+   if (cnt > 1)
+      log_data[log_length++] = byte1;
+   if (cnt > 2)
+      log_data[log_length++] = byte2;
+}
+
+void log_send_buffer_func(MidiDevice * device, const uint8_t * data, uint16_t length) {
+   buffer_calls++;
+   while (length--)
+      log_data[log_length++] = *data++;
+}
+
+void log_reset() {
+   log_messages = log_length = buffer_calls = 0;
+}
+
+void log_catchall(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   log_send_func(device, cnt, byte0, byte1, byte2);
+}
+
 void cc_callback(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2){
    cc_called = true;
    got[0] = byte0;
@@ -199,6 +230,164 @@ int main(void) {
    midi_process(&test_device);
    assert(!anything_called());
 
+   //limited processing leaves the rest queued
+   reset();
+   midi_device_input(&test_device, 3, 0xB0, 0, 1);
+   midi_device_input(&test_device, 1, MIDI_CLOCK, 0, 0);
+   assert(midi_process_limited(&test_device, 3) == 3);
+   assert(cc_called);
+   assert(!realtime_called);
+   assert(midi_process_limited(&test_device, 3) == 1);
+   assert(realtime_called);
+   assert(midi_process_limited(&test_device, 3) == 0);
+
+#if MIDI_RUNNING_STATUS
+   //running status, a realtime byte between doesn't cancel it
+   reset();
+   midi_device_input(&test_device, 3, 0xB1, 2, 3);
+   midi_process(&test_device);
+   assert(cc_called);
+   reset();
+   midi_device_input(&test_device, 1, 4, 0, 0);
+   midi_device_input(&test_device, 1, MIDI_CLOCK, 0, 0);
+   midi_device_input(&test_device, 1, 5, 0, 0);
+   midi_process(&test_device);
+   assert(cc_called);
+   assert(realtime_called);
+   assert(got[0] == 0xB1 && got[1] == 4 && got[2] == 5);
+
+   //a system message cancels it
+   reset();
+   midi_device_input(&test_device, 1, MIDI_TUNEREQUEST, 0, 0);
+   midi_device_input(&test_device, 2, 6, 7, 0);
+   midi_process(&test_device);
+   assert(!cc_called);
+
+   //two byte messages take one data byte each under running status
+   midi_register_progchange_callback(&test_device, progchange_callback);
+   midi_register_chanpressure_callback(&test_device, chanpressure_callback);
+   reset();
+   midi_device_input(&test_device, 2, 0xC3, 8, 0);
+   midi_process(&test_device);
+   assert(progchange_called);
+   assert(got[0] == 0xC3 && got[1] == 8);
+   reset();
+   midi_device_input(&test_device, 1, 9, 0, 0);
+   midi_process(&test_device);
+   assert(progchange_called);
+   assert(got[0] == 0xC3 && got[1] == 9);
+   reset();
+   midi_device_input(&test_device, 1, 10, 0, 0);
+   midi_device_input(&test_device, 1, MIDI_CLOCK, 0, 0);
+   midi_device_input(&test_device, 1, 11, 0, 0);
+   midi_process(&test_device);
+   assert(progchange_called);
+   assert(realtime_called);
+   assert(got[0] == 0xC3 && got[1] == 11);
+   assert(!fallthrough_called);
+
+   reset();
+   midi_device_input(&test_device, 2, 0xD4, 12, 0);
+   midi_device_input(&test_device, 1, 13, 0, 0);
+   midi_process(&test_device);
+   assert(chanpressure_called);
+   assert(got[0] == 0xD4 && got[1] == 13);
+#endif
+
+   //bulk sends split up for a device with only a send_func
+   {
+      MidiDevice out;
+      const uint8_t buffer[] = {
+         0x90, 60, 100, 62, MIDI_CLOCK, 100,      //running status, a clock in the middle
+         SYSEX_BEGIN, 0x7D, 1, 2, 3, SYSEX_END,   //sysex in chunks
+         0xB0, 7                                  //cut short
+      };
+      const uint8_t expected[] = {
+         0x90, 60, 100, MIDI_CLOCK, 0x90, 62, 100,
+         SYSEX_BEGIN, 0x7D, 1, 2, 3, SYSEX_END
+      };
+      const uint8_t expected_counts[] = {3, 1, 3, 3, 3};
+      midi_event_t events[10];
+      uint8_t i;
+
+      midi_init_device(&out);
+      midi_device_set_send_func(&out, log_send_func);
+      log_reset();
+      midi_send_buffer(&out, buffer, sizeof(buffer));
+      assert(log_length == sizeof(expected));
+      assert(memcmp(log_data, expected, sizeof(expected)) == 0);
+      assert(log_messages == sizeof(expected_counts));
+      assert(memcmp(log_counts, expected_counts, sizeof(expected_counts)) == 0);
+
+      //and with a send buffer function it goes out as is
+      midi_device_set_send_buffer_func(&out, log_send_buffer_func);
+      log_reset();
+      midi_send_buffer(&out, buffer, sizeof(buffer));
+      assert(buffer_calls == 1 && log_messages == 0);
+      assert(log_length == sizeof(buffer) && memcmp(log_data, buffer, sizeof(buffer)) == 0);
+
+      //events are gathered up into as few calls as fit
+      for (i = 0; i < 10; i++) {
+         events[i].length = 3;
+         events[i].data[0] = MIDI_CC | i;
+         events[i].data[1] = 123;
+         events[i].data[2] = 0;
+      }
+      log_reset();
+      midi_send_events(&out, events, 10);
+      assert(buffer_calls == (30 + MIDI_SEND_EVENTS_BUFFER - 1) / MIDI_SEND_EVENTS_BUFFER);
+      assert(log_length == 30 && log_data[27] == (MIDI_CC | 9));
+
+      midi_device_set_send_buffer_func(&out, NULL);
+      log_reset();
+      midi_send_events(&out, events, 10);
+      assert(log_messages == 10 && log_length == 30);
+   }
+
+   //a buffer parsed directly gives the same callbacks as queued input, however
+   //it is split up
+   {
+      MidiDevice in;
+      const uint8_t stream[] = {
+         0x90, 60, 100, 62, 100, MIDI_CLOCK, 0xB0, 7, MIDI_START, 10,
+         SYSEX_BEGIN, 0x7D, 1, 2, 3, 4, SYSEX_END, 0xE0, 0, 64
+      };
+      uint8_t queued[64];
+      uint8_t queued_counts[16];
+      uint8_t queued_messages, queued_length;
+      size_t split, i;
+
+      midi_init_device(&in);
+      midi_register_catchall_callback(&in, log_catchall);
+      log_reset();
+      for (i = 0; i < sizeof(stream); i++)
+         midi_device_input(&in, 1, stream[i], 0, 0);
+      midi_process(&in);
+      memcpy(queued, log_data, log_length);
+      memcpy(queued_counts, log_counts, log_messages);
+      queued_messages = log_messages;
+      queued_length = log_length;
+
+      for (split = 0; split <= sizeof(stream); split++) {
+         midi_init_device(&in);
+         midi_register_catchall_callback(&in, log_catchall);
+         log_reset();
+         midi_process_buffer(&in, stream, split);
+         midi_process_buffer(&in, stream + split, sizeof(stream) - split);
+         assert(log_messages == queued_messages && log_length == queued_length);
+         assert(memcmp(log_counts, queued_counts, queued_messages) == 0);
+         assert(memcmp(log_data, queued, queued_length) == 0);
+      }
+
+      //queued input goes first
+      midi_init_device(&in);
+      midi_register_catchall_callback(&in, log_catchall);
+      log_reset();
+      midi_device_input(&in, 2, 0xB0, 1, 0);
+      midi_process_buffer(&in, stream + 7, 1);
+      assert(log_messages == 1 && log_data[0] == 0xB0 && log_data[1] == 1 && log_data[2] == 7);
+   }
+
    printf("\n\nTEST PASSED!\n\n");
    return 0;
 }
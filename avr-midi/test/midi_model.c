@@ -0,0 +1,127 @@
+#include "midi_model.h"
+
+void midi_model_init(midi_model_t * model) {
+   model->running = 0;
+   model->length = 0;
+   model->want = 0;
+   model->sysex = false;
+}
+
+static bool midi_model_emit(midi_model_t * model, midi_model_message_t * message) {
+   uint8_t i;
+   message->cnt = model->length;
+   for (i = 0; i < 3; i++)
+      message->bytes[i] = (i < model->length) ? model->message[i] : 0;
+   model->length = 0;
+   return true;
+}
+
+//how many bytes a message with this status has, 0 if we don't know
+static uint8_t midi_model_want(uint8_t status) {
+   if (status < 0xF0) {
+      uint8_t kind = status & 0xF0;
+      return (kind == 0xC0 || kind == 0xD0) ? 2 : 3;
+   }
+   switch (status) {
+      case 0xF1:
+      case 0xF3:
+         return 2;
+      case 0xF2:
+         return 3;
+      case 0xF6:
+         return 1;
+      default:
+         return 0;
+   }
+}
+
+bool midi_model_byte(midi_model_t * model, uint8_t input, midi_model_message_t * message) {
+   if (input >= 0xF8) {
+      message->cnt = 1;
+      message->bytes[0] = input;
+      message->bytes[1] = message->bytes[2] = 0;
+      return true;
+   }
+
+   if (input >= 0x80) {
+      bool emit = false;
+      if (input == 0xF7 && model->sysex) {
+         //the rest of the sysex, F7 and all
+         model->message[model->length++] = input;
+         emit = midi_model_emit(model, message);
+      }
+
+      //whatever we were in the middle of is over
+      model->sysex = false;
+      model->length = 0;
+      model->want = 0;
+      model->running = (input < 0xF0) ? input : 0;
+
+      if (input == 0xF7)
+         return emit;
+      if (input == 0xF0) {
+         model->sysex = true;
+         model->message[model->length++] = input;
+         return false;
+      }
+      model->want = midi_model_want(input);
+      if (!model->want)
+         return false;
+      model->message[model->length++] = input;
+      if (model->want == 1)
+         return midi_model_emit(model, message);
+      return false;
+   }
+
+   if (model->sysex) {
+      model->message[model->length++] = input;
+      if (model->length == 3)
+         return midi_model_emit(model, message);
+      return false;
+   }
+   if (!model->length) {
+      if (!model->running)
+         return false;
+      model->message[model->length++] = model->running;
+      model->want = midi_model_want(model->running);
+   }
+   model->message[model->length++] = input;
+   if (model->length == model->want)
+      return midi_model_emit(model, message);
+   return false;
+}
+
+midi_model_callback_t midi_model_callback(const midi_model_message_t * message) {
+   uint8_t status = message->bytes[0];
+   switch (message->cnt) {
+      case 3:
+         switch (status & 0xF0) {
+            case 0x80:
+               return MODEL_NOTEOFF;
+            case 0x90:
+               return MODEL_NOTEON;
+            case 0xA0:
+               return MODEL_AFTERTOUCH;
+            case 0xB0:
+               return MODEL_CC;
+            case 0xE0:
+               return MODEL_PITCHBEND;
+         }
+         return (status == 0xF2) ? MODEL_SONGPOSITION : MODEL_FALLTHROUGH;
+      case 2:
+         switch (status & 0xF0) {
+            case 0xC0:
+               return MODEL_PROGCHANGE;
+            case 0xD0:
+               return MODEL_CHANPRESSURE;
+         }
+         if (status == 0xF1)
+            return MODEL_TC_QUATERFRAME;
+         return (status == 0xF3) ? MODEL_SONGSELECT : MODEL_FALLTHROUGH;
+      case 1:
+         if (status >= 0xF8)
+            return MODEL_REALTIME;
+         return (status == 0xF6) ? MODEL_TUNEREQUEST : MODEL_FALLTHROUGH;
+   }
+   return MODEL_FALLTHROUGH;
+}
@@ -0,0 +1,55 @@
+//reference model of the input parser, for the fuzz harness
+//
+//this is what midi_process_byte should do, written down as plainly as we
+//can rather than as fast or as small:
+//
+//- realtime bytes are passed on as they come, even in the middle of another
+//  message, and change nothing
+//- a channel status byte starts a message and becomes the running status,
+//  data bytes after a complete channel message start another one with it
+//- system common and sysex cancel the running status.  Tune request is
+//  passed on straight away, the undefined F4 and F5 are dropped.
+//- sysex is passed on 3 bytes at a time, F0 in front of the first piece,
+//  and what is left with F7 at the end
+//- any other status byte ends a sysex without F7 [the bytes not yet passed
+//  on are dropped] and F7 outside of a sysex is dropped
+//- data bytes with no message to go in are dropped
+//
+//messages come out as the count and bytes the catchall gets, plus the
+//callback it should have gone to, see midi_model_callback.
+
+#ifndef MIDI_MODEL_H
+#define MIDI_MODEL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+   MODEL_CC, MODEL_NOTEON, MODEL_NOTEOFF, MODEL_AFTERTOUCH, MODEL_PITCHBEND,
+   MODEL_SONGPOSITION, MODEL_PROGCHANGE, MODEL_CHANPRESSURE, MODEL_SONGSELECT,
+   MODEL_TC_QUATERFRAME, MODEL_REALTIME, MODEL_TUNEREQUEST, MODEL_FALLTHROUGH
+} midi_model_callback_t;
+
+typedef struct {
+   uint8_t cnt;
+   uint8_t bytes[3];
+} midi_model_message_t;
+
+typedef struct {
+   //the running status, 0 for none
+   uint8_t running;
+   //the message we're in the middle of, and how long it will be
+   uint8_t message[3];
+   uint8_t length;
+   uint8_t want;
+   bool sysex;
+} midi_model_t;
+
+void midi_model_init(midi_model_t * model);
+//returns true and fills in message if the byte finishes one
+bool midi_model_byte(midi_model_t * model, uint8_t input, midi_model_message_t * message);
+//the specific callback a message goes to, fallthrough if there isn't one
+midi_model_callback_t midi_model_callback(const midi_model_message_t * message);
+
+#endif
@@ -0,0 +1,78 @@
+//the same parser with its callbacks in a shared table, built with
+//MIDI_OPS_TABLE [see the Makefile]
+#include "midi_device.h"
+#include "midi.h"
+#include <stdio.h>
+#include <assert.h>
+
+MidiDevice device_a;
+MidiDevice device_b;
+
+MidiDevice * cc_device;
+uint8_t got[3];
+int cc_calls;
+int realtime_calls;
+int catchall_calls;
+
+void cc_callback(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2){
+   cc_device = device;
+   cc_calls++;
+   got[0] = byte0;
+   got[1] = byte1;
+   got[2] = byte2;
+}
+
+void realtime_callback(MidiDevice * device, uint8_t byte){
+   realtime_calls++;
+}
+
+void catchall_callback(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2){
+   catchall_calls++;
+}
+
+static const MidiDeviceOps shared_ops MIDI_OPS_PROGMEM = {
+   .cc = cc_callback,
+   .realtime = realtime_callback,
+   .catchall = catchall_callback,
+};
+
+void reset() {
+   cc_device = NULL;
+   got[0] = got[1] = got[2] = 0;
+   cc_calls = realtime_calls = catchall_calls = 0;
+}
+
+int main(void) {
+   midi_init_device(&device_a);
+   midi_init_device(&device_b);
+
+   //nothing is called before a table is set
+   reset();
+   midi_device_input(&device_a, 3, 0xB0, 1, 2);
+   midi_process(&device_a);
+   assert(!cc_calls && !catchall_calls);
+
+   midi_device_set_ops(&device_a, &shared_ops);
+   midi_device_set_ops(&device_b, &shared_ops);
+
+   reset();
+   midi_device_input(&device_a, 3, 0xB0, 1, 2);
+   midi_device_input(&device_a, 1, MIDI_CLOCK, 0, 0);
+   midi_process(&device_a);
+   assert(cc_calls == 1 && cc_device == &device_a);
+   assert(got[0] == 0xB0 && got[1] == 1 && got[2] == 2);
+   assert(realtime_calls == 1);
+   assert(catchall_calls == 2);
+
+   //the other device shares the table, a note on has no callback in it
+   reset();
+   midi_device_input(&device_b, 3, 0x90, 60, 100);
+   midi_device_input(&device_b, 3, 0xB5, 7, 8);
+   midi_process(&device_b);
+   assert(cc_calls == 1 && cc_device == &device_b);
+   assert(got[0] == 0xB5 && got[1] == 7 && got[2] == 8);
+   assert(catchall_calls == 2);
+
+   printf("\n\nOPS TEST PASSED!\n\n");
+   return 0;
+}
@@ -0,0 +1,387 @@
+//the input parser against the reference model in midi_model.c
+//
+//every stream goes through a device three times, once queued in pieces with
+//midi_device_input and parsed with midi_process, once a byte at a time
+//through midi_device_input_byte, once with midi_process_buffer, and every
+//log of callbacks has to be what the model says.  The var byte callbacks only have to agree on the cnt bytes they
+//are given.
+//
+//run on its own it plays every file in the corpus directory and then
+//random streams.  A random stream the parser gets wrong is cut down to as
+//few bytes as still go wrong and saved in the corpus, so that it is played
+//from then on.  The bench reads the same directory as its input.
+//
+//   ./parser_fuzz [corpus] [streams] [seed]
+//
+//built with -DPARSER_FUZZ_LIBFUZZER it is a libFuzzer target instead, with
+//the corpus directory as its corpus:
+//
+//   make parser_fuzz_libfuzzer && ./parser_fuzz_libfuzzer corpus
+#include "midi.h"
+#include "midi_model.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+#define MAX_STREAM 512
+//callbacks in a log, a message is the specific one or fallthrough and then
+//the catchall
+#define MAX_LOG (2 * MAX_STREAM)
+
+enum { CATCHALL = MODEL_FALLTHROUGH + 1 };
+
+typedef struct {
+   uint8_t callback;
+   uint8_t cnt;
+   uint8_t bytes[3];
+} logged_t;
+
+typedef struct {
+   logged_t entries[MAX_LOG];
+   size_t length;
+} log_t;
+
+static log_t device_log;
+static log_t model_log;
+
+static void log_call(log_t * log, uint8_t callback, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   logged_t * entry;
+   if (log->length == MAX_LOG)
+      return;
+   entry = &log->entries[log->length++];
+   entry->callback = callback;
+   entry->cnt = cnt;
+   entry->bytes[0] = byte0;
+   entry->bytes[1] = (cnt > 1) ? byte1 : 0;
+   entry->bytes[2] = (cnt > 2) ? byte2 : 0;
+}
+
+#define THREE_BYTE_LOGGER(name, id) \
+   static void log_##name(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2) { \
+      log_call(&device_log, id, 3, byte0, byte1, byte2); \
+   }
+#define TWO_BYTE_LOGGER(name, id) \
+   static void log_##name(MidiDevice * device, uint8_t byte0, uint8_t byte1) { \
+      log_call(&device_log, id, 2, byte0, byte1, 0); \
+   }
+#define ONE_BYTE_LOGGER(name, id) \
+   static void log_##name(MidiDevice * device, uint8_t byte0) { \
+      log_call(&device_log, id, 1, byte0, 0, 0); \
+   }
+#define VAR_BYTE_LOGGER(name, id) \
+   static void log_##name(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) { \
+      log_call(&device_log, id, cnt, byte0, byte1, byte2); \
+   }
+
+THREE_BYTE_LOGGER(cc, MODEL_CC)
+THREE_BYTE_LOGGER(noteon, MODEL_NOTEON)
+THREE_BYTE_LOGGER(noteoff, MODEL_NOTEOFF)
+THREE_BYTE_LOGGER(aftertouch, MODEL_AFTERTOUCH)
+THREE_BYTE_LOGGER(pitchbend, MODEL_PITCHBEND)
+THREE_BYTE_LOGGER(songposition, MODEL_SONGPOSITION)
+TWO_BYTE_LOGGER(progchange, MODEL_PROGCHANGE)
+TWO_BYTE_LOGGER(chanpressure, MODEL_CHANPRESSURE)
+TWO_BYTE_LOGGER(songselect, MODEL_SONGSELECT)
+TWO_BYTE_LOGGER(tc_quaterframe, MODEL_TC_QUATERFRAME)
+ONE_BYTE_LOGGER(realtime, MODEL_REALTIME)
+ONE_BYTE_LOGGER(tunerequest, MODEL_TUNEREQUEST)
+VAR_BYTE_LOGGER(fallthrough, MODEL_FALLTHROUGH)
+VAR_BYTE_LOGGER(catchall, CATCHALL)
+
+static void setup(MidiDevice * device) {
+   midi_init_device(device);
+   midi_register_cc_callback(device, log_cc);
+   midi_register_noteon_callback(device, log_noteon);
+   midi_register_noteoff_callback(device, log_noteoff);
+   midi_register_aftertouch_callback(device, log_aftertouch);
+   midi_register_pitchbend_callback(device, log_pitchbend);
+   midi_register_songposition_callback(device, log_songposition);
+   midi_register_progchange_callback(device, log_progchange);
+   midi_register_chanpressure_callback(device, log_chanpressure);
+   midi_register_songselect_callback(device, log_songselect);
+   midi_register_tc_quarterframe_callback(device, log_tc_quaterframe);
+   midi_register_realtime_callback(device, log_realtime);
+   midi_register_tunerequest_callback(device, log_tunerequest);
+   midi_register_fallthrough_callback(device, log_fallthrough);
+   midi_register_catchall_callback(device, log_catchall);
+}
+
+static void run_model(const uint8_t * data, size_t length) {
+   midi_model_t model;
+   midi_model_message_t message;
+   size_t i;
+   model_log.length = 0;
+   midi_model_init(&model);
+   for (i = 0; i < length; i++) {
+      if (midi_model_byte(&model, data[i], &message)) {
+         log_call(&model_log, midi_model_callback(&message), message.cnt,
+               message.bytes[0], message.bytes[1], message.bytes[2]);
+         log_call(&model_log, CATCHALL, message.cnt,
+               message.bytes[0], message.bytes[1], message.bytes[2]);
+      }
+   }
+}
+
+static bool same_logs(void) {
+   return device_log.length == model_log.length &&
+      memcmp(device_log.entries, model_log.entries, model_log.length * sizeof(logged_t)) == 0;
+}
+
+//true if either way into the parser doesn't do what the model does
+static bool differs(const uint8_t * data, size_t length) {
+   MidiDevice device;
+   midi_input_framer_t framer;
+   size_t at = 0;
+
+   if (length > MAX_STREAM)
+      length = MAX_STREAM;
+   run_model(data, length);
+
+   //queued, in pieces of 1 to 3 bytes the way the usb and serial code queue
+   //them, parsed now and then
+   setup(&device);
+   device_log.length = 0;
+   while (at < length) {
+      uint8_t piece = 1 + (at % 3);
+      if (piece > length - at)
+         piece = length - at;
+      midi_device_input(&device, piece, data[at], at + 1 < length ? data[at + 1] : 0,
+            at + 2 < length ? data[at + 2] : 0);
+      at += piece;
+      if (at % 64 < 3)
+         midi_process(&device);
+   }
+   midi_process(&device);
+   if (!same_logs())
+      return true;
+
+   //framed into whole messages a byte at a time, the way the uart queues
+   setup(&device);
+   device_log.length = 0;
+   midi_input_framer_init(&framer);
+   for (at = 0; at < length; at++) {
+      midi_device_input_byte(&device, &framer, data[at]);
+      if (at % 64 == 63)
+         midi_process(&device);
+   }
+   midi_process(&device);
+   if (!same_logs())
+      return true;
+
+   setup(&device);
+   device_log.length = 0;
+   midi_process_buffer(&device, data, length);
+   return !same_logs();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t length) {
+   if (differs(data, length))
+      abort();
+   return 0;
+}
+
+#ifndef PARSER_FUZZ_LIBFUZZER
+
+//xorshift, so a seed always gives the same streams
+static uint32_t rand_state;
+static uint32_t next_rand(void) {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+//short streams of things that look like midi, with sysex of any length,
+//status bytes where they don't belong and realtime anywhere
+static size_t make_stream(uint8_t * stream) {
+   size_t length = next_rand() % 64;
+   size_t i = 0;
+   while (i < length) {
+      uint32_t r = next_rand();
+      switch (r % 8) {
+         case 0:
+         case 1:
+            {
+               size_t n = (r >> 8) % 8;
+               while (n-- && i < length)
+                  stream[i++] = next_rand() & 0x7F;
+            }
+            break;
+         case 2:
+         case 3:
+            stream[i++] = 0x80 | ((r >> 8) & 0x7F);
+            break;
+         case 4:
+            stream[i++] = 0xF0 | ((r >> 8) & 0x07);
+            break;
+         case 5:
+            stream[i++] = 0xF8 | ((r >> 8) & 0x07);
+            break;
+         case 6:
+            //a sysex, ended or not
+            stream[i++] = SYSEX_BEGIN;
+            {
+               size_t n = (r >> 8) % 10;
+               while (n-- && i < length)
+                  stream[i++] = next_rand() & 0x7F;
+            }
+            if (i < length && (r & 0x10000000))
+               stream[i++] = SYSEX_END;
+            break;
+         default:
+            stream[i++] = (r >> 8) & 0x7F;
+            break;
+      }
+   }
+   return length;
+}
+
+//take out runs of bytes, shorter and shorter, while it still goes wrong,
+//then zero the data bytes that don't matter so that cases of one bug come
+//out the same
+static size_t minimize(uint8_t * data, size_t length) {
+   uint8_t trial[MAX_STREAM];
+   size_t run = length / 2, i;
+   while (run) {
+      bool smaller = false;
+      size_t at = 0;
+      while (at + run <= length) {
+         memcpy(trial, data, at);
+         memcpy(trial + at, data + at + run, length - at - run);
+         if (differs(trial, length - run)) {
+            length -= run;
+            memcpy(data, trial, length);
+            smaller = true;
+         } else {
+            at += run;
+         }
+      }
+      if (!smaller)
+         run /= 2;
+   }
+   for (i = 0; i < length; i++) {
+      uint8_t was = data[i];
+      if (!was || was & 0x80)
+         continue;
+      data[i] = 0;
+      if (!differs(data, length))
+         data[i] = was;
+   }
+   return length;
+}
+
+static void print_stream(const char * what, const uint8_t * data, size_t length) {
+   size_t i;
+   fprintf(stderr, "%s:", what);
+   for (i = 0; i < length; i++)
+      fprintf(stderr, " %02X", data[i]);
+   fprintf(stderr, "\n");
+}
+
+static void print_log(const char * what, const log_t * log) {
+   size_t i;
+   fprintf(stderr, "%s:\n", what);
+   for (i = 0; i < log->length; i++) {
+      const logged_t * entry = &log->entries[i];
+      fprintf(stderr, "   callback %d, %d: %02X %02X %02X\n", entry->callback, entry->cnt,
+            entry->bytes[0], entry->bytes[1], entry->bytes[2]);
+   }
+}
+
+//fnv-1a, cases are saved by the hash of what is in them
+static uint32_t hash_case(const uint8_t * data, size_t length) {
+   uint32_t hash = 2166136261u;
+   size_t i;
+   for (i = 0; i < length; i++)
+      hash = (hash ^ data[i]) * 16777619u;
+   return hash;
+}
+
+static bool save_case(const char * corpus, uint32_t hash, const uint8_t * data, size_t length) {
+   char path[1024];
+   FILE * file;
+   snprintf(path, sizeof(path), "%s/%08x.bin", corpus, hash);
+   file = fopen(path, "wb");
+   if (!file)
+      return false;
+   fwrite(data, 1, length, file);
+   fclose(file);
+   fprintf(stderr, "saved %s\n", path);
+   return true;
+}
+
+//play every file in the corpus, the count of ones that go wrong
+static size_t play_corpus(const char * corpus, size_t * played) {
+   DIR * dir = opendir(corpus);
+   struct dirent * entry;
+   size_t wrong = 0;
+   *played = 0;
+   if (!dir)
+      return 0;
+   while ((entry = readdir(dir))) {
+      uint8_t data[MAX_STREAM];
+      char path[1024];
+      size_t length;
+      FILE * file;
+      if (entry->d_name[0] == '.')
+         continue;
+      snprintf(path, sizeof(path), "%s/%s", corpus, entry->d_name);
+      if (!(file = fopen(path, "rb")))
+         continue;
+      length = fread(data, 1, sizeof(data), file);
+      fclose(file);
+      (*played)++;
+      if (differs(data, length)) {
+         fprintf(stderr, "%s goes wrong\n", path);
+         print_stream("stream", data, length);
+         print_log("parser", &device_log);
+         print_log("model", &model_log);
+         wrong++;
+      }
+   }
+   closedir(dir);
+   return wrong;
+}
+
+int main(int argc, char * argv[]) {
+   const char * corpus = (argc > 1) ? argv[1] : "corpus";
+   size_t streams = (argc > 2) ? strtoul(argv[2], NULL, 0) : 200000;
+   uint32_t seed = (argc > 3) ? strtoul(argv[3], NULL, 0) : 1;
+   uint8_t stream[MAX_STREAM];
+   //the cases found so far, cut down cases of one bug tend to come out the
+   //same and are only reported once
+   uint32_t found[8];
+   size_t s, f, played, wrong, found_count = 0;
+
+   wrong = play_corpus(corpus, &played);
+   rand_state = seed ? seed : 1;
+   for (s = 0; s < streams; s++) {
+      size_t length = make_stream(stream);
+      uint32_t hash;
+      if (!differs(stream, length))
+         continue;
+      length = minimize(stream, length);
+      hash = hash_case(stream, length);
+      for (f = 0; f < found_count && found[f] != hash; f++);
+      if (f < found_count)
+         continue;
+      found[found_count++] = hash;
+      differs(stream, length);
+      print_stream("random stream goes wrong, cut down to", stream, length);
+      print_log("parser", &device_log);
+      print_log("model", &model_log);
+      save_case(corpus, hash, stream, length);
+      wrong++;
+      if (found_count == sizeof(found) / sizeof(found[0]))
+         break;
+   }
+   if (wrong)
+      return 1;
+
+   printf("%zu corpus streams and %zu random ones parsed like the model\n", played, streams);
+   printf("\n\nPARSER FUZZ PASSED!\n\n");
+   return 0;
+}
+
+#endif
@@ -0,0 +1,147 @@
+//the ring buffers ring.h makes, for usb event packets counted in a byte
+//and for bytes in a ring bigger than a byte can count
+#include "ring.h"
+#include <stdio.h>
+#include <assert.h>
+
+typedef struct {
+   uint8_t cable;
+   uint8_t data[3];
+} packet_t;
+
+RING_DEFINE(packets, packet_t, uint8_t, 128)
+RING_DEFINE(bytes, uint8_t, uint16_t, 1024)
+
+static uint32_t rand_state = 1;
+static uint32_t next_rand(void) {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+static void make_packet(packet_t * packet, uint32_t n) {
+   packet->cable = n & 0x0F;
+   packet->data[0] = 0x90 | (n & 0x0F);
+   packet->data[1] = (n >> 4) & 0x7F;
+   packet->data[2] = (n >> 11) & 0x7F;
+}
+
+static bool same_packet(const packet_t * packet, uint32_t n) {
+   packet_t expected;
+   make_packet(&expected, n);
+   return packet->cable == expected.cable && packet->data[0] == expected.data[0] &&
+      packet->data[1] == expected.data[1] && packet->data[2] == expected.data[2];
+}
+
+static void packet_test(void) {
+   packets_t ring;
+   packet_t packet, many[200];
+   uint32_t in = 0, out = 0, round;
+   uint8_t i, got;
+
+   packets_init(&ring);
+   assert(packets_length(&ring) == 0 && packets_space(&ring) == 128);
+   assert(!packets_pop(&ring, &packet));
+
+   //full is 128, not 127, and the 129th doesn't go in
+   for (i = 0; i < 128; i++) {
+      make_packet(&packet, in++);
+      assert(packets_push(&ring, &packet));
+   }
+   assert(packets_length(&ring) == 128 && packets_space(&ring) == 0);
+   assert(!packets_push(&ring, &packet));
+   assert(same_packet(packets_peek(&ring, 0), 0) && same_packet(packets_peek(&ring, 127), 127));
+   for (i = 0; i < 100; i++) {
+      assert(packets_pop(&ring, &packet));
+      assert(same_packet(&packet, out++));
+   }
+
+   //in and out wrap around many times, with bulk pushes and pops of any
+   //size and spans that end at the end of the ring
+   for (round = 0; round < 20000; round++) {
+      uint8_t want = next_rand() % 200, length;
+      packet_t * span;
+      switch (next_rand() % 4) {
+         case 0:
+            for (i = 0; i < want; i++)
+               make_packet(&many[i], in + i);
+            got = packets_push_many(&ring, many, want);
+            assert(got == (want < 128 - (in - out) ? want : 128 - (in - out)));
+            in += got;
+            break;
+         case 1:
+            got = packets_pop_many(&ring, many, want);
+            assert(got == (want < in - out ? want : in - out));
+            for (i = 0; i < got; i++)
+               assert(same_packet(&many[i], out++));
+            break;
+         case 2:
+            span = packets_write_span(&ring, &length);
+            assert(length <= 128 - (in - out));
+            assert(length == 128 - (in - out) || ((in + length) & 127) == 0);
+            if (length > want)
+               length = want;
+            for (i = 0; i < length; i++)
+               make_packet(&span[i], in++);
+            packets_commit(&ring, length);
+            break;
+         default:
+            span = packets_read_span(&ring, &length);
+            assert(length <= in - out);
+            assert(length == in - out || ((out + length) & 127) == 0);
+            if (length > want)
+               length = want;
+            for (i = 0; i < length; i++)
+               assert(same_packet(&span[i], out++));
+            packets_consume(&ring, length);
+            break;
+      }
+      assert(packets_length(&ring) == in - out);
+   }
+   printf("%u packets through a ring of 128\n", out);
+}
+
+static void byte_test(void) {
+   static bytes_t ring;
+   uint8_t data[1500];
+   uint32_t in = 0, out = 0, round;
+   uint16_t i, got;
+
+   bytes_init(&ring);
+   for (i = 0; i < sizeof(data); i++)
+      data[i] = i;
+   //more than a byte can count, all of it
+   assert(bytes_push_many(&ring, data, sizeof(data)) == 1024);
+   assert(bytes_length(&ring) == 1024 && bytes_space(&ring) == 0);
+   assert(bytes_pop_many(&ring, data, 1000) == 1000);
+   for (i = 0; i < 1000; i++)
+      assert(data[i] == (uint8_t)i);
+   in = 1024;
+   out = 1000;
+
+   for (round = 0; round < 20000; round++) {
+      uint16_t want = next_rand() % 1500;
+      if (next_rand() & 1) {
+         for (i = 0; i < want; i++)
+            data[i] = in + i;
+         got = bytes_push_many(&ring, data, want);
+         assert(got == (want < 1024 - (in - out) ? want : 1024 - (in - out)));
+         in += got;
+      } else {
+         got = bytes_pop_many(&ring, data, want);
+         assert(got == (want < in - out ? want : in - out));
+         for (i = 0; i < got; i++)
+            assert(data[i] == (uint8_t)out++);
+      }
+      assert(bytes_length(&ring) == in - out);
+   }
+   printf("%u bytes through a ring of 1024\n", out);
+}
+
+int main(void) {
+   packet_test();
+   byte_test();
+   printf("\n\nRING TEST PASSED!\n\n");
+   return 0;
+}
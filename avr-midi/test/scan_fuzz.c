@@ -0,0 +1,209 @@
+//midi_scan_process against midi_process_buffer on random input
+//
+//both devices get every callback registered, each call is logged and the
+//two logs and the parser state after each stream have to be the same.  The
+//scanned device gets its stream in random pieces, some of them queued
+//first, the other one all at once.
+//
+//   ./scan_test [streams] [seed]
+#include "midi_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define MAX_STREAM 4096
+
+typedef struct {
+   uint8_t callback;
+   uint8_t cnt;
+   uint8_t bytes[3];
+} logged_t;
+
+typedef struct {
+   logged_t entries[2 * MAX_STREAM];
+   size_t length;
+} log_t;
+
+MidiDevice ref_device;
+MidiDevice scan_device;
+log_t ref_log;
+log_t scan_log;
+
+enum {
+   CC, NOTEON, NOTEOFF, AFTERTOUCH, PITCHBEND, SONGPOSITION, PROGCHANGE,
+   CHANPRESSURE, SONGSELECT, TC_QUATERFRAME, REALTIME, TUNEREQUEST,
+   FALLTHROUGH, CATCHALL
+};
+
+void log_call(MidiDevice * device, uint8_t callback, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   log_t * log = (device == &ref_device) ? &ref_log : &scan_log;
+   logged_t * entry = &log->entries[log->length++];
+   assert(log->length <= 2 * MAX_STREAM);
+   entry->callback = callback;
+   entry->cnt = cnt;
+   entry->bytes[0] = byte0;
+   entry->bytes[1] = byte1;
+   entry->bytes[2] = byte2;
+}
+
+#define THREE_BYTE_LOGGER(name, id) \
+   void log_##name(MidiDevice * device, uint8_t byte0, uint8_t byte1, uint8_t byte2) { \
+      log_call(device, id, 3, byte0, byte1, byte2); \
+   }
+#define TWO_BYTE_LOGGER(name, id) \
+   void log_##name(MidiDevice * device, uint8_t byte0, uint8_t byte1) { \
+      log_call(device, id, 2, byte0, byte1, 0); \
+   }
+#define ONE_BYTE_LOGGER(name, id) \
+   void log_##name(MidiDevice * device, uint8_t byte0) { \
+      log_call(device, id, 1, byte0, 0, 0); \
+   }
+#define VAR_BYTE_LOGGER(name, id) \
+   void log_##name(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) { \
+      log_call(device, id, cnt, byte0, byte1, byte2); \
+   }
+
+THREE_BYTE_LOGGER(cc, CC)
+THREE_BYTE_LOGGER(noteon, NOTEON)
+THREE_BYTE_LOGGER(noteoff, NOTEOFF)
+THREE_BYTE_LOGGER(aftertouch, AFTERTOUCH)
+THREE_BYTE_LOGGER(pitchbend, PITCHBEND)
+THREE_BYTE_LOGGER(songposition, SONGPOSITION)
+TWO_BYTE_LOGGER(progchange, PROGCHANGE)
+TWO_BYTE_LOGGER(chanpressure, CHANPRESSURE)
+TWO_BYTE_LOGGER(songselect, SONGSELECT)
+TWO_BYTE_LOGGER(tc_quaterframe, TC_QUATERFRAME)
+ONE_BYTE_LOGGER(realtime, REALTIME)
+ONE_BYTE_LOGGER(tunerequest, TUNEREQUEST)
+VAR_BYTE_LOGGER(fallthrough, FALLTHROUGH)
+VAR_BYTE_LOGGER(catchall, CATCHALL)
+
+void setup(MidiDevice * device) {
+   midi_init_device(device);
+   midi_register_cc_callback(device, log_cc);
+   midi_register_noteon_callback(device, log_noteon);
+   midi_register_noteoff_callback(device, log_noteoff);
+   midi_register_aftertouch_callback(device, log_aftertouch);
+   midi_register_pitchbend_callback(device, log_pitchbend);
+   midi_register_songposition_callback(device, log_songposition);
+   midi_register_progchange_callback(device, log_progchange);
+   midi_register_chanpressure_callback(device, log_chanpressure);
+   midi_register_songselect_callback(device, log_songselect);
+   midi_register_tc_quarterframe_callback(device, log_tc_quaterframe);
+   midi_register_realtime_callback(device, log_realtime);
+   midi_register_tunerequest_callback(device, log_tunerequest);
+   //no fallthrough, so that it doesn't hide the catchall on every message
+   midi_register_catchall_callback(device, log_catchall);
+}
+
+//xorshift, so a seed always gives the same streams
+uint32_t rand_state;
+uint32_t next_rand(void) {
+   rand_state ^= rand_state << 13;
+   rand_state ^= rand_state >> 17;
+   rand_state ^= rand_state << 5;
+   return rand_state;
+}
+
+//mostly long data runs, which is where the scanner does its work, with
+//every kind of status byte and now and then realtime in the middle
+size_t make_stream(uint8_t * stream) {
+   size_t length = next_rand() % MAX_STREAM;
+   size_t i = 0;
+   while (i < length) {
+      uint32_t r = next_rand();
+      switch (r % 8) {
+         case 0:
+         case 1:
+         case 2:
+            {
+               //a run of data
+               size_t n = (r >> 8) % 80;
+               while (n-- && i < length)
+                  stream[i++] = next_rand() & 0x7F;
+            }
+            break;
+         case 3:
+         case 4:
+            stream[i++] = 0x80 | ((r >> 8) & 0x7F);
+            break;
+         case 5:
+            //system common, sysex and the undefined ones
+            stream[i++] = 0xF0 | ((r >> 8) & 0x07);
+            break;
+         case 6:
+            stream[i++] = 0xF8 | ((r >> 8) & 0x07);
+            break;
+         default:
+            stream[i++] = (r >> 8) & 0x7F;
+            break;
+      }
+   }
+   return length;
+}
+
+void check_same(size_t stream) {
+   size_t i;
+   if (ref_log.length != scan_log.length)
+      fprintf(stderr, "stream %zu: %zu callbacks, scanned %zu\n", stream, ref_log.length, scan_log.length);
+   assert(ref_log.length == scan_log.length);
+   for (i = 0; i < ref_log.length; i++) {
+      if (memcmp(&ref_log.entries[i], &scan_log.entries[i], sizeof(logged_t)) != 0)
+         fprintf(stderr, "stream %zu: callback %zu differs\n", stream, i);
+      assert(memcmp(&ref_log.entries[i], &scan_log.entries[i], sizeof(logged_t)) == 0);
+   }
+   assert(ref_device.input_state == scan_device.input_state);
+   assert(ref_device.input_count == scan_device.input_count);
+   assert(memcmp(ref_device.input_buffer, scan_device.input_buffer, 3) == 0);
+}
+
+int main(int argc, char * argv[]) {
+   size_t streams = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000;
+   uint32_t seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : 1;
+   static uint8_t stream[MAX_STREAM + 3];
+   size_t s, bytes = 0, callbacks = 0;
+
+   rand_state = seed ? seed : 1;
+   setup(&ref_device);
+   setup(&scan_device);
+
+   for (s = 0; s < streams; s++) {
+      size_t length = make_stream(stream);
+      size_t at = 0;
+
+      //the parsers carry on from the last stream, every few start over
+      if (!(next_rand() % 8)) {
+         setup(&ref_device);
+         setup(&scan_device);
+      }
+      ref_log.length = scan_log.length = 0;
+
+      midi_process_buffer(&ref_device, stream, length);
+      while (at < length) {
+         size_t piece = 1 + next_rand() % 600;
+         if (piece > length - at)
+            piece = length - at;
+         if (!(next_rand() % 4)) {
+            //queue a few bytes, which have to be parsed first
+            uint8_t queued = next_rand() % 4;
+            if (queued > piece)
+               queued = piece;
+            midi_device_input(&scan_device, queued, stream[at], stream[at + 1], stream[at + 2]);
+            at += queued;
+            piece -= queued;
+         }
+         midi_scan_process(&scan_device, stream + at, piece);
+         at += piece;
+      }
+
+      check_same(s);
+      bytes += length;
+      callbacks += ref_log.length;
+   }
+
+   printf("%s scanner: %zu streams, %zu bytes, %zu callbacks the same\n",
+         midi_scan_impl(), streams, bytes, callbacks);
+   printf("\n\nSCAN TEST PASSED!\n\n");
+   return 0;
+}
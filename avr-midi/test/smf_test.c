@@ -0,0 +1,150 @@
+//the midi file player on a small format 1 file, built with a tiny send
+//queue and track buffer [see the Makefile] so that both run out often
+#include "smf.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+   const uint8_t * data;
+   uint32_t length;
+} file_t;
+
+uint16_t file_read(void * context, uint32_t offset, uint8_t * data, uint16_t length) {
+   file_t * file = (file_t *)context;
+   if (offset >= file->length)
+      return 0;
+   if (length > file->length - offset)
+      length = file->length - offset;
+   memcpy(data, file->data + offset, length);
+   return length;
+}
+
+const uint8_t song[] = {
+   'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 3, 0, 96,
+   //conductor, 120 bpm then 60 from the second beat
+   'M', 'T', 'r', 'k', 0, 0, 0, 18,
+   0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+   0x60, 0xFF, 0x51, 0x03, 0x0F, 0x42, 0x40,
+   0x00, 0xFF, 0x2F, 0x00,
+   //a chunk we don't know
+   'X', 'Y', 'Z', 'W', 0, 0, 0, 4, 1, 2, 3, 4,
+   //notes in running status, a text event, a program change
+   'M', 'T', 'r', 'k', 0, 0, 0, 28,
+   0x00, 0x90, 0x3C, 0x64,
+   0x30, 0x3C, 0x00,
+   0x30, 0x3E, 0x64,
+   0x60, 0x80, 0x3E, 0x40,
+   0x00, 0xFF, 0x01, 0x03, 'a', 'b', 'c',
+   0x00, 0xC0, 0x05,
+   0x00, 0xFF, 0x2F, 0x00,
+   //a sysex and a cc a third of a beat later at the slower tempo, with a two
+   //byte delta time
+   'M', 'T', 'r', 'k', 0, 0, 0, 17,
+   0x81, 0x00, 0xF0, 0x05, 0x7D, 0x01, 0x02, 0x03, 0xF7,
+   0x00, 0xB1, 0x07, 0x7F,
+   0x00, 0xFF, 0x2F, 0x00,
+};
+
+//what should come out and when
+struct {
+   uint32_t due;
+   uint8_t length;
+   uint8_t data[3];
+} expected[] = {
+   {0, 3, {0x90, 0x3C, 0x64}},
+   {250000, 3, {0x90, 0x3C, 0x00}},
+   {500000, 3, {0x90, 0x3E, 0x64}},
+   {833333, 3, {0xF0, 0x7D, 0x01}},
+   {833333, 3, {0x02, 0x03, 0xF7}},
+   {833333, 3, {0xB1, 0x07, 0x7F}},
+   {1500000, 3, {0x80, 0x3E, 0x40}},
+   {1500000, 2, {0xC0, 0x05, 0}},
+};
+#define EXPECTED (sizeof(expected) / sizeof(expected[0]))
+
+uint8_t got[32][3];
+uint8_t got_length[32];
+uint32_t got_time[32];
+uint8_t got_count;
+uint32_t now;
+
+void log_send(MidiDevice * device, uint8_t cnt, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   assert(got_count < 32);
+   got_length[got_count] = cnt;
+   got[got_count][0] = byte0;
+   got[got_count][1] = byte1;
+   got[got_count][2] = byte2;
+   got_time[got_count++] = now;
+}
+
+int main(void) {
+   smf_player_t player;
+   smf_track_t tracks[3];
+   file_t file = {song, sizeof(song)};
+   MidiDevice device;
+   uint8_t i;
+
+   midi_init_device(&device);
+   midi_device_set_send_func(&device, log_send);
+
+   assert(smf_open(&player, tracks, 3, file_read, &file));
+   assert(player.track_count == 3);
+
+   //play on a clock that jumps to each due time, nothing goes early
+   while (1) {
+      uint32_t due;
+      smf_fill(&player);
+      if (!smf_next_due(&player, &due))
+         break;
+      assert(smf_send_due(&player, &device, due - 1) == 0);
+      now = due;
+      assert(smf_send_due(&player, &device, now) > 0);
+   }
+
+   assert(smf_done(&player));
+   assert(got_count == EXPECTED);
+   for (i = 0; i < EXPECTED; i++) {
+      assert(got_time[i] == expected[i].due);
+      assert(got_length[i] == expected[i].length);
+      assert(memcmp(got[i], expected[i].data, expected[i].length) == 0);
+   }
+   assert(!smf_fill(&player));
+
+   //too many tracks for the room we give it
+   assert(!smf_open(&player, tracks, 2, file_read, &file));
+   //format 2 and things that aren't midi files
+   {
+      uint8_t copy[sizeof(song)];
+      file_t other = {copy, sizeof(copy)};
+      memcpy(copy, song, sizeof(song));
+      copy[9] = 2;
+      assert(!smf_open(&player, tracks, 3, file_read, &other));
+      copy[0] = 'R';
+      assert(!smf_open(&player, tracks, 3, file_read, &other));
+      other.length = 10;
+      assert(!smf_open(&player, tracks, 3, file_read, &other));
+
+      //25 frames a second, 40 ticks a frame is a millisecond a tick and the
+      //tempo events don't count
+      memcpy(copy, song, sizeof(song));
+      other.length = sizeof(copy);
+      copy[12] = (uint8_t)-25;
+      copy[13] = 40;
+      got_count = 0;
+      assert(smf_open(&player, tracks, 3, file_read, &other));
+      while (1) {
+         uint32_t due;
+         smf_fill(&player);
+         if (!smf_next_due(&player, &due))
+            break;
+         now = due;
+         smf_send_due(&player, &device, now);
+      }
+      assert(got_count == EXPECTED);
+      assert(got_time[1] == 48000 && got_time[2] == 96000 && got_time[3] == 128000 && got_time[7] == 192000);
+   }
+
+   printf("\n\nSMF TEST PASSED!\n\n");
+   return 0;
+}
@@ -0,0 +1,289 @@
+//sysex firmware update bootloader for the 32u2
+
+#include "bootloader.h"
+#include "Descriptors.h"
+#include "sysex.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/wdt.h>
+#include <avr/power.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/delay.h>
+#include <util/crc16.h>
+
+//what the flash is doing with the page at flash_address
+typedef enum {
+   FLASH_IDLE,
+   FLASH_ERASE,
+   FLASH_WRITE
+} flash_state_t;
+
+USB_ClassInfo_MIDI_Device_t USB_MIDI_Interface =
+{
+   .Config =
+   {
+      .StreamingInterfaceNumber = 1,
+
+      .DataINEndpointNumber      = MIDI_STREAM_IN_EPNUM,
+      .DataINEndpointSize        = MIDI_STREAM_EPSIZE,
+      .DataINEndpointDoubleBank  = false,
+
+      .DataOUTEndpointNumber     = MIDI_STREAM_OUT_EPNUM,
+      .DataOUTEndpointSize       = MIDI_STREAM_EPSIZE,
+      .DataOUTEndpointDoubleBank = false,
+   },
+};
+
+static flash_state_t flash_state;
+static uint16_t flash_address;
+
+//a block waiting for the flash, page is NULL to only erase
+static bool page_waiting;
+static uint16_t page_address;
+static const uint8_t * page;
+
+static uint8_t block[BOOT_PAGE_SIZE];
+//block 0 is kept until the end, so the application only looks valid once
+//all of it is written
+static uint8_t first_block[BOOT_PAGE_SIZE];
+
+static bool updating;
+static bool ending;
+static bool done;
+static uint16_t blocks;
+static uint16_t received;
+
+void boot_check(void) __attribute__((naked, section(".init3")));
+
+//decide between us and the application, this runs before main so the key
+//isn't overwritten by the stack yet
+void boot_check(void) {
+   bool requested = (MCUSR & _BV(WDRF)) && *BOOT_KEY_ADDRESS == BOOT_KEY;
+
+   *BOOT_KEY_ADDRESS = 0;
+   if (requested || pgm_read_word(0) == 0xFFFF)
+      return;
+
+   MCUSR &= ~_BV(WDRF);
+   wdt_disable();
+   ((void (*)(void))0)();
+}
+
+static void boot_status(uint8_t status, uint16_t n) {
+   uint8_t data[3];
+   data[0] = status;
+   data[1] = n & 0x7F;
+   data[2] = (n >> 7) & 0x7F;
+   sysex_reply(SYSEX_CMD_BOOT_STATUS, data, 3);
+}
+
+static void boot_error(uint8_t status, uint16_t n) {
+   updating = false;
+   boot_status(status, n);
+}
+
+//progress isn't worth waiting for, only reply if the whole message fits in
+//the endpoint now, a host that only sends the .syx doesn't read replies
+static void boot_progress(uint16_t n) {
+   Endpoint_SelectEndpoint(MIDI_STREAM_IN_EPNUM);
+   if (Endpoint_IsReadWriteAllowed() &&
+         Endpoint_BytesInEndpoint() <= MIDI_STREAM_EPSIZE - 3 * sizeof(MIDI_EventPacket_t))
+      boot_status(BOOT_OK, n);
+}
+
+static void boot_output(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   MIDI_EventPacket_t packet;
+   packet.CableNumber = 0;
+   packet.Command = cin;
+   packet.Data1 = byte0;
+   packet.Data2 = byte1;
+   packet.Data3 = byte2;
+   MIDI_Device_SendEventPacket(&USB_MIDI_Interface, &packet);
+}
+
+static void boot_queue(uint16_t address, const uint8_t * data) {
+   page_address = address;
+   page = data;
+   page_waiting = true;
+}
+
+static void boot_begin(const uint8_t * data, uint8_t length) {
+   if (length != 2) {
+      boot_error(BOOT_ERR_SIZE, 0);
+      return;
+   }
+   blocks = data[0] | ((uint16_t)data[1] << 7);
+   if (blocks == 0 || blocks > BOOT_BLOCKS_MAX) {
+      boot_error(BOOT_ERR_SIZE, 0);
+      return;
+   }
+   received = 0;
+   ending = false;
+   updating = true;
+   //from here on a reset brings us back until the update is done
+   boot_queue(0, NULL);
+}
+
+static void boot_block(const uint8_t * data, uint8_t length) {
+   uint8_t * dest;
+   uint16_t n, crc;
+   uint8_t i;
+
+   if (!updating || ending) {
+      boot_status(BOOT_ERR_STATE, received);
+      return;
+   }
+   if (length != BOOT_BLOCK_MESSAGE) {
+      boot_error(BOOT_ERR_SIZE, received);
+      return;
+   }
+   n = data[0] | ((uint16_t)data[1] << 7);
+   if (n != received || n >= blocks) {
+      boot_error(BOOT_ERR_ORDER, received);
+      return;
+   }
+
+   dest = (n == 0) ? first_block : block;
+   sysex_unpack(data + 5, length - 5, dest);
+   crc = 0;
+   for (i = 0; i < BOOT_PAGE_SIZE; i++)
+      crc = _crc16_update(crc, dest[i]);
+   if (crc != (data[2] | ((uint16_t)data[3] << 7) | ((uint16_t)data[4] << 14))) {
+      boot_error(BOOT_ERR_CRC, n);
+      return;
+   }
+
+   received++;
+   if (n != 0)
+      boot_queue(n * BOOT_PAGE_SIZE, block);
+   else
+      boot_progress(n);
+}
+
+static void boot_end(void) {
+   if (!updating || ending) {
+      boot_status(BOOT_ERR_STATE, received);
+      return;
+   }
+   if (received != blocks) {
+      boot_error(BOOT_ERR_SIZE, received);
+      return;
+   }
+   ending = true;
+   boot_queue(0, first_block);
+}
+
+static void boot_command(uint8_t command, const uint8_t * data, uint8_t length) {
+   switch (command) {
+      case SYSEX_CMD_BOOT_BEGIN:
+         boot_begin(data, length);
+         break;
+      case SYSEX_CMD_BOOT_BLOCK:
+         boot_block(data, length);
+         break;
+      case SYSEX_CMD_BOOT_END:
+         boot_end();
+         break;
+      default:
+         break;
+   }
+}
+
+//start the next step of the page at flash_address once the last one is done,
+//interrupts are off around each spm as its timing is strict
+static void flash_task(void) {
+   uint8_t sreg;
+   uint8_t i;
+
+   if (boot_spm_busy())
+      return;
+
+   sreg = SREG;
+   cli();
+   switch (flash_state) {
+      case FLASH_IDLE:
+         if (!page_waiting)
+            break;
+         flash_address = page_address;
+         if (page) {
+            //fill the spm buffer first, then the page buffer is free for the
+            //next block while this one is erased and written
+            for (i = 0; i < BOOT_PAGE_SIZE; i += 2)
+               boot_page_fill(flash_address + i, page[i] | (page[i + 1] << 8));
+         }
+         page_waiting = false;
+         boot_page_erase(flash_address);
+         flash_state = FLASH_ERASE;
+         break;
+      case FLASH_ERASE:
+         if (page)
+            boot_page_write(flash_address);
+         flash_state = FLASH_WRITE;
+         break;
+      case FLASH_WRITE:
+         //let the application section be read again
+         boot_rww_enable();
+         flash_state = FLASH_IDLE;
+         SREG = sreg;
+         if (!page)
+            boot_status(BOOT_READY, 0);
+         else if (ending && flash_address == 0)
+            done = true;
+         else
+            boot_progress(flash_address / BOOT_PAGE_SIZE);
+         return;
+   }
+   SREG = sreg;
+}
+
+int main(void) {
+   MCUSR &= ~_BV(WDRF);
+   wdt_disable();
+   clock_prescale_set(clock_div_1);
+
+   //our interrupt vectors are in the boot section, the application section
+   //can't be read while it is written
+   MCUCR = _BV(IVCE);
+   MCUCR = _BV(IVSEL);
+
+   USB_Init();
+   sysex_init(boot_command);
+   sysex_set_output(boot_output);
+   sei();
+
+   for (;;) {
+      MIDI_EventPacket_t packet;
+
+      //only take input when a block has somewhere to go, otherwise the
+      //host waits on the endpoint
+      if (!page_waiting && MIDI_Device_ReceiveEventPacket(&USB_MIDI_Interface, &packet))
+         sysex_usb_input(packet.Command, packet.Data1, packet.Data2, packet.Data3);
+      flash_task();
+
+      if (done) {
+         boot_status(BOOT_DONE, blocks);
+         MIDI_Device_USBTask(&USB_MIDI_Interface);
+         //give the host a moment to read it, then start the application
+         //with a clean reset
+         _delay_ms(50);
+         USB_ShutDown();
+         wdt_enable(WDTO_15MS);
+         for (;;)
+            ;
+      }
+
+      MIDI_Device_USBTask(&USB_MIDI_Interface);
+      USB_USBTask();
+   }
+}
+
+void EVENT_USB_Device_ConfigurationChanged(void) {
+   MIDI_Device_ConfigureEndpoints(&USB_MIDI_Interface);
+}
+
+void EVENT_USB_Device_UnhandledControlRequest(void) {
+   MIDI_Device_ProcessControlRequest(&USB_MIDI_Interface);
+}
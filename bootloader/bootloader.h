@@ -0,0 +1,68 @@
+//sysex firmware update bootloader for the 32u2
+//
+//the bootloader lives in the 4k boot section [BOOTSZ fuses 00, BOOTRST
+//programmed] and shows up as a usb midi device like the application does,
+//so a new firmware is just a .syx file sent to it with any midi tool, no
+//driver switch like with dfu.  make syx in the top directory turns MIDI.hex
+//into MIDI.syx with bootloader/mksyx.
+//
+//getting in:
+//the application jumps here when sent SYSEX_CMD_BOOT_ENTER [F0 7D 30 F7].  It
+//leaves BOOT_KEY at BOOT_KEY_ADDRESS and resets with the watchdog, we look
+//for it before anything touches the stack.  We also stay when there is no
+//application, the first page is only written once a whole update has
+//arrived, so an update that didn't finish brings us back here.
+//
+//writing:
+//the application section is read-while-write, a page erase or write goes on
+//in the background while we keep running from the boot section.  A block is
+//one flash page.  When a block message is complete it is unpacked into a
+//page buffer and copied into the spm buffer as soon as the flash is free,
+//then erased and written.  The next block is received while that happens,
+//and usb input isn't read while a block is waiting on the flash, so the
+//host is held off by the endpoint instead of us dropping data.  An update
+//takes about as long as the slower of the transfer and the page writes.
+//
+//sysex commands [data bytes]:
+//SYSEX_CMD_BOOT_BEGIN blocks[2]
+//   number of blocks in the image, 7 bits per byte, least significant first.
+//   Erases the first page, replies BOOT_READY.
+//SYSEX_CMD_BOOT_BLOCK block[2] crc[3] data...
+//   block number, the crc-16 of the block's BOOT_PAGE_SIZE bytes
+//   [avr-libc's _crc16_update, starting from 0] and the bytes, 7 bit packed
+//   [see sysex.h].  Blocks come in order from 0.  Replies BOOT_OK once
+//   written, if the host has room for it.
+//SYSEX_CMD_BOOT_END
+//   writes the first block and replies BOOT_DONE, then starts the
+//   application.
+//
+//every reply is SYSEX_CMD_BOOT_STATUS status block[2].  An error is always
+//replied and the blocks after it are ignored, start again from BEGIN.
+
+#ifndef BOOTLOADER_H
+#define BOOTLOADER_H
+
+//the application section is everything below the boot section
+#define BOOT_START 0x7000
+#define BOOT_APP_SIZE BOOT_START
+#define BOOT_PAGE_SIZE 128
+#define BOOT_BLOCKS_MAX (BOOT_APP_SIZE / BOOT_PAGE_SIZE)
+
+//the largest block message, after the manufacturer id and command
+#define BOOT_BLOCK_MESSAGE (2 + 3 + SYSEX_PACKED_LENGTH(BOOT_PAGE_SIZE))
+
+//left by the application to ask for the bootloader, the last word of ram is
+//only used by the call to main, which we get to before
+#define BOOT_KEY 0xB007
+#define BOOT_KEY_ADDRESS ((volatile uint16_t *)(RAMEND - 1))
+
+//status replies
+#define BOOT_OK 0x00
+#define BOOT_READY 0x01
+#define BOOT_DONE 0x03
+#define BOOT_ERR_STATE 0x10
+#define BOOT_ERR_SIZE 0x11
+#define BOOT_ERR_ORDER 0x12
+#define BOOT_ERR_CRC 0x13
+
+#endif
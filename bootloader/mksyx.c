@@ -0,0 +1,103 @@
+//turn an application image into a .syx for the bootloader
+//
+//usage: mksyx image.bin image.syx
+//
+//the image is split into BOOT_PAGE_SIZE blocks, the last one padded with
+//erased flash, and written as a begin message, one message per block and an
+//end message [see bootloader.h].  Send it to the bootloader with any midi
+//tool, amidi -p hw:1 -s image.syx for instance.
+
+#include "bootloader.h"
+#include "sysex.h"
+#include "avr-midi/midi.h"
+#include <stdio.h>
+#include <string.h>
+
+//_crc16_update from avr-libc
+static uint16_t crc16_update(uint16_t crc, uint8_t a) {
+   int i;
+   crc ^= a;
+   for (i = 0; i < 8; i++) {
+      if (crc & 1)
+         crc = (crc >> 1) ^ 0xA001;
+      else
+         crc = (crc >> 1);
+   }
+   return crc;
+}
+
+static void write_message(FILE * out, uint8_t command, const uint8_t * data, size_t length) {
+   fputc(SYSEX_BEGIN, out);
+   fputc(SYSEX_EDUMANUFID, out);
+   fputc(command, out);
+   fwrite(data, 1, length, out);
+   fputc(SYSEX_END, out);
+}
+
+int main(int argc, char * argv[]) {
+   static uint8_t image[BOOT_APP_SIZE];
+   uint8_t message[BOOT_BLOCK_MESSAGE];
+   uint16_t blocks, n, crc;
+   size_t size;
+   FILE * in;
+   FILE * out;
+   int i;
+
+   if (argc != 3) {
+      fprintf(stderr, "usage: %s image.bin image.syx\n", argv[0]);
+      return 1;
+   }
+
+   in = fopen(argv[1], "rb");
+   if (!in) {
+      perror(argv[1]);
+      return 1;
+   }
+   memset(image, 0xFF, sizeof(image));
+   size = fread(image, 1, sizeof(image), in);
+   if (fgetc(in) != EOF) {
+      fprintf(stderr, "%s: larger than the %d bytes below the bootloader\n",
+            argv[1], BOOT_APP_SIZE);
+      fclose(in);
+      return 1;
+   }
+   fclose(in);
+   if (size == 0) {
+      fprintf(stderr, "%s: empty\n", argv[1]);
+      return 1;
+   }
+
+   out = fopen(argv[2], "wb");
+   if (!out) {
+      perror(argv[2]);
+      return 1;
+   }
+
+   blocks = (size + BOOT_PAGE_SIZE - 1) / BOOT_PAGE_SIZE;
+   message[0] = blocks & 0x7F;
+   message[1] = (blocks >> 7) & 0x7F;
+   write_message(out, SYSEX_CMD_BOOT_BEGIN, message, 2);
+
+   for (n = 0; n < blocks; n++) {
+      const uint8_t * block = image + n * BOOT_PAGE_SIZE;
+      crc = 0;
+      for (i = 0; i < BOOT_PAGE_SIZE; i++)
+         crc = crc16_update(crc, block[i]);
+      message[0] = n & 0x7F;
+      message[1] = (n >> 7) & 0x7F;
+      message[2] = crc & 0x7F;
+      message[3] = (crc >> 7) & 0x7F;
+      message[4] = (crc >> 14) & 0x7F;
+      sysex_pack(block, BOOT_PAGE_SIZE, message + 5);
+      write_message(out, SYSEX_CMD_BOOT_BLOCK, message, BOOT_BLOCK_MESSAGE);
+   }
+
+   write_message(out, SYSEX_CMD_BOOT_END, NULL, 0);
+
+   if (fclose(out) != 0) {
+      perror(argv[2]);
+      return 1;
+   }
+   printf("%s: %u bytes in %u blocks\n", argv[2], (unsigned)size, blocks);
+   return 0;
+}
@@ -0,0 +1,275 @@
+//runtime control and telemetry over sysex
+
+#include "control.h"
+#include "sysex.h"
+#include "usb_fifo.h"
+#include "scheduler.h"
+#include "input_map.h"
+#include "spi_link.h"
+#ifdef MATRIX_ENABLE
+#include "matrix.h"
+#endif
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+//channel mode messages sent by panic
+#define CONTROL_ALL_SOUND_OFF 120
+#define CONTROL_ALL_NOTES_OFF 123
+#define CONTROL_PANIC_CHANNELS 16
+
+typedef struct {
+   uint8_t command;
+   uint8_t seq;
+   //flags, or the input of a map write
+   uint8_t arg;
+   input_map_entry_t entry;
+} control_request_t;
+
+//builds one chunk of a response: the whole response is put a byte at a time
+//and only the bytes from start on that fit in the chunk are kept, so we
+//never need a buffer for all of it
+typedef struct {
+   uint8_t * out;
+   uint16_t start;
+   //offset of the next byte put, the response length once it is all put
+   uint16_t pos;
+   uint8_t length;
+} control_writer_t;
+
+static MidiDevice * dests[CONTROL_MAX_DESTS];
+
+//the head of the queue is the request being replied to
+static control_request_t queue[CONTROL_QUEUE_LENGTH];
+static uint8_t queue_head;
+static uint8_t queue_count;
+//how far we are through the reply at the head
+static uint16_t chunk;
+static uint16_t offset;
+
+static void put8(control_writer_t * w, uint8_t b) {
+   if (w->pos >= w->start && w->length < CONTROL_CHUNK_BYTES)
+      w->out[w->length++] = b;
+   w->pos++;
+}
+
+static void put16(control_writer_t * w, uint16_t v) {
+   put8(w, v & 0xFF);
+   put8(w, v >> 8);
+}
+
+static void control_stats(control_writer_t * w) {
+   uint8_t i;
+
+   put8(w, CONTROL_STATS_VERSION);
+   put16(w, usb_fifo_dropped());
+   put8(w, usb_fifo_length());
+   put16(w, sched_loop_max_cycles());
+
+   put8(w, sched_num_tasks());
+   for (i = 0; i < sched_num_tasks(); i++) {
+      const sched_task_t * task = sched_task(i);
+      put16(w, task->runs);
+      put16(w, task->max_cycles);
+      put16(w, sched_task_avg_cycles(i));
+      put16(w, task->overruns);
+   }
+
+   put8(w, spi_link_num_slaves());
+   for (i = 0; i < spi_link_num_slaves(); i++) {
+      const spi_link_stats_t * stats = spi_link_stats(i);
+      put8(w, spi_link_online(i));
+      put16(w, stats->transactions);
+      put16(w, stats->frames);
+      put16(w, stats->payloads);
+      put16(w, stats->sync_errors);
+      put16(w, stats->crc_errors);
+      put16(w, stats->lost);
+      put8(w, stats->max_gap);
+   }
+
+#ifdef MATRIX_ENABLE
+   {
+      const matrix_stats_t * stats = matrix_stats();
+      put8(w, 1);
+      put16(w, stats->scans);
+      put16(w, stats->dropped);
+      put8(w, stats->max_queued);
+      put16(w, stats->max_latency);
+   }
+#else
+   put8(w, 0);
+#endif
+}
+
+static void control_map(control_writer_t * w) {
+   uint8_t i;
+
+   put8(w, INPUT_MAP_SIZE);
+   put8(w, sizeof(input_map_entry_t));
+   for (i = 0; i < INPUT_MAP_SIZE; i++) {
+      const input_map_entry_t * entry = input_map_get(i);
+      put8(w, entry->type);
+      put8(w, entry->chan);
+      put8(w, entry->num);
+      put8(w, entry->on_val);
+      put8(w, entry->off_val);
+      put8(w, entry->flags);
+   }
+}
+
+#if SCHED_HISTOGRAM
+static void control_histogram(control_writer_t * w) {
+   uint8_t i;
+
+   put8(w, SCHED_HISTOGRAM_BUCKETS);
+   put8(w, F_CPU / 1000000UL);
+   for (i = 0; i < SCHED_HISTOGRAM_BUCKETS; i++)
+      put16(w, sched_loop_histogram(i));
+}
+#endif
+
+static void control_reply(const control_request_t * request, uint8_t status,
+      uint16_t n, const uint8_t * data, uint8_t length) {
+   uint8_t message[5 + SYSEX_PACKED_LENGTH(CONTROL_CHUNK_BYTES)];
+
+   message[0] = request->seq;
+   message[1] = request->command;
+   message[2] = status;
+   message[3] = n & 0x7F;
+   message[4] = (n >> 7) & 0x7F;
+   length = sysex_pack(data, length, message + 5);
+   sysex_reply(SYSEX_CMD_CTL_REPLY, message, 5 + length);
+}
+
+static void control_pop(void) {
+   queue_head = (queue_head + 1) % CONTROL_QUEUE_LENGTH;
+   queue_count--;
+   chunk = 0;
+   offset = 0;
+}
+
+void control_init(void) {
+   uint8_t i;
+   for (i = 0; i < CONTROL_MAX_DESTS; i++)
+      dests[i] = NULL;
+   queue_head = 0;
+   queue_count = 0;
+   chunk = 0;
+   offset = 0;
+}
+
+void control_set_dest(uint8_t n, MidiDevice * device) {
+   if (n < CONTROL_MAX_DESTS)
+      dests[n] = device;
+}
+
+void control_command(uint8_t command, const uint8_t * data, uint8_t length) {
+   control_request_t request;
+
+   //without a sequence id there is nothing to reply to
+   if (length < 1)
+      return;
+   request.command = command;
+   request.seq = data[0];
+   request.arg = 0;
+
+   switch (command) {
+      case SYSEX_CMD_CTL_STATS:
+#if SCHED_HISTOGRAM
+      case SYSEX_CMD_CTL_HISTOGRAM:
+#endif
+         if (length > 1)
+            request.arg = data[1];
+         break;
+      case SYSEX_CMD_CTL_MAP_READ:
+      case SYSEX_CMD_CTL_PANIC:
+         break;
+      case SYSEX_CMD_CTL_MAP_WRITE:
+         //kept until its turn, so reads before it see the old entry
+         if (length != 2 + sizeof(input_map_entry_t)) {
+            control_reply(&request, CONTROL_ERR_ARG, 0, NULL, 0);
+            return;
+         }
+         request.arg = data[1];
+         memcpy(&request.entry, data + 2, sizeof(input_map_entry_t));
+         break;
+      default:
+         control_reply(&request, CONTROL_ERR_COMMAND, 0, NULL, 0);
+         return;
+   }
+
+   if (queue_count == CONTROL_QUEUE_LENGTH) {
+      control_reply(&request, CONTROL_ERR_BUSY, 0, NULL, 0);
+      return;
+   }
+   queue[(queue_head + queue_count) % CONTROL_QUEUE_LENGTH] = request;
+   queue_count++;
+}
+
+void control_task(void) {
+   const control_request_t * request;
+   uint8_t data[CONTROL_CHUNK_BYTES];
+   midi_event_t panic[2];
+   control_writer_t w;
+   uint8_t i;
+
+   if (!queue_count)
+      return;
+   //leave at least half the fifo to the midi we're forwarding
+   if (usb_fifo_length() + CONTROL_CHUNK_PACKETS > USB_FIFO_LENGTH / 2)
+      return;
+   request = &queue[queue_head];
+
+   switch (request->command) {
+      case SYSEX_CMD_CTL_MAP_WRITE:
+         control_reply(request,
+               input_map_set(request->arg, &request->entry) ? CONTROL_LAST : CONTROL_ERR_ARG,
+               0, NULL, 0);
+         control_pop();
+         return;
+      case SYSEX_CMD_CTL_PANIC:
+         //offset counts channels here
+         if (offset < CONTROL_PANIC_CHANNELS) {
+            panic[0].length = panic[1].length = 3;
+            panic[0].data[0] = panic[1].data[0] = MIDI_CC | offset;
+            panic[0].data[1] = CONTROL_ALL_SOUND_OFF;
+            panic[1].data[1] = CONTROL_ALL_NOTES_OFF;
+            panic[0].data[2] = panic[1].data[2] = 0;
+            for (i = 0; i < CONTROL_MAX_DESTS; i++) {
+               if (dests[i])
+                  midi_send_events(dests[i], panic, 2);
+            }
+            offset++;
+         } else {
+            control_reply(request, CONTROL_LAST, 0, NULL, 0);
+            control_pop();
+         }
+         return;
+      default:
+         break;
+   }
+
+   w.out = data;
+   w.start = offset;
+   w.pos = 0;
+   w.length = 0;
+   if (request->command == SYSEX_CMD_CTL_STATS)
+      control_stats(&w);
+   else if (request->command == SYSEX_CMD_CTL_MAP_READ)
+      control_map(&w);
+#if SCHED_HISTOGRAM
+   else
+      control_histogram(&w);
+#endif
+   offset += w.length;
+
+   if (offset < w.pos) {
+      control_reply(request, CONTROL_MORE, chunk++, data, w.length);
+      return;
+   }
+   control_reply(request, CONTROL_LAST, chunk, data, w.length);
+   if (request->arg & CONTROL_RESET)
+      sched_reset_stats();
+   control_pop();
+}
@@ -0,0 +1,85 @@
+//runtime control and telemetry over sysex
+//
+//requests are our sysex messages with one of the SYSEX_CMD_CTL_* commands,
+//their first data byte is a sequence id [0-127] picked by the host.  Every
+//request is answered with one or more SYSEX_CMD_CTL_REPLY messages:
+//   seq command status chunk[2] data...
+//CONTROL_MORE means more chunks follow, CONTROL_LAST ends the reply and
+//anything else is an error, which ends it too.  chunk counts up from 0.
+//data is up to CONTROL_CHUNK_BYTES of the response, 7 bit packed [see
+//sysex.h], numbers in it are little endian.
+//
+//up to CONTROL_QUEUE_LENGTH requests can be outstanding, so a host can
+//pipeline them and match the replies up by sequence id.  Replies come in
+//request order.  A request that finds the queue full is answered with
+//CONTROL_ERR_BUSY straight away.
+//
+//control_task streams the replies a chunk at a time and only while the usb
+//fifo is less than half full, so a long reply never crowds out the midi we
+//are forwarding.  A full chunk fills CONTROL_CHUNK_PACKETS usb midi packets
+//exactly.  Responses are read from the live counters as they go out, values
+//in different chunks can be a few ms apart.
+//
+//commands [request data after seq], and their responses:
+//SYSEX_CMD_CTL_STATS flags
+//   CONTROL_STATS_VERSION[1]
+//   usb fifo: dropped[2] queued[1]
+//   loop max cycles[2]
+//   tasks[1], for each: runs[2] max cycles[2] avg cycles[2] overruns[2]
+//   slaves[1], for each: online[1] transactions[2] frames[2] payloads[2]
+//      sync errors[2] crc errors[2] lost[2] max gap[1]
+//   matrix[1], if 1: scans[2] dropped[2] max queued[1] max latency[2]
+//   with CONTROL_RESET in flags the scheduler counters [tasks, loop and
+//   histogram] are cleared once the reply is sent.
+//SYSEX_CMD_CTL_MAP_READ
+//   entries[1] entry size[1], then each input_map_entry_t in table order
+//SYSEX_CMD_CTL_MAP_WRITE input entry[6]
+//   sets an entry [not saved, see SYSEX_CMD_MAP_SAVE] in its turn, replies
+//   with no data or CONTROL_ERR_ARG
+//SYSEX_CMD_CTL_HISTOGRAM flags
+//   buckets[1] cycles per us[1] counts[2 each], see sched_loop_histogram.
+//   CONTROL_RESET works as for stats.  CONTROL_ERR_COMMAND in builds without
+//   SCHED_HISTOGRAM.
+//SYSEX_CMD_CTL_PANIC
+//   all sound off and all notes off on every channel of every destination,
+//   a channel per run of control_task, replies with no data when done
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <inttypes.h>
+#include "avr-midi/midi.h"
+
+#define CONTROL_QUEUE_LENGTH 4
+#define CONTROL_MAX_DESTS 2
+
+//response bytes per chunk, and the usb midi packets a full chunk takes: the
+//sysex header, seq, command, status and chunk number are 8 bytes, the data
+//packs to 24 and the end byte makes 33
+#define CONTROL_CHUNK_BYTES 21
+#define CONTROL_CHUNK_PACKETS 11
+
+#define CONTROL_STATS_VERSION 1
+
+//request flags
+#define CONTROL_RESET 0x01
+
+//reply status
+#define CONTROL_MORE 0x00
+#define CONTROL_LAST 0x01
+#define CONTROL_ERR_BUSY 0x10
+#define CONTROL_ERR_COMMAND 0x11
+#define CONTROL_ERR_ARG 0x12
+
+void control_init(void);
+//set the device panic sends to for destination n
+void control_set_dest(uint8_t n, MidiDevice * device);
+
+//handle one of the SYSEX_CMD_CTL_* commands
+void control_command(uint8_t command, const uint8_t * data, uint8_t length);
+
+//send the next chunk of the current reply, run it on every pass of the main
+//loop
+void control_task(void);
+
+#endif
@@ -0,0 +1,44 @@
+//bit parallel debouncing of whole input ports
+
+#include "debounce.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+static volatile debounce_port_t ports[DEBOUNCE_PORTS];
+
+uint8_t debounce_update(volatile debounce_port_t * p, uint8_t raw) {
+   uint8_t cnt0 = p->cnt0;
+   uint8_t cnt1 = p->cnt1;
+   //pins that disagree with the debounced state
+   uint8_t delta = raw ^ p->state;
+   uint8_t toggle;
+
+   //count the disagreeing pins up, reset the rest to zero
+   cnt1 = (cnt1 ^ cnt0) & delta;
+   cnt0 = ~cnt0 & delta;
+   //pins whose counter just rolled over have been stable long enough
+   toggle = delta & ~(cnt0 | cnt1);
+
+   p->cnt0 = cnt0;
+   p->cnt1 = cnt1;
+   p->state ^= toggle;
+   return toggle;
+}
+
+void debounce_sample(uint8_t port, uint8_t raw) {
+   ports[port].changes |= debounce_update(&ports[port], raw);
+}
+
+uint8_t debounce_state(uint8_t port) {
+   return ports[port].state;
+}
+
+uint8_t debounce_changes(uint8_t port) {
+   uint8_t changes;
+   uint8_t sreg = SREG;
+   cli();
+   changes = ports[port].changes;
+   ports[port].changes = 0;
+   SREG = sreg;
+   return changes;
+}
@@ -0,0 +1,44 @@
+//bit parallel debouncing of whole input ports
+//
+//each port gets a 2 bit vertical counter, bit n of cnt0 and cnt1 together
+//count how many samples in a row pin n has disagreed with its debounced
+//state.  After 4 disagreeing samples the state flips and the pin's bit is set
+//in the port's change mask.  A port of 8 pins costs the same few
+//instructions as a single pin, so adding ports adds a fixed cost per 8 pins.
+//
+//sample from a fixed rate timer interrupt so the debounce time doesn't
+//depend on how busy the main loop is, at 1kHz a pin must be stable for 4ms.
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <inttypes.h>
+
+//number of 8 bit ports we debounce
+#ifndef DEBOUNCE_PORTS
+#define DEBOUNCE_PORTS 2
+#endif
+
+typedef struct {
+   uint8_t state;
+   uint8_t cnt0;
+   uint8_t cnt1;
+   uint8_t changes;
+} debounce_port_t;
+
+//run the vertical counter of a port you keep yourself on a raw sample,
+//returns the bits whose debounced state just flipped [it doesn't touch
+//changes]
+uint8_t debounce_update(volatile debounce_port_t * port, uint8_t raw);
+
+//feed a raw sample of a port, 1 bits are active
+//call this from the sampling timer interrupt
+void debounce_sample(uint8_t port, uint8_t raw);
+
+//the debounced state of a port, 1 bits are active
+uint8_t debounce_state(uint8_t port);
+
+//the bits of a port that have changed since the last call, clears them
+uint8_t debounce_changes(uint8_t port);
+
+#endif
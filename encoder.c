@@ -0,0 +1,125 @@
+//quadrature decoding of endless rotary encoders
+
+#include "encoder.h"
+#include "scheduler.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+//the a/b pins of each encoder are adjacent, A is the lower bit
+#define ENCODER0_PIN PINB
+#define ENCODER0_PORT PORTB
+#define ENCODER0_DDR DDRB
+#define ENCODER0_SHIFT PINB6
+
+#define ENCODER1_PIN PINC
+#define ENCODER1_PORT PORTC
+#define ENCODER1_DDR DDRC
+#define ENCODER1_SHIFT PINC5
+
+#define ENCODER_AB_MASK 0x3
+#define ENCODER_DELTA_MAX 0x3FFF
+
+typedef struct {
+   //last a/b reading
+   uint8_t state;
+   //quarter steps towards the next detent
+   int8_t steps;
+   //tick of the last detent, for acceleration
+   uint8_t last_tick;
+   //no detent for ENCODER_ACCEL_MEDIUM ticks or more, the tick count wraps
+   //every 256 so a long gap would otherwise look like a short one
+   uint8_t idle;
+   //detents not yet taken by the main loop
+   int16_t delta;
+} encoder_t;
+
+//indexed by (old a/b << 2) | new a/b, invalid transitions [both pins
+//changed, we missed an edge] count as nothing
+static const int8_t transitions[16] PROGMEM = {
+    0, -1,  1,  0,
+    1,  0,  0, -1,
+   -1,  0,  0,  1,
+    0,  1, -1,  0
+};
+
+static volatile encoder_t encoders[ENCODER_NUM];
+
+static void encoder_update(uint8_t n, uint8_t ab) {
+   volatile encoder_t * enc = &encoders[n];
+   int8_t dir = pgm_read_byte(&transitions[(enc->state << 2) | ab]);
+   int16_t detents;
+   uint8_t now, dt;
+
+   enc->state = ab;
+   if (!dir)
+      return;
+
+   enc->steps += dir;
+   if (enc->steps > -ENCODER_STEPS_PER_DETENT && enc->steps < ENCODER_STEPS_PER_DETENT)
+      return;
+   detents = (enc->steps > 0) ? 1 : -1;
+   enc->steps = 0;
+
+   now = sched_now();
+   dt = now - enc->last_tick;
+   enc->last_tick = now;
+   if (enc->idle)
+      enc->idle = 0;
+   else if (dt < ENCODER_ACCEL_FAST)
+      detents *= ENCODER_ACCEL_FAST_MULT;
+   else if (dt < ENCODER_ACCEL_MEDIUM)
+      detents *= ENCODER_ACCEL_MEDIUM_MULT;
+
+   detents += enc->delta;
+   if (detents > ENCODER_DELTA_MAX)
+      detents = ENCODER_DELTA_MAX;
+   else if (detents < -ENCODER_DELTA_MAX)
+      detents = -ENCODER_DELTA_MAX;
+   enc->delta = detents;
+}
+
+ISR(PCINT0_vect) {
+   encoder_update(0, (ENCODER0_PIN >> ENCODER0_SHIFT) & ENCODER_AB_MASK);
+}
+
+ISR(PCINT1_vect) {
+   encoder_update(1, (ENCODER1_PIN >> ENCODER1_SHIFT) & ENCODER_AB_MASK);
+}
+
+void encoder_init(void) {
+   uint8_t i;
+
+   //inputs with pullups
+   ENCODER0_DDR &= ~(ENCODER_AB_MASK << ENCODER0_SHIFT);
+   ENCODER0_PORT |= (ENCODER_AB_MASK << ENCODER0_SHIFT);
+   ENCODER1_DDR &= ~(ENCODER_AB_MASK << ENCODER1_SHIFT);
+   ENCODER1_PORT |= (ENCODER_AB_MASK << ENCODER1_SHIFT);
+
+   for (i = 0; i < ENCODER_NUM; i++) {
+      encoders[i].steps = 0;
+      encoders[i].delta = 0;
+      encoders[i].last_tick = 0;
+      encoders[i].idle = 1;
+   }
+   encoders[0].state = (ENCODER0_PIN >> ENCODER0_SHIFT) & ENCODER_AB_MASK;
+   encoders[1].state = (ENCODER1_PIN >> ENCODER1_SHIFT) & ENCODER_AB_MASK;
+
+   PCMSK0 |= _BV(PCINT6) | _BV(PCINT7);
+   PCMSK1 |= _BV(PCINT8) | _BV(PCINT9);
+   PCICR |= _BV(PCIE0) | _BV(PCIE1);
+}
+
+int16_t encoder_take(uint8_t n) {
+   int16_t delta;
+   uint8_t sreg = SREG;
+   cli();
+   delta = encoders[n].delta;
+   encoders[n].delta = 0;
+   //we're called every few ticks, long before the tick count comes back
+   //around to the last detent
+   if ((uint8_t)(sched_now() - encoders[n].last_tick) >= ENCODER_ACCEL_MEDIUM)
+      encoders[n].idle = 1;
+   SREG = sreg;
+   return delta;
+}
@@ -0,0 +1,38 @@
+//quadrature decoding of endless rotary encoders
+//
+//every edge on an encoder pin fires a pin change interrupt, which looks up
+//the old and new a/b state in a 16 entry transition table to get a quarter
+//step of -1, 0 or +1.  Quarter steps are counted into detents and detents
+//are accumulated into a per encoder delta until the main loop takes them, so
+//no steps are lost however long the main loop is busy.
+//
+//detents that come quickly are accelerated, the faster the knob turns the
+//more each detent counts.
+//
+//encoder 0 is on PB6/PB7 [PCINT6/7], encoder 1 on PC5/PC6 [PCINT9/8]
+
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <inttypes.h>
+
+#define ENCODER_NUM 2
+//quarter steps per detent, most mechanical encoders have 4
+#define ENCODER_STEPS_PER_DETENT 4
+
+//acceleration, detents closer together than these [scheduler ticks, ms]
+//count as ENCODER_ACCEL_FAST_MULT or ENCODER_ACCEL_MEDIUM_MULT detents
+#define ENCODER_ACCEL_FAST 8
+#define ENCODER_ACCEL_FAST_MULT 4
+#define ENCODER_ACCEL_MEDIUM 25
+#define ENCODER_ACCEL_MEDIUM_MULT 2
+
+//set up the pins and pin change interrupts
+void encoder_init(void);
+
+//take the detents accumulated since the last call, positive is clockwise
+//this also tells acceleration an encoder has stopped, so call it well within
+//the 256 ticks the scheduler's tick count takes to wrap
+int16_t encoder_take(uint8_t n);
+
+#endif
@@ -0,0 +1,82 @@
+//the 32u2 side of the tiny48 input expanders
+
+#include "expander.h"
+#include "spi_link.h"
+#include "input_map.h"
+#include "spilink/expander_report.h"
+
+#if INPUT_MAP_EXPANDERS > SPI_LINK_MAX_SLAVES
+#error "more expanders than the spi link has slaves"
+#endif
+
+//last state reported for each digital port, 1 bits are active
+static uint8_t digital_state[INPUT_MAP_EXPANDERS][EXPANDER_DIGITAL_PORTS];
+//link errors when we last asked each expander for a resync
+static uint16_t errors_seen[INPUT_MAP_EXPANDERS];
+
+static void expander_digital(uint8_t expander, uint8_t port, uint8_t state) {
+   uint8_t changes = state ^ digital_state[expander][port];
+   uint8_t input = INPUT_MAP_EXPANDER(expander * EXPANDER_DIGITAL_INS + port * 8);
+
+   digital_state[expander][port] = state;
+   for (; changes; input++, changes >>= 1, state >>= 1) {
+      if (changes & 1)
+         input_map_event(input, state & 1);
+   }
+}
+
+static void expander_receive(uint8_t expander, const uint8_t * report, uint8_t len) {
+   uint8_t i = 0;
+
+   if (expander >= INPUT_MAP_EXPANDERS)
+      return;
+
+   while (i < len) {
+      uint8_t index = report[i] & EXPANDER_INDEX_MASK;
+      switch (report[i] & EXPANDER_TAG_MASK) {
+         case EXPANDER_DIGITAL:
+            if (i + EXPANDER_DIGITAL_LENGTH > len || index >= EXPANDER_DIGITAL_PORTS)
+               return;
+            expander_digital(expander, index, report[i + 1]);
+            i += EXPANDER_DIGITAL_LENGTH;
+            break;
+         case EXPANDER_ANALOG:
+            if (i + EXPANDER_ANALOG_LENGTH > len || index >= EXPANDER_ANALOG_INS)
+               return;
+            input_map_value(INPUT_MAP_ANALOG(expander * EXPANDER_ANALOG_INS + index),
+                  ((uint16_t)report[i + 1] << 7) | report[i + 2]);
+            i += EXPANDER_ANALOG_LENGTH;
+            break;
+         default:
+            //the crc passed so this is from a newer tiny48, skip the rest
+            return;
+      }
+   }
+}
+
+static uint16_t expander_link_errors(uint8_t expander) {
+   const spi_link_stats_t * stats = spi_link_stats(expander);
+   return stats->crc_errors + stats->sync_errors + stats->lost;
+}
+
+void expander_init(void) {
+   uint8_t e, i;
+   for (e = 0; e < INPUT_MAP_EXPANDERS && e < spi_link_num_slaves(); e++) {
+      for (i = 0; i < EXPANDER_DIGITAL_PORTS; i++)
+         digital_state[e][i] = 0;
+      errors_seen[e] = expander_link_errors(e);
+   }
+   spi_link_set_receive(expander_receive);
+}
+
+void expander_task(void) {
+   uint8_t e;
+   uint8_t cmd = EXPANDER_CMD_RESYNC;
+
+   for (e = 0; e < INPUT_MAP_EXPANDERS && e < spi_link_num_slaves(); e++) {
+      uint16_t errors = expander_link_errors(e);
+      //if a command is already waiting we try again next time
+      if (errors != errors_seen[e] && spi_link_send(e, &cmd, 1))
+         errors_seen[e] = errors;
+   }
+}
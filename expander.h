@@ -0,0 +1,22 @@
+//the 32u2 side of the tiny48 input expanders
+//
+//each tiny48 reports changes to its inputs over the spi link [see
+//spilink/expander_report.h], we turn them into input_map events.  Digital
+//input n of expander e is INPUT_MAP_EXPANDER(e * EXPANDER_DIGITAL_INS + n),
+//analog input n is INPUT_MAP_ANALOG(e * EXPANDER_ANALOG_INS + n).  Expander
+//e is spi link slave e, up to INPUT_MAP_EXPANDERS of them.
+//
+//reports are only sent on change, so one lost to a link error would leave us
+//out of step.  expander_task watches each link's error counters and asks the
+//tiny48 to report everything again when they move.
+
+#ifndef EXPANDER_H
+#define EXPANDER_H
+
+//take the reports from the spi link, call after the slaves are added
+void expander_init(void);
+
+//request resyncs after link errors, run it at SPI_LINK_POLL_MIN
+void expander_task(void);
+
+#endif
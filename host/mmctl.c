@@ -0,0 +1,419 @@
+//command line client for the MIDI MONSTER's runtime control sysex
+//
+//usage: mmctl [-d device] [-t timeout ms] command...
+//
+//commands:
+//   stats [reset]       task, usb fifo, spi link and matrix counters
+//   histogram [reset]   main loop passes by length
+//   map                 the input mapping table
+//   set input type chan num on off flags
+//                       set a mapping table entry [not saved]
+//   panic               all sound/notes off on every channel
+//
+//device is the midi port as a raw byte stream, /dev/snd/midiC1D0 for
+//instance [see amidi -l], or anything else that behaves like one, the tests
+//use a pty.  Several commands are pipelined, up to CONTROL_QUEUE_LENGTH
+//requests are outstanding at once and the replies are matched up by their
+//sequence ids.  See control.h for the protocol.
+
+#include "control.h"
+#include "sysex.h"
+#include "input_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define MMCTL_DEFAULT_DEVICE "/dev/midi1"
+#define MMCTL_DEFAULT_TIMEOUT 1000
+#define MMCTL_MAX_REQUESTS 64
+//the most response data we take for a request
+#define MMCTL_MAX_RESPONSE 4096
+//the longest sysex message we take
+#define MMCTL_MAX_MESSAGE 256
+
+typedef struct {
+   uint8_t command;
+   uint8_t data[8];
+   uint8_t length;
+
+   //reply assembly
+   uint8_t seq;
+   uint16_t chunk;
+   uint8_t response[MMCTL_MAX_RESPONSE];
+   size_t response_length;
+   int finished;
+} request_t;
+
+static request_t requests[MMCTL_MAX_REQUESTS];
+static int num_requests;
+
+static int device;
+static int timeout = MMCTL_DEFAULT_TIMEOUT;
+
+//incoming sysex message being collected
+static uint8_t message[MMCTL_MAX_MESSAGE];
+static size_t message_length;
+static int receiving;
+
+static void usage(const char * name) {
+   fprintf(stderr,
+         "usage: %s [-d device] [-t timeout ms] command...\n"
+         "commands:\n"
+         "   stats [reset]\n"
+         "   histogram [reset]\n"
+         "   map\n"
+         "   set input type chan num on off flags\n"
+         "   panic\n", name);
+   exit(2);
+}
+
+static uint16_t get16(const uint8_t * p) {
+   return p[0] | (p[1] << 8);
+}
+
+static int parse_number(const char * s, int max) {
+   char * end;
+   long v = strtol(s, &end, 0);
+   if (*s == '\0' || *end != '\0' || v < 0 || v > max) {
+      fprintf(stderr, "bad number: %s\n", s);
+      exit(2);
+   }
+   return (int)v;
+}
+
+//turn the command line into requests, returns the number of arguments used
+static int parse_command(int argc, char * argv[], request_t * request) {
+   const char * name = argv[0];
+   int used = 1;
+
+   request->length = 0;
+   if (strcmp(name, "stats") == 0 || strcmp(name, "histogram") == 0) {
+      request->command = (name[0] == 's') ? SYSEX_CMD_CTL_STATS : SYSEX_CMD_CTL_HISTOGRAM;
+      request->data[0] = 0;
+      if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+         request->data[0] = CONTROL_RESET;
+         used++;
+      }
+      request->length = 1;
+   } else if (strcmp(name, "map") == 0) {
+      request->command = SYSEX_CMD_CTL_MAP_READ;
+   } else if (strcmp(name, "panic") == 0) {
+      request->command = SYSEX_CMD_CTL_PANIC;
+   } else if (strcmp(name, "set") == 0) {
+      int i;
+      if (argc < 8)
+         usage("mmctl");
+      request->command = SYSEX_CMD_CTL_MAP_WRITE;
+      for (i = 0; i < 7; i++)
+         request->data[i] = parse_number(argv[1 + i], 0x7F);
+      request->length = 7;
+      used += 7;
+   } else {
+      fprintf(stderr, "unknown command: %s\n", name);
+      usage("mmctl");
+   }
+   return used;
+}
+
+static void send_request(request_t * request) {
+   uint8_t out[4 + sizeof(request->data) + 1];
+   size_t n = 0;
+
+   out[n++] = SYSEX_BEGIN;
+   out[n++] = SYSEX_EDUMANUFID;
+   out[n++] = request->command;
+   out[n++] = request->seq;
+   memcpy(out + n, request->data, request->length);
+   n += request->length;
+   out[n++] = SYSEX_END;
+   if (write(device, out, n) != (ssize_t)n) {
+      perror("write");
+      exit(1);
+   }
+}
+
+static void print_stats(const request_t * request) {
+   const uint8_t * p = request->response;
+   const uint8_t * end = p + request->response_length;
+   int i, n;
+
+   if (request->response_length < 7 || p[0] != CONTROL_STATS_VERSION) {
+      printf("stats: unknown format\n");
+      return;
+   }
+   printf("usb fifo: %u dropped, %u queued\n", get16(p + 1), p[3]);
+   printf("loop: max %u cycles\n", get16(p + 4));
+   p += 6;
+
+   n = *p++;
+   for (i = 0; i < n && p + 8 <= end; i++, p += 8)
+      printf("task %d: %u runs, max %u avg %u cycles, %u overruns\n", i,
+            get16(p), get16(p + 2), get16(p + 4), get16(p + 6));
+
+   if (p >= end)
+      return;
+   n = *p++;
+   for (i = 0; i < n && p + 14 <= end; i++, p += 14)
+      printf("slave %d: %s, %u transactions, %u frames, %u payloads, "
+            "%u sync errors, %u crc errors, %u lost, max gap %u\n", i,
+            p[0] ? "online" : "offline", get16(p + 1), get16(p + 3),
+            get16(p + 5), get16(p + 7), get16(p + 9), get16(p + 11), p[13]);
+
+   if (p < end && *p++ && p + 7 <= end)
+      printf("matrix: %u scans, %u dropped, max %u queued, max latency %u ms\n",
+            get16(p), get16(p + 2), p[4], get16(p + 5));
+}
+
+static void print_histogram(const request_t * request) {
+   const uint8_t * p = request->response;
+   int i, buckets, per_us;
+
+   if (request->response_length < 2) {
+      printf("histogram: unknown format\n");
+      return;
+   }
+   buckets = p[0];
+   per_us = p[1] ? p[1] : 1;
+   if (request->response_length < 2 + 2 * (size_t)buckets) {
+      printf("histogram: short\n");
+      return;
+   }
+   printf("loop passes by length:\n");
+   for (i = 0; i < buckets; i++) {
+      unsigned long low = i ? 1UL << (i - 1) : 0;
+      unsigned long high = (1UL << i) - 1;
+      uint16_t count = get16(p + 2 + 2 * i);
+      if (!count)
+         continue;
+      printf("%6lu-%-6lu cycles [%lu-%lu us]: %u\n", low, high,
+            low / per_us, high / per_us, count);
+   }
+}
+
+static void print_map(const request_t * request) {
+   const uint8_t * p = request->response;
+   int i, entries, size;
+
+   if (request->response_length < 2) {
+      printf("map: unknown format\n");
+      return;
+   }
+   entries = p[0];
+   size = p[1];
+   if (size < (int)sizeof(input_map_entry_t) ||
+         request->response_length < 2 + (size_t)(entries * size)) {
+      printf("map: short\n");
+      return;
+   }
+   for (i = 0, p += 2; i < entries; i++, p += size)
+      printf("input %d: type %u chan %u num %u on %u off %u flags 0x%02x\n",
+            i, p[0], p[1], p[2], p[3], p[4], p[5]);
+}
+
+static const char * status_name(uint8_t status) {
+   switch (status) {
+      case CONTROL_ERR_BUSY:
+         return "busy";
+      case CONTROL_ERR_COMMAND:
+         return "unknown command";
+      case CONTROL_ERR_ARG:
+         return "bad argument";
+      default:
+         return "error";
+   }
+}
+
+static void print_response(const request_t * request) {
+   switch (request->command) {
+      case SYSEX_CMD_CTL_STATS:
+         print_stats(request);
+         break;
+      case SYSEX_CMD_CTL_HISTOGRAM:
+         print_histogram(request);
+         break;
+      case SYSEX_CMD_CTL_MAP_READ:
+         print_map(request);
+         break;
+      case SYSEX_CMD_CTL_MAP_WRITE:
+         printf("input %u set\n", request->data[0]);
+         break;
+      case SYSEX_CMD_CTL_PANIC:
+         printf("panic sent\n");
+         break;
+   }
+}
+
+//take a complete reply message [after the manufacturer id and command],
+//returns the request it finished or -1
+static int handle_reply(const uint8_t * data, size_t length, int first, int sent, int * failed) {
+   request_t * request;
+   uint8_t unpacked[MMCTL_MAX_MESSAGE];
+   uint16_t chunk;
+   size_t n;
+   int i;
+
+   if (length < 5)
+      return -1;
+   for (i = first; i < sent; i++) {
+      if (!requests[i].finished && requests[i].seq == data[0] &&
+            requests[i].command == data[1])
+         break;
+   }
+   if (i == sent)
+      return -1;
+   request = &requests[i];
+
+   if (data[2] != CONTROL_MORE && data[2] != CONTROL_LAST) {
+      fprintf(stderr, "request %d: %s\n", i, status_name(data[2]));
+      *failed = 1;
+      return i;
+   }
+   chunk = data[3] | (data[4] << 7);
+   if (chunk != request->chunk) {
+      fprintf(stderr, "request %d: got chunk %u, expected %u\n", i, chunk, request->chunk);
+      *failed = 1;
+      return i;
+   }
+   request->chunk++;
+
+   n = sysex_unpack(data + 5, length - 5, unpacked);
+   if (request->response_length + n > sizeof(request->response)) {
+      fprintf(stderr, "request %d: response too long\n", i);
+      *failed = 1;
+      return i;
+   }
+   memcpy(request->response + request->response_length, unpacked, n);
+   request->response_length += n;
+
+   if (data[2] == CONTROL_MORE)
+      return -1;
+   print_response(request);
+   return i;
+}
+
+//take a byte of input, returns the request it finished or -1
+static int take_byte(uint8_t b, int first, int sent, int * failed) {
+   if (b == SYSEX_BEGIN) {
+      receiving = 1;
+      message_length = 0;
+   } else if (!receiving || midi_is_realtime(b)) {
+      //realtime messages may show up in the middle of sysex
+   } else if (b == SYSEX_END) {
+      receiving = 0;
+      if (message_length >= 2 && message[0] == SYSEX_EDUMANUFID &&
+            message[1] == SYSEX_CMD_CTL_REPLY)
+         return handle_reply(message + 2, message_length - 2, first, sent, failed);
+   } else if (midi_is_statusbyte(b) || message_length == sizeof(message)) {
+      receiving = 0;
+   } else {
+      message[message_length++] = b;
+   }
+   return -1;
+}
+
+//read from the device until a request is finished, returns it or -1 on a
+//timeout.  Input after the end of the reply is kept for the next call.
+static int wait_reply(int first, int sent, int * failed) {
+   static uint8_t in[256];
+   static ssize_t in_length;
+   static ssize_t in_pos;
+
+   for (;;) {
+      struct pollfd pfd;
+      int r;
+
+      while (in_pos < in_length) {
+         int done = take_byte(in[in_pos++], first, sent, failed);
+         if (done >= 0)
+            return done;
+      }
+
+      pfd.fd = device;
+      pfd.events = POLLIN;
+      r = poll(&pfd, 1, timeout);
+      if (r < 0) {
+         if (errno == EINTR)
+            continue;
+         perror("poll");
+         exit(1);
+      }
+      if (r == 0)
+         return -1;
+      in_pos = 0;
+      in_length = read(device, in, sizeof(in));
+      if (in_length <= 0) {
+         if (in_length < 0 && (errno == EINTR || errno == EAGAIN)) {
+            in_length = 0;
+            continue;
+         }
+         fprintf(stderr, "device closed\n");
+         exit(1);
+      }
+   }
+}
+
+int main(int argc, char * argv[]) {
+   const char * path = MMCTL_DEFAULT_DEVICE;
+   int first, sent, done, failed = 0;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "d:t:h")) != -1) {
+      switch (opt) {
+         case 'd':
+            path = optarg;
+            break;
+         case 't':
+            timeout = parse_number(optarg, 600000);
+            break;
+         default:
+            usage(argv[0]);
+      }
+   }
+   if (optind >= argc)
+      usage(argv[0]);
+
+   while (optind < argc) {
+      if (num_requests == MMCTL_MAX_REQUESTS) {
+         fprintf(stderr, "too many commands\n");
+         return 2;
+      }
+      optind += parse_command(argc - optind, argv + optind, &requests[num_requests]);
+      requests[num_requests].seq = num_requests & 0x7F;
+      num_requests++;
+   }
+
+   device = open(path, O_RDWR | O_NOCTTY);
+   if (device < 0) {
+      perror(path);
+      return 1;
+   }
+   if (isatty(device)) {
+      struct termios t;
+      tcgetattr(device, &t);
+      cfmakeraw(&t);
+      tcsetattr(device, TCSANOW, &t);
+   }
+
+   //keep the device's request queue full, replies come back in order
+   first = sent = 0;
+   while (first < num_requests) {
+      while (sent < num_requests && sent - first < CONTROL_QUEUE_LENGTH)
+         send_request(&requests[sent++]);
+      done = wait_reply(first, sent, &failed);
+      if (done < 0) {
+         fprintf(stderr, "timed out waiting for a reply\n");
+         return 1;
+      }
+      requests[done].finished = 1;
+      while (first < num_requests && requests[first].finished)
+         first++;
+   }
+
+   close(device);
+   return failed ? 1 : 0;
+}
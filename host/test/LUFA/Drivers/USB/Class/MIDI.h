@@ -0,0 +1,20 @@
+#ifndef FAKE_LUFA_MIDI_H
+#define FAKE_LUFA_MIDI_H
+
+//the usb midi types usb_fifo.h needs, the test plays the usb fifo itself
+
+#include <inttypes.h>
+
+typedef struct {
+   unsigned char Command : 4;
+   unsigned char CableNumber : 4;
+   uint8_t Data1;
+   uint8_t Data2;
+   uint8_t Data3;
+} MIDI_EventPacket_t;
+
+typedef struct {
+   int unused;
+} USB_ClassInfo_MIDI_Device_t;
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef FAKE_AVR_INTERRUPT_H
+#define FAKE_AVR_INTERRUPT_H
+
+//just enough for the bytequeue to build on the host
+
+#include <inttypes.h>
+
+extern volatile uint8_t SREG;
+
+#define cli()
+#define sei()
+
+#endif
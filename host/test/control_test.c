@@ -0,0 +1,367 @@
+//host side stand-in for the device end of the control protocol
+//
+//../../control.c and ../../sysex.c run here against fake counters, with a
+//pty in place of the usb midi port.  ../mmctl is run on the other end and
+//what it prints is checked against the fakes.  Replies go through a fake usb
+//fifo that only sends a few packets per pass of our loop, so long replies
+//are paced like they are on the device and we can check they never take
+//more than half the fifo.
+
+#define _XOPEN_SOURCE 600
+#define _DEFAULT_SOURCE
+
+#include "control.h"
+#include "sysex.h"
+#include "usb_fifo.h"
+#include "scheduler.h"
+#include "input_map.h"
+#include "spi_link.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+//packets the fake fifo sends per pass
+#define FIFO_SEND_PER_PASS 4
+#define NUM_TASKS 3
+
+volatile uint8_t SREG;
+
+static int pty;
+
+//fake usb fifo, packets written to the pty as midi bytes
+static MIDI_EventPacket_t fifo[USB_FIFO_LENGTH];
+static uint8_t fifo_start;
+static uint8_t fifo_count;
+static uint8_t fifo_max;
+
+//fake counters
+static sched_task_t tasks[NUM_TASKS];
+static spi_link_stats_t slave_stats;
+static input_map_entry_t map[INPUT_MAP_SIZE];
+static int resets;
+
+static MidiDevice usb_device;
+static MidiDevice serial_device;
+static int serial_all_sound_off;
+static int serial_all_notes_off;
+
+bool usb_fifo_push(const MIDI_EventPacket_t * packet) {
+   assert(fifo_count < USB_FIFO_LENGTH);
+   fifo[(fifo_start + fifo_count) % USB_FIFO_LENGTH] = *packet;
+   fifo_count++;
+   if (fifo_count > fifo_max)
+      fifo_max = fifo_count;
+   return true;
+}
+
+uint8_t usb_fifo_length(void) {
+   return fifo_count;
+}
+
+uint16_t usb_fifo_dropped(void) {
+   return 7;
+}
+
+//send a few packets, sysex ones carry as many bytes as their cin says,
+//anything else is a channel message
+static void fifo_send(void) {
+   uint8_t i;
+   for (i = 0; i < FIFO_SEND_PER_PASS && fifo_count; i++) {
+      MIDI_EventPacket_t * packet = &fifo[fifo_start];
+      uint8_t bytes[3];
+      size_t n;
+
+      bytes[0] = packet->Data1;
+      bytes[1] = packet->Data2;
+      bytes[2] = packet->Data3;
+      if (packet->Command >= 0x5 && packet->Command <= 0x7)
+         n = packet->Command - 0x4;
+      else
+         n = 3;
+      assert(write(pty, bytes, n) == (ssize_t)n);
+
+      fifo_start = (fifo_start + 1) % USB_FIFO_LENGTH;
+      fifo_count--;
+   }
+}
+
+static void sysex_output(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   MIDI_EventPacket_t packet;
+   packet.CableNumber = 0;
+   packet.Command = cin;
+   packet.Data1 = byte0;
+   packet.Data2 = byte1;
+   packet.Data3 = byte2;
+   usb_fifo_push(&packet);
+}
+
+static void usb_send(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   sysex_output(byte0 >> 4, byte0, byte1, byte2);
+}
+
+static void serial_send(MidiDevice * device, uint8_t count, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   assert(count == 3 && (byte0 & 0xF0) == MIDI_CC);
+   if (byte1 == 120)
+      serial_all_sound_off++;
+   else if (byte1 == 123)
+      serial_all_notes_off++;
+}
+
+uint8_t sched_num_tasks(void) {
+   return NUM_TASKS;
+}
+
+const sched_task_t * sched_task(uint8_t index) {
+   return &tasks[index];
+}
+
+uint16_t sched_task_avg_cycles(uint8_t index) {
+   return index + 1;
+}
+
+uint16_t sched_loop_max_cycles(void) {
+   return 1234;
+}
+
+uint16_t sched_loop_histogram(uint8_t bucket) {
+   //a few passes in the buckets 8 to 11, 128 to 2047 cycles
+   if (bucket >= 8 && bucket < 12)
+      return 100 * (bucket - 7);
+   return 0;
+}
+
+void sched_reset_stats(void) {
+   resets++;
+}
+
+uint8_t spi_link_num_slaves(void) {
+   return 1;
+}
+
+bool spi_link_online(uint8_t slave) {
+   return true;
+}
+
+const spi_link_stats_t * spi_link_stats(uint8_t slave) {
+   return &slave_stats;
+}
+
+const input_map_entry_t * input_map_get(uint8_t input) {
+   return &map[input];
+}
+
+bool input_map_set(uint8_t input, const input_map_entry_t * entry) {
+   if (input >= INPUT_MAP_SIZE || entry->type > INPUT_MAP_PROGCHANGE)
+      return false;
+   map[input] = *entry;
+   return true;
+}
+
+static void sysex_command(uint8_t command, const uint8_t * data, uint8_t length) {
+   control_command(command, data, length);
+}
+
+static void setup(void) {
+   uint8_t i;
+
+   memset(tasks, 0, sizeof(tasks));
+   for (i = 0; i < NUM_TASKS; i++) {
+      tasks[i].runs = 100 * (i + 1);
+      tasks[i].max_cycles = 10 * (i + 1);
+   }
+   tasks[1].overruns = 5;
+
+   memset(&slave_stats, 0, sizeof(slave_stats));
+   slave_stats.transactions = 1000;
+   slave_stats.frames = 990;
+   slave_stats.payloads = 40;
+   slave_stats.crc_errors = 10;
+   slave_stats.max_gap = 4;
+
+   for (i = 0; i < INPUT_MAP_SIZE; i++) {
+      map[i].type = INPUT_MAP_NOTE;
+      map[i].chan = i % 16;
+      map[i].num = 36 + i;
+      map[i].on_val = 127;
+      map[i].off_val = 0;
+      map[i].flags = INPUT_MAP_DEST(0);
+   }
+
+   fifo_start = fifo_count = fifo_max = 0;
+   resets = 0;
+   serial_all_sound_off = serial_all_notes_off = 0;
+
+   midi_init_device(&usb_device);
+   midi_device_set_send_func(&usb_device, usb_send);
+   midi_init_device(&serial_device);
+   midi_device_set_send_func(&serial_device, serial_send);
+
+   sysex_init(sysex_command);
+   sysex_set_output(sysex_output);
+   control_init();
+   control_set_dest(0, &usb_device);
+   control_set_dest(1, &serial_device);
+}
+
+//run mmctl with the given arguments against us, returns its exit status
+//and what it printed in output
+static int run_client(const char * device, const char * const args[], char * output, size_t size) {
+   int out[2];
+   size_t got = 0;
+   pid_t pid;
+   int status;
+
+   assert(pipe(out) == 0);
+   pid = fork();
+   assert(pid >= 0);
+   if (pid == 0) {
+      const char * argv[32];
+      int n = 0;
+      argv[n++] = "mmctl";
+      argv[n++] = "-d";
+      argv[n++] = device;
+      while (*args)
+         argv[n++] = *args++;
+      argv[n] = NULL;
+      dup2(out[1], 1);
+      close(out[0]);
+      execv("../mmctl", (char * const *)argv);
+      perror("../mmctl");
+      _exit(127);
+   }
+   close(out[1]);
+   fcntl(out[0], F_SETFL, O_NONBLOCK);
+
+   for (;;) {
+      struct pollfd pfd;
+      uint8_t in[64];
+      ssize_t n, i;
+
+      //the device side, one pass of its main loop
+      pfd.fd = pty;
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 1) > 0) {
+         n = read(pty, in, sizeof(in));
+         for (i = 0; i < n; i++)
+            sysex_input_byte(in[i]);
+      }
+      control_task();
+      fifo_send();
+
+      if (got + 1 < size) {
+         n = read(out[0], output + got, size - got - 1);
+         if (n > 0)
+            got += n;
+      }
+      if (waitpid(pid, &status, WNOHANG) == pid)
+         break;
+   }
+   for (;;) {
+      ssize_t n = read(out[0], output + got, size - got - 1);
+      if (n <= 0)
+         break;
+      got += n;
+   }
+   output[got] = '\0';
+   close(out[0]);
+
+   assert(WIFEXITED(status));
+   return WEXITSTATUS(status);
+}
+
+static void expect(const char * output, const char * line) {
+   if (!strstr(output, line)) {
+      fprintf(stderr, "missing \"%s\" in:\n%s", line, output);
+      abort();
+   }
+}
+
+static void test_pipelined(const char * device) {
+   //more requests than the device queues, with a write between two reads
+   const char * const args[] = {
+      "stats", "reset", "histogram", "map", "set", "3", "1", "2", "20", "100", "0", "0x10",
+      "map", "panic", NULL
+   };
+   char output[16384];
+   char line[128];
+   const char * first_map;
+
+   setup();
+   assert(run_client(device, args, output, sizeof(output)) == 0);
+
+   expect(output, "usb fifo: 7 dropped");
+   expect(output, "loop: max 1234 cycles\n");
+   expect(output, "task 0: 100 runs, max 10 avg 1 cycles, 0 overruns\n");
+   expect(output, "task 1: 200 runs, max 20 avg 2 cycles, 5 overruns\n");
+   expect(output, "task 2: 300 runs, max 30 avg 3 cycles, 0 overruns\n");
+   expect(output, "slave 0: online, 1000 transactions, 990 frames, 40 payloads, "
+         "0 sync errors, 10 crc errors, 0 lost, max gap 4\n");
+   assert(resets == 1);
+
+   expect(output, "loop passes by length:\n");
+   expect(output, "   128-255    cycles [8-15 us]: 100\n");
+   expect(output, "  1024-2047   cycles [64-127 us]: 400\n");
+
+   //the first map read is from before the write, the second after
+   first_map = strstr(output, "input 3: type 2 chan 3 num 39 on 127 off 0 flags 0x10\n");
+   assert(first_map);
+   expect(output, "input 3 set\n");
+   expect(first_map, "input 3: type 1 chan 2 num 20 on 100 off 0 flags 0x10\n");
+   //the map is many chunks long, make sure the last entry made it
+   snprintf(line, sizeof(line), "input %d: type 2 chan %d num %d on 127 off 0 flags 0x10\n",
+         INPUT_MAP_SIZE - 1, (INPUT_MAP_SIZE - 1) % 16, 36 + INPUT_MAP_SIZE - 1);
+   expect(first_map, line);
+
+   expect(output, "panic sent\n");
+   assert(serial_all_sound_off == 16 && serial_all_notes_off == 16);
+
+   //replies never took more than half the fifo
+   assert(fifo_max <= USB_FIFO_LENGTH / 2);
+}
+
+static void test_errors(const char * device) {
+   char output[1024];
+   const char * const bad_input[] = {"set", "100", "1", "0", "0", "0", "0", "0", NULL};
+   const char * const bad_type[] = {"set", "0", "9", "0", "0", "0", "0", "0", "stats", NULL};
+
+   setup();
+   assert(run_client(device, bad_input, output, sizeof(output)) == 1);
+   //an error doesn't stop the requests after it
+   assert(run_client(device, bad_type, output, sizeof(output)) == 1);
+   expect(output, "task 2: 300 runs");
+   assert(map[0].type == INPUT_MAP_NOTE);
+}
+
+int main(void) {
+   struct termios t;
+   const char * device;
+   int slave;
+
+   pty = posix_openpt(O_RDWR | O_NOCTTY);
+   assert(pty >= 0);
+   assert(grantpt(pty) == 0 && unlockpt(pty) == 0);
+   device = ptsname(pty);
+   assert(device);
+
+   //keep our own end of the slave open and raw, so the line is never hung
+   //up between clients and nothing is echoed back
+   slave = open(device, O_RDWR | O_NOCTTY);
+   assert(slave >= 0);
+   tcgetattr(slave, &t);
+   cfmakeraw(&t);
+   tcsetattr(slave, TCSANOW, &t);
+
+   test_pipelined(device);
+   test_errors(device);
+
+   close(slave);
+   close(pty);
+   printf("TEST PASSED!\n");
+   return 0;
+}
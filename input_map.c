@@ -0,0 +1,302 @@
+//table mapping our physical inputs to the midi messages they send
+
+#include "input_map.h"
+#include <avr/eeprom.h>
+#include <stddef.h>
+
+#define INPUT_MAP_MAGIC 0x4D
+
+typedef struct {
+   uint8_t magic;
+   uint8_t version;
+   uint8_t count;
+   //INPUT_MAP_EXPANDERS of the build that saved the table
+   uint8_t expanders;
+} input_map_header_t;
+
+//the sections of the table, in table order, the size of some depends on
+//the number of expanders
+#define INPUT_MAP_SECTIONS 4
+
+//the header first, so that it stays put when a build with another number of
+//expanders has a longer or shorter table
+static struct {
+   input_map_header_t header;
+   input_map_entry_t table[INPUT_MAP_SIZE];
+} EEMEM ee_map;
+
+static input_map_entry_t table[INPUT_MAP_SIZE];
+//current state of toggle inputs, one bit per input
+static uint8_t toggled[(INPUT_MAP_SIZE + 7) / 8];
+static MidiDevice * dests[INPUT_MAP_MAX_DESTS];
+static input_map_busy_func_t dest_busy[INPUT_MAP_MAX_DESTS];
+//last value sent for each analog input, at the resolution it was sent
+static uint16_t analog_sent[INPUT_MAP_NUM_ANALOG];
+#define INPUT_MAP_UNSENT 0xFFFF
+//current absolute value of each encoder
+static uint8_t encoder_value[INPUT_MAP_NUM_ENCODER];
+//per destination, relative detents not sent yet, and the absolute value
+//last sent
+static int16_t encoder_held[INPUT_MAP_NUM_ENCODER][INPUT_MAP_MAX_DESTS];
+static uint8_t encoder_sent[INPUT_MAP_NUM_ENCODER][INPUT_MAP_MAX_DESTS];
+#define INPUT_MAP_RELATIVE_CENTER 64
+
+static void input_map_default(uint8_t input, input_map_entry_t * entry) {
+   //what the board always did, cc on channel 16 numbered by input, 127 when
+   //active, 0 when not, to both usb and serial
+   entry->type = INPUT_MAP_CC;
+   entry->chan = 15;
+   entry->num = input;
+   entry->on_val = 127;
+   entry->off_val = 0;
+   entry->flags = INPUT_MAP_DEST(0) | INPUT_MAP_DEST(1);
+}
+
+static bool input_map_valid(const input_map_entry_t * entry) {
+   return entry->type <= INPUT_MAP_PROGCHANGE &&
+      entry->chan <= MIDI_CHANMASK &&
+      !((entry->num | entry->on_val | entry->off_val | entry->flags) & MIDI_STATUSMASK);
+}
+
+static uint16_t input_map_section_length(uint8_t section, uint8_t expanders) {
+   switch (section) {
+      case 0:
+         return INPUT_MAP_NUM_DIGITAL;
+      case 1:
+         return INPUT_MAP_ANALOG_PER_EXPANDER * expanders;
+      case 2:
+         return INPUT_MAP_NUM_ENCODER;
+      default:
+         return INPUT_MAP_DIGITAL_PER_EXPANDER * expanders;
+   }
+}
+
+void input_map_init(void) {
+   input_map_header_t header;
+   uint16_t saved_at = 0, at = 0;
+   uint8_t section;
+
+   input_map_reset();
+
+   eeprom_read_block(&header, &ee_map.header, sizeof(input_map_header_t));
+   if (header.magic != INPUT_MAP_MAGIC || header.version != INPUT_MAP_VERSION)
+      return;
+
+   //a section at a time, as much of each as both tables have, so a table
+   //saved with more or fewer expanders still lands on the right inputs.
+   //Anything the saved table doesn't cover [or that is garbage] keeps its
+   //default.
+   for (section = 0; section < INPUT_MAP_SECTIONS; section++) {
+      uint16_t saved = input_map_section_length(section, header.expanders);
+      uint16_t ours = input_map_section_length(section, INPUT_MAP_EXPANDERS);
+      uint16_t i;
+      for (i = 0; i < saved && i < ours && saved_at + i < header.count; i++) {
+         input_map_entry_t entry;
+         eeprom_read_block(&entry, &ee_map.table[saved_at + i], sizeof(input_map_entry_t));
+         input_map_set(at + i, &entry);
+      }
+      saved_at += saved;
+      at += ours;
+   }
+}
+
+void input_map_set_dest(uint8_t n, MidiDevice * device) {
+   if (n < INPUT_MAP_MAX_DESTS)
+      dests[n] = device;
+}
+
+void input_map_set_dest_busy(uint8_t n, input_map_busy_func_t busy) {
+   if (n < INPUT_MAP_MAX_DESTS)
+      dest_busy[n] = busy;
+}
+
+static void input_map_encoder_clear(uint8_t n) {
+   uint8_t i;
+   encoder_value[n] = table[INPUT_MAP_ENCODER(n)].off_val;
+   for (i = 0; i < INPUT_MAP_MAX_DESTS; i++) {
+      encoder_held[n][i] = 0;
+      encoder_sent[n][i] = encoder_value[n];
+   }
+}
+
+void input_map_event(uint8_t input, bool active) {
+   const input_map_entry_t * entry;
+   uint8_t mask, val, i;
+   bool on;
+
+   if (input >= INPUT_MAP_SIZE)
+      return;
+   entry = &table[input];
+   mask = 1 << (input & 0x7);
+
+   if (entry->flags & INPUT_MAP_TOGGLE) {
+      //toggles only act when activated
+      if (!active)
+         return;
+      toggled[input >> 3] ^= mask;
+      on = toggled[input >> 3] & mask;
+   } else {
+      on = active;
+   }
+
+   if (entry->flags & (on ? INPUT_MAP_SKIP_ON : INPUT_MAP_SKIP_OFF))
+      return;
+   val = on ? entry->on_val : entry->off_val;
+
+   for (i = 0; i < INPUT_MAP_MAX_DESTS; i++) {
+      MidiDevice * device = dests[i];
+      if (!device || !(entry->flags & INPUT_MAP_DEST(i)))
+         continue;
+      switch (entry->type) {
+         case INPUT_MAP_CC:
+            midi_send_cc(device, entry->chan, entry->num, val);
+            break;
+         case INPUT_MAP_NOTE:
+            if (on)
+               midi_send_noteon(device, entry->chan, entry->num, val);
+            else
+               midi_send_noteoff(device, entry->chan, entry->num, val);
+            break;
+         case INPUT_MAP_PROGCHANGE:
+            midi_send_programchange(device, entry->chan, val);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+void input_map_value(uint8_t input, uint16_t value) {
+   const input_map_entry_t * entry;
+   uint16_t * sent;
+   bool fine;
+   uint8_t i;
+
+   if (input < INPUT_MAP_ANALOG(0) || input >= INPUT_MAP_ENCODER(0))
+      return;
+   entry = &table[input];
+   if (entry->type != INPUT_MAP_CC)
+      return;
+   sent = &analog_sent[input - INPUT_MAP_ANALOG(0)];
+
+   if (value > INPUT_MAP_VALUE_MAX)
+      value = INPUT_MAP_VALUE_MAX;
+   fine = (entry->flags & INPUT_MAP_14BIT) && entry->num < 32;
+   if (!fine)
+      value >>= 7;
+   if (value == *sent)
+      return;
+   *sent = value;
+
+   for (i = 0; i < INPUT_MAP_MAX_DESTS; i++) {
+      MidiDevice * device = dests[i];
+      if (!device || !(entry->flags & INPUT_MAP_DEST(i)))
+         continue;
+      if (fine) {
+         midi_send_cc(device, entry->chan, entry->num, value >> 7);
+         midi_send_cc(device, entry->chan, entry->num + 32, value & 0x7F);
+      } else {
+         midi_send_cc(device, entry->chan, entry->num, value);
+      }
+   }
+}
+
+void input_map_delta(uint8_t input, int16_t delta) {
+   const input_map_entry_t * entry;
+   uint8_t n, val, i;
+
+   if (input < INPUT_MAP_ENCODER(0) || input >= INPUT_MAP_EXPANDER(0))
+      return;
+   entry = &table[input];
+   if (entry->type != INPUT_MAP_CC)
+      return;
+   n = input - INPUT_MAP_ENCODER(0);
+
+   if (!(entry->flags & INPUT_MAP_RELATIVE)) {
+      int16_t next = (int16_t)encoder_value[n] + delta;
+      if (next > entry->on_val)
+         next = entry->on_val;
+      if (next < entry->off_val)
+         next = entry->off_val;
+      encoder_value[n] = next;
+   }
+
+   for (i = 0; i < INPUT_MAP_MAX_DESTS; i++) {
+      MidiDevice * device = dests[i];
+      if (!device || !(entry->flags & INPUT_MAP_DEST(i)))
+         continue;
+
+      if (entry->flags & INPUT_MAP_RELATIVE) {
+         int16_t held = encoder_held[n][i] + delta;
+         //anything past what one message can carry is dropped
+         if (held > INPUT_MAP_RELATIVE_CENTER - 1)
+            held = INPUT_MAP_RELATIVE_CENTER - 1;
+         else if (held < -INPUT_MAP_RELATIVE_CENTER)
+            held = -INPUT_MAP_RELATIVE_CENTER;
+         encoder_held[n][i] = held;
+         if (!held || (dest_busy[i] && dest_busy[i]()))
+            continue;
+         val = INPUT_MAP_RELATIVE_CENTER + held;
+         encoder_held[n][i] = 0;
+      } else {
+         val = encoder_value[n];
+         if (val == encoder_sent[n][i] || (dest_busy[i] && dest_busy[i]()))
+            continue;
+         encoder_sent[n][i] = val;
+      }
+      midi_send_cc(device, entry->chan, entry->num, val);
+   }
+}
+
+bool input_map_relative_cc(uint8_t chan, uint8_t num) {
+   uint8_t i;
+   for (i = INPUT_MAP_ENCODER(0); i < INPUT_MAP_EXPANDER(0); i++) {
+      const input_map_entry_t * entry = &table[i];
+      if (entry->type == INPUT_MAP_CC && (entry->flags & INPUT_MAP_RELATIVE) &&
+            entry->chan == chan && entry->num == num)
+         return true;
+   }
+   return false;
+}
+
+const input_map_entry_t * input_map_get(uint8_t input) {
+   if (input >= INPUT_MAP_SIZE)
+      return NULL;
+   return &table[input];
+}
+
+bool input_map_set(uint8_t input, const input_map_entry_t * entry) {
+   if (input >= INPUT_MAP_SIZE || !input_map_valid(entry))
+      return false;
+   table[input] = *entry;
+   //start toggles off when they're remapped, and make sure analogs send
+   //their next value
+   toggled[input >> 3] &= ~(1 << (input & 0x7));
+   if (input >= INPUT_MAP_ENCODER(0) && input < INPUT_MAP_EXPANDER(0))
+      input_map_encoder_clear(input - INPUT_MAP_ENCODER(0));
+   else if (input >= INPUT_MAP_ANALOG(0) && input < INPUT_MAP_ENCODER(0))
+      analog_sent[input - INPUT_MAP_ANALOG(0)] = INPUT_MAP_UNSENT;
+   return true;
+}
+
+void input_map_reset(void) {
+   uint8_t i;
+   for (i = 0; i < INPUT_MAP_SIZE; i++)
+      input_map_default(i, &table[i]);
+   for (i = 0; i < sizeof(toggled); i++)
+      toggled[i] = 0;
+   for (i = 0; i < INPUT_MAP_NUM_ANALOG; i++)
+      analog_sent[i] = INPUT_MAP_UNSENT;
+   for (i = 0; i < INPUT_MAP_NUM_ENCODER; i++)
+      input_map_encoder_clear(i);
+}
+
+void input_map_save(void) {
+   input_map_header_t header;
+   header.magic = INPUT_MAP_MAGIC;
+   header.version = INPUT_MAP_VERSION;
+   header.count = INPUT_MAP_SIZE;
+   header.expanders = INPUT_MAP_EXPANDERS;
+   eeprom_update_block(table, ee_map.table, sizeof(table));
+   eeprom_update_block(&header, &ee_map.header, sizeof(input_map_header_t));
+}
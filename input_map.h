@@ -0,0 +1,127 @@
+//table mapping our physical inputs to the midi messages they send
+//
+//each input has an entry giving the message type, channel, number, the
+//values to send when it goes active and inactive, whether it is momentary or
+//toggles and which midi devices it sends to.  The table lives in ram, is
+//loaded from eeprom at boot [or set to defaults if eeprom doesn't hold a
+//table of our version] and can be edited and saved at runtime over sysex.
+//
+//all entry fields are 7 bit clean so an entry can be sent as is in sysex.
+//
+//the eeprom table is versioned, the entry layout is fixed for a given
+//INPUT_MAP_VERSION.  New kinds of input [analog, encoders] append entries to
+//the end of the table, a saved table that is shorter than ours loads what it
+//has and the rest get defaults.  The saved table also records how many
+//expanders it was saved with, so that a build with a different number loads
+//each section into the right inputs.
+
+#ifndef INPUT_MAP_H
+#define INPUT_MAP_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "avr-midi/midi.h"
+
+#define INPUT_MAP_VERSION 2
+
+//tiny48 expanders on the spi link, each has 8 analog inputs and 16 digital
+//ones [13 of them wired, see spilink/expander_report.h], so costs 24 table
+//entries [144 bytes of ram and of eeprom].  The analog and expander
+//sections of the table are sized by this.
+#ifndef INPUT_MAP_EXPANDERS
+#define INPUT_MAP_EXPANDERS 1
+#endif
+#define INPUT_MAP_ANALOG_PER_EXPANDER 8
+#define INPUT_MAP_DIGITAL_PER_EXPANDER 16
+
+//the inputs the table covers, in table order
+#define INPUT_MAP_NUM_DIGITAL 4
+#define INPUT_MAP_NUM_ANALOG (INPUT_MAP_ANALOG_PER_EXPANDER * INPUT_MAP_EXPANDERS)
+#define INPUT_MAP_NUM_ENCODER 2
+#define INPUT_MAP_NUM_EXPANDER (INPUT_MAP_DIGITAL_PER_EXPANDER * INPUT_MAP_EXPANDERS)
+#define INPUT_MAP_DIGITAL(n) (n)
+#define INPUT_MAP_ANALOG(n) (INPUT_MAP_NUM_DIGITAL + (n))
+#define INPUT_MAP_ENCODER(n) (INPUT_MAP_ANALOG(INPUT_MAP_NUM_ANALOG) + (n))
+#define INPUT_MAP_EXPANDER(n) (INPUT_MAP_ENCODER(INPUT_MAP_NUM_ENCODER) + (n))
+#define INPUT_MAP_SIZE (INPUT_MAP_EXPANDER(INPUT_MAP_NUM_EXPANDER))
+
+//analog values are 14 bit
+#define INPUT_MAP_VALUE_MAX 0x3FFF
+
+//how many midi devices an entry can send to
+#define INPUT_MAP_MAX_DESTS 2
+
+typedef enum {
+   INPUT_MAP_NONE = 0,
+   //analog inputs and encoders only support cc
+   //analog inputs ignore the on and off values, encoders use them as the
+   //top and bottom of their range
+   INPUT_MAP_CC = 1,
+   //active sends note on with the on value as velocity, inactive sends note
+   //off with the off value
+   INPUT_MAP_NOTE = 2,
+   //sends a program change with the on or off value as the program
+   INPUT_MAP_PROGCHANGE = 3
+} input_map_type_t;
+
+//flags
+//toggle: each activation flips between the on and off values, releasing
+//does nothing.  Otherwise the input is momentary.
+#define INPUT_MAP_TOGGLE 0x01
+//don't send anything for the on or off value
+#define INPUT_MAP_SKIP_ON 0x02
+#define INPUT_MAP_SKIP_OFF 0x04
+//analog cc with number n < 32 sends the 14 bit value as msb on n and lsb on
+//n + 32, otherwise we send 7 bits
+#define INPUT_MAP_14BIT 0x08
+//encoders send relative values, 64 plus the detents turned, otherwise they
+//send an absolute value that they keep between the off and on values
+#define INPUT_MAP_RELATIVE 0x40
+//destination mask, bit n sends to the device set with input_map_set_dest(n)
+#define INPUT_MAP_DEST_SHIFT 4
+#define INPUT_MAP_DEST(n) (1 << (INPUT_MAP_DEST_SHIFT + (n)))
+
+typedef struct {
+   uint8_t type;
+   uint8_t chan;
+   uint8_t num;
+   uint8_t on_val;
+   uint8_t off_val;
+   uint8_t flags;
+} input_map_entry_t;
+
+//load the table from eeprom, or defaults if eeprom doesn't have a valid one
+void input_map_init(void);
+//set the device for destination bit n
+void input_map_set_dest(uint8_t n, MidiDevice * device);
+//a destination whose output can back up [usb, when the host isn't reading]
+//can have a busy func.  While it returns true, encoder messages for that
+//destination are held, the detents pile up and go out as one message once
+//it isn't busy.  The other destinations get theirs as usual.
+typedef bool (* input_map_busy_func_t)(void);
+void input_map_set_dest_busy(uint8_t n, input_map_busy_func_t busy);
+
+//a digital input [on the board or the expander] changed, send whatever its
+//entry says
+void input_map_event(uint8_t input, bool active);
+//an analog input has a new 14 bit value, only sends if the value at the
+//resolution we send [7 or 14 bit] differs from what we last sent
+void input_map_value(uint8_t input, uint16_t value);
+//an encoder has turned, delta is all the detents since the last call and is
+//sent as a single message.  Call it even with no detents, that is when
+//messages held for a busy destination go out.
+void input_map_delta(uint8_t input, int16_t delta);
+
+//true if an encoder sends relative values on this channel and cc number,
+//each of its messages counts so they can't be merged
+bool input_map_relative_cc(uint8_t chan, uint8_t num);
+
+//access to the ram table, set returns false for a bad input or entry
+const input_map_entry_t * input_map_get(uint8_t input);
+bool input_map_set(uint8_t input, const input_map_entry_t * entry);
+//put the ram table back to the defaults
+void input_map_reset(void);
+//write the ram table to eeprom
+void input_map_save(void);
+
+#endif
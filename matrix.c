@@ -0,0 +1,171 @@
+//key matrix scanner with velocity from dual contact timing
+
+#include "matrix.h"
+#include "debounce.h"
+#include "avr-midi/ring.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#define MATRIX_EVENT_ON 0x80
+
+typedef struct {
+   //key, MATRIX_EVENT_ON set for note on
+   uint8_t key;
+   //scans between the first and second contact, note on only
+   uint8_t dt;
+   //scan the event was queued in
+   uint16_t time;
+} matrix_event_t;
+
+//velocity for the time between contacts, in 2 scan [2ms] steps, a log curve
+//from 127 at 2ms down to 1 past 120ms
+static const uint8_t velocity_curve[64] PROGMEM = {
+   127, 115, 99, 89, 81, 75, 70, 65, 62, 58, 55, 52, 50, 48, 45, 43,
+   41, 40, 38, 36, 35, 33, 32, 31, 29, 28, 27, 26, 25, 24, 23, 22,
+   21, 20, 19, 18, 17, 16, 16, 15, 14, 13, 13, 12, 11, 10, 10, 9,
+   8, 8, 7, 7, 6, 5, 5, 4, 4, 3, 3, 2, 2, 1, 1, 1
+};
+
+static MidiDevice * matrix_device;
+static uint8_t matrix_chan;
+static uint8_t matrix_base;
+
+//interrupt state
+static volatile debounce_port_t rows[MATRIX_ROWS];
+static uint8_t row;
+//scan each key's first contact closed in
+static uint16_t first_time[MATRIX_KEYS];
+//keys we have sent a note on for, a bit each
+static uint8_t sounding[MATRIX_KEYS / 8];
+
+//interrupt to main loop queue, the interrupt only pushes, the main loop
+//only pops
+RING_DEFINE(matrix_queue, matrix_event_t, uint8_t, MATRIX_QUEUE_EVENTS)
+static matrix_queue_t events;
+
+static volatile matrix_stats_t stats;
+
+static void matrix_queue_event(uint8_t key, uint8_t dt) {
+   matrix_event_t event;
+   uint8_t depth;
+   event.key = key;
+   event.dt = dt;
+   event.time = stats.scans;
+   if (!matrix_queue_push(&events, &event)) {
+      stats.dropped++;
+      return;
+   }
+
+   depth = matrix_queue_length(&events);
+   if (depth > stats.max_queued)
+      stats.max_queued = depth;
+}
+
+static void matrix_row_changed(uint8_t r, uint8_t changes, uint8_t state) {
+   uint8_t key = (r >> 1) * MATRIX_COLS;
+   uint8_t col;
+
+   for (col = 0; changes; col++, key++, changes >>= 1, state >>= 1) {
+      uint8_t mask = _BV(key & 0x7);
+      uint8_t * sound = &sounding[key >> 3];
+      if (!(changes & 0x1))
+         continue;
+
+      if (!(r & 0x1)) {
+         //first contact
+         if (state & 0x1) {
+            first_time[key] = stats.scans;
+         } else if (*sound & mask) {
+            //released
+            *sound &= ~mask;
+            matrix_queue_event(key, 0);
+         }
+      } else if ((state & 0x1) && !(*sound & mask) && (rows[r - 1].state & _BV(col))) {
+         //second contact closed with the first still closed, the key is down
+         uint16_t dt = stats.scans - first_time[key];
+         *sound |= mask;
+         matrix_queue_event(key | MATRIX_EVENT_ON, dt > 0xFF ? 0xFF : dt);
+      }
+   }
+}
+
+ISR(TIMER1_COMPB_vect) {
+   uint8_t changes;
+
+   //timer1 free runs for the scheduler, we just move our compare along
+   OCR1B += MATRIX_ROW_CYCLES;
+
+   //the selected row has had a whole period to settle, columns are active low
+   changes = debounce_update(&rows[row], ~MATRIX_COL_PIN);
+   if (changes)
+      matrix_row_changed(row, changes, rows[row].state);
+
+   if (++row >= MATRIX_ROWS) {
+      row = 0;
+      stats.scans++;
+   }
+   //only the selected row is an output [low], the rest float
+   MATRIX_ROW_DDR = _BV(row);
+}
+
+void matrix_init(MidiDevice * device, uint8_t chan, uint8_t base) {
+   uint8_t i;
+
+   matrix_device = device;
+   matrix_chan = chan;
+   matrix_base = base;
+
+   for (i = 0; i < MATRIX_ROWS; i++) {
+      rows[i].state = rows[i].cnt0 = rows[i].cnt1 = rows[i].changes = 0;
+   }
+   for (i = 0; i < sizeof(sounding); i++)
+      sounding[i] = 0;
+   matrix_queue_init(&events);
+   row = 0;
+   stats.scans = 0;
+   stats.dropped = 0;
+   stats.max_queued = 0;
+   stats.max_latency = 0;
+
+   //rows, no pullups, select the first
+   MATRIX_ROW_PORT = 0;
+   MATRIX_ROW_DDR = _BV(0);
+   //columns, inputs with pullups
+   MATRIX_COL_DDR = 0;
+   MATRIX_COL_PORT = 0xFF;
+
+   //start the row interrupt off timer1, which the scheduler has running
+   OCR1B = TCNT1 + MATRIX_ROW_CYCLES;
+   TIMSK1 |= _BV(OCIE1B);
+}
+
+void matrix_task(void) {
+   while (matrix_queue_length(&events)) {
+      matrix_event_t * event = matrix_queue_peek(&events, 0);
+      uint8_t note = (event->key & ~MATRIX_EVENT_ON) + matrix_base;
+      uint16_t latency, now;
+      uint8_t sreg = SREG;
+
+      cli();
+      now = stats.scans;
+      SREG = sreg;
+      latency = now - event->time;
+      if (latency > stats.max_latency)
+         stats.max_latency = latency;
+
+      if (event->key & MATRIX_EVENT_ON) {
+         uint8_t step = event->dt >> 1;
+         uint8_t vel = pgm_read_byte(&velocity_curve[step < 64 ? step : 63]);
+         midi_send_noteon(matrix_device, matrix_chan, note, vel);
+      } else {
+         midi_send_noteoff(matrix_device, matrix_chan, note, 64);
+      }
+
+      matrix_queue_pop(&events, NULL);
+   }
+}
+
+const matrix_stats_t * matrix_stats(void) {
+   return (const matrix_stats_t *)&stats;
+}
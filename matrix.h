@@ -0,0 +1,77 @@
+//key matrix scanner with velocity from dual contact timing
+//
+//each key has two contacts, the first closes early in the key's travel and
+//the second at the bottom.  The time between them gives the velocity.  Key
+//k [0 .. MATRIX_KEYS-1] has its first contact on row 2 * (k / 8) and its
+//second on row 2 * (k / 8) + 1, both on column k % 8.  The matrix needs a
+//diode per contact, then any number of keys can be down at once with no
+//ghosting.
+//
+//rows are driven low one at a time on MATRIX_ROW_PORT, the columns are read
+//with pullups on MATRIX_COL_PIN.  On the MIDI MONSTER board those pins are
+//the tiny48 link, encoder 0, the HD inputs and the uart [PD2/PD3], so the
+//matrix is only for controller builds, built with -DMATRIX_ENABLE.  Those
+//builds leave out the expander, the encoders, the HD inputs and serial midi,
+//with 8 rows and 8 columns there are no other pins to move them to.
+//
+//timing:
+//the timer1 compare b interrupt reads one row and selects the next every
+//MATRIX_ROW_CYCLES [125us at 16MHz], so every row is sampled at
+//MATRIX_SCAN_HZ [1kHz with 8 rows].  Each contact is debounced with the
+//vertical counter from debounce.c, 4 samples, so a contact is seen 4ms
+//after it settles.  Both contacts of a key are delayed by the same amount
+//so the velocity timing isn't affected.  Contact times have a resolution of
+//one scan, 1ms, and the velocity curve covers 2ms [127] to ~120ms [1].
+//
+//the interrupt only queues changes, note on with the contact time or note
+//off, MATRIX_QUEUE_EVENTS of them.  matrix_task turns them into
+//midi_send_noteon/midi_send_noteoff calls.  Scan-to-note latency is the
+//debounce time plus the time the event waits for matrix_task, the worst case
+//of which is kept in the stats along with the queue's high water mark and
+//any events lost to a full queue.
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <inttypes.h>
+#include "avr-midi/midi.h"
+
+#define MATRIX_ROW_PORT PORTB
+#define MATRIX_ROW_DDR DDRB
+#define MATRIX_COL_PIN PIND
+#define MATRIX_COL_PORT PORTD
+#define MATRIX_COL_DDR DDRD
+
+#define MATRIX_ROWS 8
+#define MATRIX_COLS 8
+#define MATRIX_KEYS ((MATRIX_ROWS / 2) * MATRIX_COLS)
+
+#define MATRIX_ROW_HZ 8000
+#define MATRIX_ROW_CYCLES (F_CPU / MATRIX_ROW_HZ)
+#define MATRIX_SCAN_HZ (MATRIX_ROW_HZ / MATRIX_ROWS)
+
+//events queued between the interrupt and matrix_task, a power of 2 no
+//larger than 128
+#define MATRIX_QUEUE_EVENTS 16
+
+typedef struct {
+   //full scans of the matrix, wraps
+   uint16_t scans;
+   //events dropped because the queue was full
+   uint16_t dropped;
+   //most events waiting at once
+   uint8_t max_queued;
+   //worst time from an event being queued to it being sent, in scans [ms]
+   uint16_t max_latency;
+} matrix_stats_t;
+
+//set up the pins and start scanning, notes are sent to the given device on
+//the given channel with key 0 as note base
+void matrix_init(MidiDevice * device, uint8_t chan, uint8_t base);
+
+//send the queued key changes, run this from the main loop
+void matrix_task(void);
+
+const matrix_stats_t * matrix_stats(void);
+
+#endif
@@ -0,0 +1,178 @@
+//a small static cooperative scheduler for the main loop
+
+#include "scheduler.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define SCHED_TIMER0_PRESCALE 64
+#define SCHED_TIMER0_TOP ((F_CPU / SCHED_TIMER0_PRESCALE / SCHED_TICK_HZ) - 1)
+
+//ticks after which a 16 bit cycle count has certainly wrapped
+#define SCHED_WRAP_TICKS (SCHED_CYCLES_MAX / (F_CPU / SCHED_TICK_HZ))
+
+static sched_task_t tasks[SCHED_MAX_TASKS];
+static uint8_t num_tasks;
+static volatile uint8_t ticks;
+static uint16_t loop_max_cycles;
+#if SCHED_HISTOGRAM
+static uint16_t loop_histogram[SCHED_HISTOGRAM_BUCKETS];
+#endif
+
+//timer1 free runs at F_CPU, read it atomically as interrupts may also use
+//the 16 bit temp register
+static uint16_t sched_cycles(void) {
+   uint16_t cycles;
+   uint8_t sreg = SREG;
+   cli();
+   cycles = TCNT1;
+   SREG = sreg;
+   return cycles;
+}
+
+static uint16_t sched_elapsed(uint16_t start_cycles, uint8_t start_tick) {
+   if ((uint8_t)(ticks - start_tick) > SCHED_WRAP_TICKS)
+      return SCHED_CYCLES_MAX;
+   return sched_cycles() - start_cycles;
+}
+
+void sched_init(void) {
+   num_tasks = 0;
+   ticks = 0;
+   sched_reset_stats();
+
+   //timer0, CTC, interrupt at SCHED_TICK_HZ
+   TCCR0A = _BV(WGM01);
+   TCCR0B = _BV(CS01) | _BV(CS00);
+   OCR0A = SCHED_TIMER0_TOP;
+   TIMSK0 |= _BV(OCIE0A);
+
+   //timer1, normal mode, no prescale, our cycle counter
+   TCCR1A = 0;
+   TCCR1B = _BV(CS10);
+}
+
+int8_t sched_add_task(sched_task_func_t func, uint8_t period, uint16_t budget) {
+   sched_task_t * task;
+   if (num_tasks >= SCHED_MAX_TASKS)
+      return -1;
+   task = &tasks[num_tasks];
+   task->func = func;
+   task->period = period;
+   task->last_due = ticks;
+   task->budget = budget;
+   task->runs = 0;
+   task->max_cycles = 0;
+   task->total_cycles = 0;
+   task->overruns = 0;
+   return num_tasks++;
+}
+
+void sched_tick(void) {
+   ticks++;
+}
+
+uint8_t sched_now(void) {
+   return ticks;
+}
+
+void sched_run(void) {
+   uint8_t i;
+   uint8_t loop_tick = ticks;
+   uint16_t loop_start = sched_cycles();
+
+   for (i = 0; i < num_tasks; i++) {
+      sched_task_t * task = &tasks[i];
+      uint8_t start_tick = ticks;
+      uint16_t start, cycles;
+
+      if (task->period) {
+         uint8_t late = start_tick - task->last_due;
+         if (late < task->period)
+            continue;
+         //keep a fixed rate, unless we've fallen so far behind that catching
+         //up would just burst the task
+         if (late >= 2 * task->period)
+            task->last_due = start_tick;
+         else
+            task->last_due += task->period;
+      }
+
+      start = sched_cycles();
+      task->func();
+      cycles = sched_elapsed(start, start_tick);
+
+      //halve the totals when the run count is about to wrap, this keeps the
+      //average meaningful without wider counters
+      if (task->runs == 0xFFFF) {
+         task->runs >>= 1;
+         task->total_cycles >>= 1;
+      }
+      task->runs++;
+      task->total_cycles += cycles;
+      if (cycles > task->max_cycles)
+         task->max_cycles = cycles;
+      if (task->budget && cycles > task->budget && task->overruns != 0xFFFF)
+         task->overruns++;
+   }
+
+   {
+      uint16_t cycles = sched_elapsed(loop_start, loop_tick);
+      if (cycles > loop_max_cycles)
+         loop_max_cycles = cycles;
+#if SCHED_HISTOGRAM
+      {
+         uint8_t bucket = 0;
+         //the bucket is the number of bits in the cycle count
+         while (cycles) {
+            bucket++;
+            cycles >>= 1;
+         }
+         if (loop_histogram[bucket] != 0xFFFF)
+            loop_histogram[bucket]++;
+      }
+#endif
+   }
+}
+
+uint8_t sched_num_tasks(void) {
+   return num_tasks;
+}
+
+const sched_task_t * sched_task(uint8_t index) {
+   if (index >= num_tasks)
+      return 0;
+   return &tasks[index];
+}
+
+uint16_t sched_task_avg_cycles(uint8_t index) {
+   if (index >= num_tasks || tasks[index].runs == 0)
+      return 0;
+   return tasks[index].total_cycles / tasks[index].runs;
+}
+
+uint16_t sched_loop_max_cycles(void) {
+   return loop_max_cycles;
+}
+
+#if SCHED_HISTOGRAM
+uint16_t sched_loop_histogram(uint8_t bucket) {
+   if (bucket >= SCHED_HISTOGRAM_BUCKETS)
+      return 0;
+   return loop_histogram[bucket];
+}
+#endif
+
+void sched_reset_stats(void) {
+   uint8_t i;
+   for (i = 0; i < num_tasks; i++) {
+      tasks[i].runs = 0;
+      tasks[i].max_cycles = 0;
+      tasks[i].total_cycles = 0;
+      tasks[i].overruns = 0;
+   }
+#if SCHED_HISTOGRAM
+   for (i = 0; i < SCHED_HISTOGRAM_BUCKETS; i++)
+      loop_histogram[i] = 0;
+#endif
+   loop_max_cycles = 0;
+}
@@ -0,0 +1,83 @@
+//a small static cooperative scheduler for the main loop
+//
+//tasks are registered once at startup with a period [in scheduler ticks, 1ms]
+//and a cycle budget.  sched_run does one pass over the table, running every
+//task that is due, and times each run with timer1 [clocked at F_CPU] so we
+//know the worst case and average cost of each task and of the loop as a
+//whole.
+//
+//tasks must not block, anything that takes a while should be split up and
+//given a budget [like the byte budget for midi processing].
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define SCHED_MAX_TASKS 9
+#define SCHED_TICK_HZ 1000
+
+//cycle counts are taken from a 16 bit timer, anything at or over this was
+//longer than we can measure [~4ms at 16MHz] and is clamped
+#define SCHED_CYCLES_MAX 0xFFFF
+
+//loop passes are also counted by length, bucket n of the histogram counts
+//passes of 2^(n-1) up to 2^n cycles [bucket 0 is passes under a cycle,
+//which can't happen].  A pass is how long input can wait before we look at
+//it, so this is the spread of the latency we add.  Set SCHED_HISTOGRAM to 0
+//to leave it out and save its ram.
+#ifndef SCHED_HISTOGRAM
+#define SCHED_HISTOGRAM 1
+#endif
+#define SCHED_HISTOGRAM_BUCKETS 17
+
+//convert a budget in microseconds to cycles
+#define SCHED_US(us) ((uint16_t)((F_CPU / 1000000UL) * (us)))
+
+typedef void (* sched_task_func_t)(void);
+
+typedef struct {
+   sched_task_func_t func;
+   //ticks between runs, 0 means run on every pass
+   uint8_t period;
+   //tick at which the task last became due
+   uint8_t last_due;
+   //cycles the task is expected to fit in, 0 for no budget
+   uint16_t budget;
+
+   //accounting
+   uint16_t runs;
+   uint16_t max_cycles;
+   uint32_t total_cycles;
+   //runs that went over budget
+   uint16_t overruns;
+} sched_task_t;
+
+//set up the tick and cycle timers and clear the task table
+void sched_init(void);
+
+//add a task, returns its index or -1 if the table is full
+int8_t sched_add_task(sched_task_func_t func, uint8_t period, uint16_t budget);
+
+//call this from the SCHED_TICK_HZ timer interrupt
+void sched_tick(void);
+//the current tick count, wraps
+uint8_t sched_now(void);
+
+//run one pass of the loop
+void sched_run(void);
+
+//accounting access
+uint8_t sched_num_tasks(void);
+const sched_task_t * sched_task(uint8_t index);
+uint16_t sched_task_avg_cycles(uint8_t index);
+//worst case cycles for a whole pass, this is our loop jitter
+uint16_t sched_loop_max_cycles(void);
+#if SCHED_HISTOGRAM
+//passes counted in a bucket [saturates]
+uint16_t sched_loop_histogram(uint8_t bucket);
+#endif
+void sched_reset_stats(void);
+
+#endif
@@ -0,0 +1,276 @@
+//the 32u2 end of the framed spi link to the tiny48 expanders
+
+#include "spi_link.h"
+#include "scheduler.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/delay.h>
+
+#define SPI_LINK_DDR DDRB
+#define SPI_LINK_SS PINB0
+#define SPI_LINK_SCK PINB1
+#define SPI_LINK_MOSI PINB2
+#define SPI_LINK_MISO PINB3
+
+#define SPI_LINK_IDLE 0
+#define SPI_LINK_BUSY 1
+#define SPI_LINK_DONE 2
+#define SPI_LINK_SUSPENDED 3
+
+//master, interrupt driven, fck/64
+#define SPI_LINK_SPCR (_BV(SPIE) | _BV(SPE) | _BV(MSTR) | _BV(SPR1))
+
+typedef struct {
+   volatile uint8_t * select_port;
+   uint8_t select_mask;
+
+   //a payload waiting for the next transaction
+   uint8_t pending[SPI_FRAME_MAX_PAYLOAD];
+   uint8_t pending_length;
+   bool pending_ready;
+
+   uint8_t tx_sequence;
+   uint8_t rx_sequence;
+   bool rx_synced;
+
+   //tick of the last poll
+   uint8_t last_poll;
+   spi_link_stats_t stats;
+} spi_link_slave_t;
+
+static spi_link_slave_t slaves[SPI_LINK_MAX_SLAVES];
+static uint8_t num_slaves;
+//the slave on the bus, or that was last
+static uint8_t current;
+
+static volatile uint8_t state;
+
+//the frame going out and what has come back, only the interrupt touches
+//these while we're busy
+static uint8_t tx_frame[SPI_FRAME_MAX];
+static uint8_t tx_length;
+static volatile uint8_t tx_index;
+static uint8_t rx_frame[SPI_FRAME_MAX];
+static volatile uint8_t rx_index;
+static volatile uint8_t rx_length;
+
+static spi_link_receive_func_t receive_func;
+
+ISR(SPI_STC_vect) {
+   uint8_t b = SPDR;
+
+   if (rx_index < SPI_FRAME_MAX)
+      rx_frame[rx_index++] = b;
+   //once we have the header we know how long the slave's frame is, with a
+   //bad header we just finish sending ours
+   if (rx_index == 2) {
+      rx_length = spi_frame_length(rx_frame);
+      if (rx_length == 0)
+         rx_length = 2;
+   }
+
+   if (tx_index < tx_length || rx_index < rx_length) {
+      _delay_us(SPI_LINK_BYTE_GAP_US);
+      SPDR = (tx_index < tx_length) ? tx_frame[tx_index++] : 0;
+   } else {
+      *slaves[current].select_port |= slaves[current].select_mask;
+      state = SPI_LINK_DONE;
+   }
+}
+
+void spi_link_init(void) {
+   state = SPI_LINK_IDLE;
+   num_slaves = 0;
+   current = 0;
+   receive_func = NULL;
+
+   //SS has to be an output or a low on it would drop us out of master mode
+   SPI_LINK_DDR |= _BV(SPI_LINK_SS) | _BV(SPI_LINK_SCK) | _BV(SPI_LINK_MOSI);
+   SPI_LINK_DDR &= ~_BV(SPI_LINK_MISO);
+
+   SPCR = SPI_LINK_SPCR;
+}
+
+int8_t spi_link_add_slave(volatile uint8_t * port, volatile uint8_t * ddr, uint8_t pin) {
+   spi_link_slave_t * slave;
+   if (num_slaves >= SPI_LINK_MAX_SLAVES)
+      return -1;
+   slave = &slaves[num_slaves];
+   memset(slave, 0, sizeof(spi_link_slave_t));
+   slave->select_port = port;
+   slave->select_mask = _BV(pin);
+   slave->stats.interval = SPI_LINK_POLL_MIN;
+   slave->last_poll = sched_now() - SPI_LINK_POLL_MAX;
+
+   //deselected
+   *port |= slave->select_mask;
+   *ddr |= slave->select_mask;
+   return num_slaves++;
+}
+
+uint8_t spi_link_num_slaves(void) {
+   return num_slaves;
+}
+
+void spi_link_set_receive(spi_link_receive_func_t func) {
+   receive_func = func;
+}
+
+bool spi_link_send(uint8_t index, const uint8_t * payload, uint8_t len) {
+   spi_link_slave_t * slave;
+   uint8_t i;
+   if (index >= num_slaves || len > SPI_FRAME_MAX_PAYLOAD)
+      return false;
+   slave = &slaves[index];
+   if (slave->pending_ready)
+      return false;
+   for (i = 0; i < len; i++)
+      slave->pending[i] = payload[i];
+   slave->pending_length = len;
+   slave->pending_ready = true;
+   return true;
+}
+
+//a bad frame, back off to the idle rate once the slave looks to be gone
+static void spi_link_failed(spi_link_slave_t * slave) {
+   if (slave->stats.failures < SPI_LINK_OFFLINE_ERRORS)
+      slave->stats.failures++;
+   if (slave->stats.failures >= SPI_LINK_OFFLINE_ERRORS)
+      slave->stats.interval = SPI_LINK_POLL_MAX;
+}
+
+static void spi_link_finish(void) {
+   spi_link_slave_t * slave = &slaves[current];
+   spi_link_stats_t * stats = &slave->stats;
+   uint8_t len;
+
+   stats->bytes += rx_index;
+   switch (spi_frame_check(rx_frame, rx_index)) {
+      case SPI_FRAME_OK:
+         break;
+      case SPI_FRAME_BAD_CRC:
+         stats->crc_errors++;
+         spi_link_failed(slave);
+         return;
+      default:
+         stats->sync_errors++;
+         spi_link_failed(slave);
+         return;
+   }
+
+   stats->frames++;
+   stats->failures = 0;
+   len = rx_frame[SPI_FRAME_LENGTH];
+   if (len == 0) {
+      if (stats->interval < SPI_LINK_POLL_MAX)
+         stats->interval++;
+      return;
+   }
+   stats->interval = SPI_LINK_POLL_MIN;
+
+   if (slave->rx_synced)
+      stats->lost += (uint8_t)(rx_frame[SPI_FRAME_SEQUENCE] - slave->rx_sequence - 1);
+   slave->rx_sequence = rx_frame[SPI_FRAME_SEQUENCE];
+   slave->rx_synced = true;
+
+   stats->payloads++;
+   stats->payload_bytes += len;
+   if (receive_func)
+      receive_func(current, rx_frame + SPI_FRAME_PAYLOAD, len);
+}
+
+//pick the next slave to poll, -1 if none is due
+static int8_t spi_link_next(uint8_t now) {
+   int8_t best = -1;
+   uint8_t i, index = current;
+
+   //start after the last one polled so equals take turns
+   for (i = 0; i < num_slaves; i++) {
+      spi_link_slave_t * slave;
+      if (++index >= num_slaves)
+         index = 0;
+      slave = &slaves[index];
+      if ((uint8_t)(now - slave->last_poll) < slave->stats.interval)
+         continue;
+      if (best < 0 || slave->stats.interval < slaves[best].stats.interval)
+         best = index;
+   }
+   return best;
+}
+
+static void spi_link_start(uint8_t index, uint8_t now) {
+   spi_link_slave_t * slave = &slaves[index];
+   uint8_t gap = now - slave->last_poll;
+
+   if (slave->stats.transactions && gap > slave->stats.max_gap)
+      slave->stats.max_gap = gap;
+   slave->last_poll = now;
+
+   if (slave->pending_ready) {
+      tx_length = spi_frame_build(tx_frame, ++slave->tx_sequence,
+            slave->pending, slave->pending_length);
+      slave->pending_ready = false;
+      slave->stats.sent++;
+   } else
+      tx_length = spi_frame_build(tx_frame, slave->tx_sequence, NULL, 0);
+
+   current = index;
+   tx_index = 0;
+   rx_index = 0;
+   //clock at least the header whatever we're sending
+   rx_length = 2;
+   state = SPI_LINK_BUSY;
+   slave->stats.transactions++;
+
+   *slave->select_port &= ~slave->select_mask;
+   _delay_us(SPI_LINK_SELECT_US);
+   SPDR = tx_frame[tx_index++];
+}
+
+void spi_link_service(void) {
+   uint8_t now;
+   int8_t next;
+
+   if (state == SPI_LINK_BUSY || state == SPI_LINK_SUSPENDED)
+      return;
+   if (state == SPI_LINK_DONE) {
+      state = SPI_LINK_IDLE;
+      spi_link_finish();
+   }
+
+   now = sched_now();
+   next = spi_link_next(now);
+   if (next >= 0)
+      spi_link_start(next, now);
+}
+
+bool spi_link_suspend(void) {
+   if (state == SPI_LINK_BUSY)
+      return false;
+   if (state == SPI_LINK_DONE)
+      spi_link_finish();
+   state = SPI_LINK_SUSPENDED;
+   SPCR &= ~_BV(SPIE);
+   return true;
+}
+
+void spi_link_resume(void) {
+   if (state != SPI_LINK_SUSPENDED)
+      return;
+   SPCR = SPI_LINK_SPCR;
+   state = SPI_LINK_IDLE;
+}
+
+bool spi_link_busy(void) {
+   return state == SPI_LINK_BUSY;
+}
+
+bool spi_link_online(uint8_t slave) {
+   return slaves[slave].stats.failures < SPI_LINK_OFFLINE_ERRORS;
+}
+
+const spi_link_stats_t * spi_link_stats(uint8_t slave) {
+   return &slaves[slave].stats;
+}
@@ -0,0 +1,108 @@
+//the 32u2 end of the framed spi link to the tiny48 expanders
+//
+//the 32u2 is the spi master of a bus of up to SPI_LINK_MAX_SLAVES slaves,
+//each with its own select line.  A transaction selects one slave and swaps
+//one frame each way [see spilink/spi_frame.h], the rest is clocked byte by
+//byte from the spi interrupt, so nothing waits on the bus.  The master clocks
+//until it has sent its whole frame and received the whole of the slave's,
+//then deselects it.  The next spi_link_service checks the received frame and
+//hands its payload to the receive function.
+//
+//polling:
+//spi_link_service runs on every pass of the main loop and starts a
+//transaction whenever the bus is free and a slave is due.  Each slave has its
+//own poll interval: a poll that brings a payload sets it to SPI_LINK_POLL_MIN
+//ticks, every empty poll lengthens it by a tick up to SPI_LINK_POLL_MAX.  Of
+//the slaves that are due the one polled most often goes first, round robin
+//between equals.  An idle slave costs an empty poll [a few bytes] every
+//SPI_LINK_POLL_MAX ticks, so adding expanders doesn't slow down the ones
+//with controls being moved.
+//
+//there are no retries, a frame that fails its crc is counted and dropped.
+//The payload sequence numbers show frames lost that way.  A slave that gives
+//SPI_LINK_OFFLINE_ERRORS bad frames in a row is offline, and is polled at
+//the idle rate until it answers again.
+
+#ifndef SPI_LINK_H
+#define SPI_LINK_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "spilink/spi_frame.h"
+
+//a slot per expander, each one is 50 bytes of ram
+#ifndef SPI_LINK_MAX_SLAVES
+#include "input_map.h"
+#define SPI_LINK_MAX_SLAVES INPUT_MAP_EXPANDERS
+#endif
+
+//poll intervals, in scheduler ticks [ms]
+#define SPI_LINK_POLL_MIN 1
+#define SPI_LINK_POLL_MAX 4
+
+#define SPI_LINK_OFFLINE_ERRORS 8
+
+//gap between bytes, the tiny48 has to get into its interrupt and load the
+//next byte before we clock it
+#define SPI_LINK_BYTE_GAP_US 4
+//gap between select and the first byte, long enough for the tiny48 to swap
+//in a payload it queued since the last poll
+#define SPI_LINK_SELECT_US 10
+
+typedef void (* spi_link_receive_func_t)(uint8_t slave, const uint8_t * payload, uint8_t len);
+
+typedef struct {
+   //transactions started
+   uint16_t transactions;
+   //total bytes clocked each way
+   uint32_t bytes;
+   //good frames from the slave, and how many of them had a payload
+   uint16_t frames;
+   uint16_t payloads;
+   uint32_t payload_bytes;
+   //frames we sent with a payload
+   uint16_t sent;
+   //bad frames from the slave
+   uint16_t sync_errors;
+   uint16_t crc_errors;
+   //payload frames missing going by the sequence numbers
+   uint16_t lost;
+   //bad frames in a row, the slave is offline at SPI_LINK_OFFLINE_ERRORS
+   uint8_t failures;
+   //current and worst ticks between polls, the worst case latency of the
+   //slave's inputs
+   uint8_t interval;
+   uint8_t max_gap;
+} spi_link_stats_t;
+
+//set up the spi pins and the peripheral as master
+void spi_link_init(void);
+
+//add a slave with its select line on bit pin of port [ddr is the port's
+//direction register], returns its index or -1 if the table is full
+int8_t spi_link_add_slave(volatile uint8_t * port, volatile uint8_t * ddr, uint8_t pin);
+uint8_t spi_link_num_slaves(void);
+
+void spi_link_set_receive(spi_link_receive_func_t func);
+
+//queue a payload for the next transaction with a slave, returns false if
+//one is already waiting
+bool spi_link_send(uint8_t slave, const uint8_t * payload, uint8_t len);
+
+//process a finished transaction and start the next if a slave is due, run it
+//on every pass of the main loop
+void spi_link_service(void);
+
+//true while a transaction is on the bus
+bool spi_link_busy(void);
+
+//give the spi peripheral to someone else [the tiny48 programmer], returns
+//false if a transaction is on the bus, try again later.  Nothing is polled
+//until spi_link_resume
+bool spi_link_suspend(void);
+void spi_link_resume(void);
+
+bool spi_link_online(uint8_t slave);
+const spi_link_stats_t * spi_link_stats(uint8_t slave);
+
+#endif
@@ -0,0 +1,41 @@
+//what the tiny48 input expander reports to the 32u2 over the spi link
+//
+//the tiny48 scans and debounces its digital pins and filters its analog
+//inputs itself, and only tells the 32u2 what has changed.  A report is the
+//payload of one spi frame, a list of changes each starting with a tag byte:
+//
+//EXPANDER_DIGITAL | port, state
+//   the debounced state of a port of 8 digital inputs, 1 bits are active
+//EXPANDER_ANALOG | channel, msb, lsb
+//   the 14 bit filtered value of an analog input, 7 bits per byte
+//
+//all bytes after the tag are 7 bit clean apart from the digital state.
+//Changes that don't fit in one frame go in the next.  With nothing changed
+//the tiny48 sends an empty frame.
+//
+//the 32u2 sends EXPANDER_CMD_RESYNC when it might have missed a report, the
+//tiny48 then reports every input again.
+
+#ifndef EXPANDER_REPORT_H
+#define EXPANDER_REPORT_H
+
+#define EXPANDER_TAG_MASK 0xF0
+#define EXPANDER_INDEX_MASK 0x0F
+
+#define EXPANDER_DIGITAL 0x10
+#define EXPANDER_ANALOG 0x20
+
+#define EXPANDER_DIGITAL_LENGTH 2
+#define EXPANDER_ANALOG_LENGTH 3
+
+//inputs are numbered port * 8 + bit, so the count includes bits a port
+//doesn't have pins for: the tiny48 has 13 digital inputs [port 1 bits 5-7
+//are always 0] and 8 analog ones
+#define EXPANDER_DIGITAL_PORTS 2
+#define EXPANDER_DIGITAL_INS (EXPANDER_DIGITAL_PORTS * 8)
+#define EXPANDER_ANALOG_INS 8
+
+//commands from the 32u2
+#define EXPANDER_CMD_RESYNC 0x01
+
+#endif
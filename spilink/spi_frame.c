@@ -0,0 +1,62 @@
+//framing for the spi link between the 32u2 and the tiny48
+
+#include "spi_frame.h"
+
+uint8_t spi_frame_crc8(uint8_t crc, uint8_t b) {
+   uint8_t i;
+   crc ^= b;
+   for (i = 0; i < 8; i++) {
+      if (crc & 0x80)
+         crc = (crc << 1) ^ 0x07;
+      else
+         crc <<= 1;
+   }
+   return crc;
+}
+
+uint8_t spi_frame_build(uint8_t * frame, uint8_t sequence, const uint8_t * payload, uint8_t len) {
+   uint8_t i, crc;
+   if (len > SPI_FRAME_MAX_PAYLOAD)
+      len = SPI_FRAME_MAX_PAYLOAD;
+
+   frame[0] = SPI_FRAME_SYNC;
+   frame[SPI_FRAME_LENGTH] = len;
+   if (len == 0)
+      return SPI_FRAME_EMPTY;
+
+   frame[SPI_FRAME_SEQUENCE] = sequence;
+   crc = spi_frame_crc8(0, len);
+   crc = spi_frame_crc8(crc, sequence);
+   for (i = 0; i < len; i++) {
+      frame[SPI_FRAME_PAYLOAD + i] = payload[i];
+      crc = spi_frame_crc8(crc, payload[i]);
+   }
+   frame[SPI_FRAME_PAYLOAD + len] = crc;
+   return len + SPI_FRAME_OVERHEAD;
+}
+
+uint8_t spi_frame_length(const uint8_t * frame) {
+   if (frame[0] != SPI_FRAME_SYNC || frame[SPI_FRAME_LENGTH] > SPI_FRAME_MAX_PAYLOAD)
+      return 0;
+   if (frame[SPI_FRAME_LENGTH] == 0)
+      return SPI_FRAME_EMPTY;
+   return frame[SPI_FRAME_LENGTH] + SPI_FRAME_OVERHEAD;
+}
+
+uint8_t spi_frame_check(const uint8_t * frame, uint8_t received) {
+   uint8_t len, i, crc;
+   if (received < 2)
+      return SPI_FRAME_SHORT;
+   len = spi_frame_length(frame);
+   if (len == 0)
+      return SPI_FRAME_BAD_SYNC;
+   if (received < len)
+      return SPI_FRAME_SHORT;
+   if (len == SPI_FRAME_EMPTY)
+      return SPI_FRAME_OK;
+
+   crc = 0;
+   for (i = SPI_FRAME_LENGTH; i < len - 1; i++)
+      crc = spi_frame_crc8(crc, frame[i]);
+   return (crc == frame[len - 1]) ? SPI_FRAME_OK : SPI_FRAME_BAD_CRC;
+}
@@ -0,0 +1,57 @@
+//framing for the spi link between the 32u2 and the tiny48
+//
+//every transaction on the link carries one frame in each direction:
+//
+//SPI_FRAME_SYNC length sequence payload[length] crc
+//
+//length is the number of payload bytes, sequence counts the frames with a
+//payload that a side has sent and crc is a crc-8 [polynomial 0x07] over
+//length, sequence and the payload.
+//
+//a frame with no payload is just SPI_FRAME_SYNC 0, so a poll when neither
+//side has anything to say is SPI_FRAME_EMPTY bytes each way.  It has no crc,
+//a payload frame whose length is hit down to 0 passes as empty, but the gap
+//it leaves in the sequence numbers shows it was lost.
+//
+//this file is shared by both ends and by the host side simulation, so it
+//must stay free of anything avr specific.
+
+#ifndef SPI_FRAME_H
+#define SPI_FRAME_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define SPI_FRAME_SYNC 0xA5
+#define SPI_FRAME_MAX_PAYLOAD 16
+#define SPI_FRAME_OVERHEAD 4
+#define SPI_FRAME_MAX (SPI_FRAME_MAX_PAYLOAD + SPI_FRAME_OVERHEAD)
+#define SPI_FRAME_EMPTY 2
+
+//byte positions
+#define SPI_FRAME_LENGTH 1
+#define SPI_FRAME_SEQUENCE 2
+#define SPI_FRAME_PAYLOAD 3
+
+//spi_frame_check results
+#define SPI_FRAME_OK 0
+//no sync byte or a length over SPI_FRAME_MAX_PAYLOAD
+#define SPI_FRAME_BAD_SYNC 1
+//fewer bytes than the header says
+#define SPI_FRAME_SHORT 2
+#define SPI_FRAME_BAD_CRC 3
+
+uint8_t spi_frame_crc8(uint8_t crc, uint8_t b);
+
+//write a frame into frame [which must hold SPI_FRAME_MAX bytes], returns
+//its total length, payload may be NULL if len is 0 [sequence is then unused]
+uint8_t spi_frame_build(uint8_t * frame, uint8_t sequence, const uint8_t * payload, uint8_t len);
+
+//the total length of a frame going by its header, only valid once the first
+//two bytes are in, 0 if the header is bad
+uint8_t spi_frame_length(const uint8_t * frame);
+
+//check a frame of received bytes
+uint8_t spi_frame_check(const uint8_t * frame, uint8_t received);
+
+#endif
@@ -0,0 +1,136 @@
+//receiving our vendor specific sysex messages
+
+#include "sysex.h"
+#include "avr-midi/midi.h"
+
+//usb midi code index numbers that carry sysex
+#define CIN_SYSEX_STARTS_CONTS 0x4
+#define CIN_SYSEX_ENDS_IN_1 0x5
+#define CIN_SYSEX_ENDS_IN_2 0x6
+#define CIN_SYSEX_ENDS_IN_3 0x7
+
+static sysex_handler_t sysex_handler;
+static sysex_output_t sysex_output;
+static uint8_t buffer[SYSEX_BUFFER_LENGTH];
+static uint8_t length;
+static bool receiving;
+static bool overflow;
+
+void sysex_init(sysex_handler_t handler) {
+   sysex_handler = handler;
+   receiving = false;
+}
+
+void sysex_set_output(sysex_output_t output) {
+   sysex_output = output;
+}
+
+void sysex_input_byte(uint8_t b) {
+   if (b == SYSEX_BEGIN) {
+      length = 0;
+      overflow = false;
+      receiving = true;
+   } else if (!receiving || midi_is_realtime(b)) {
+      //realtime messages may show up in the middle of sysex, ignore them
+      return;
+   } else if (b == SYSEX_END) {
+      receiving = false;
+      //buffer[0] is the manufacturer id, buffer[1] the command
+      if (!overflow && length >= 2 && buffer[0] == SYSEX_EDUMANUFID && sysex_handler)
+         sysex_handler(buffer[1], buffer + 2, length - 2);
+   } else if (midi_is_statusbyte(b)) {
+      //any other status byte aborts the message
+      receiving = false;
+   } else if (length < SYSEX_BUFFER_LENGTH) {
+      buffer[length++] = b;
+   } else {
+      overflow = true;
+   }
+}
+
+void sysex_usb_input(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2) {
+   switch (cin) {
+      case CIN_SYSEX_STARTS_CONTS:
+      case CIN_SYSEX_ENDS_IN_3:
+         sysex_input_byte(byte0);
+         sysex_input_byte(byte1);
+         sysex_input_byte(byte2);
+         break;
+      case CIN_SYSEX_ENDS_IN_2:
+         sysex_input_byte(byte0);
+         sysex_input_byte(byte1);
+         break;
+      case CIN_SYSEX_ENDS_IN_1:
+         //this cin is shared with single byte system common messages
+         if (byte0 == SYSEX_END)
+            sysex_input_byte(byte0);
+         break;
+      default:
+         break;
+   }
+}
+
+void sysex_reply(uint8_t command, const uint8_t * data, uint8_t length) {
+   //the whole message is the header, the data and the end byte
+   uint8_t total = length + 4;
+   uint8_t group[3];
+   uint8_t i, n = 0;
+
+   if (!sysex_output)
+      return;
+
+   for (i = 0; i < total; i++) {
+      if (i == 0)
+         group[n++] = SYSEX_BEGIN;
+      else if (i == 1)
+         group[n++] = SYSEX_EDUMANUFID;
+      else if (i == 2)
+         group[n++] = command;
+      else if (i == total - 1)
+         group[n++] = SYSEX_END;
+      else
+         group[n++] = data[i - 3];
+
+      if (i == total - 1) {
+         //the last packet says how many of its bytes are used
+         while (n < 3)
+            group[n++] = 0;
+         sysex_output(CIN_SYSEX_ENDS_IN_1 + ((total - 1) % 3),
+               group[0], group[1], group[2]);
+      } else if (n == 3) {
+         sysex_output(CIN_SYSEX_STARTS_CONTS, group[0], group[1], group[2]);
+         n = 0;
+      }
+   }
+}
+
+uint8_t sysex_pack(const uint8_t * in, uint8_t length, uint8_t * out) {
+   uint8_t i, packed = 0;
+   uint8_t msbs = 0;
+
+   for (i = 0; i < length; i++) {
+      uint8_t bit = i % 7;
+      if (bit == 0) {
+         msbs = packed++;
+         out[msbs] = 0;
+      }
+      if (in[i] & 0x80)
+         out[msbs] |= 1 << bit;
+      out[packed++] = in[i] & 0x7F;
+   }
+   return packed;
+}
+
+uint8_t sysex_unpack(const uint8_t * in, uint8_t length, uint8_t * out) {
+   uint8_t i, unpacked = 0;
+   uint8_t msbs = 0;
+
+   for (i = 0; i < length; i++) {
+      uint8_t pos = i % 8;
+      if (pos == 0)
+         msbs = in[i];
+      else
+         out[unpacked++] = in[i] | ((msbs & (1 << (pos - 1))) ? 0x80 : 0);
+   }
+   return unpacked;
+}
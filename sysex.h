@@ -0,0 +1,78 @@
+//receiving our vendor specific sysex messages
+//
+//our messages look like:
+//SYSEX_BEGIN SYSEX_EDUMANUFID command data... SYSEX_END
+//
+//bytes are fed in as they arrive, once a whole message for us has been
+//collected the handler is called with the command and the data that followed
+//it.  Other manufacturers' messages, and ones too long for our buffer, are
+//ignored.
+//
+//replies go out the same way, as usb midi event packets handed to the output
+//function.  Binary data is 7 bit packed: each group of up to 7 bytes is sent
+//as a byte holding their top bits [bit n for byte n] followed by the bytes
+//with their top bits cleared.
+
+#ifndef SYSEX_H
+#define SYSEX_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+//most data bytes we collect for a single message
+#ifndef SYSEX_BUFFER_LENGTH
+#define SYSEX_BUFFER_LENGTH 32
+#endif
+
+//commands
+//data: input, then the 6 bytes of an input_map_entry_t
+#define SYSEX_CMD_MAP_SET 0x10
+//write the mapping table to eeprom
+#define SYSEX_CMD_MAP_SAVE 0x11
+//put the mapping table back to defaults [doesn't save]
+#define SYSEX_CMD_MAP_RESET 0x12
+//reprogramming the tiny48, see tiny_isp.h
+#define SYSEX_CMD_TINY_BEGIN 0x20
+#define SYSEX_CMD_TINY_DATA 0x21
+#define SYSEX_CMD_TINY_END 0x22
+#define SYSEX_CMD_TINY_ABORT 0x23
+#define SYSEX_CMD_TINY_STATUS 0x2F
+//updating our own firmware, see bootloader/bootloader.h
+#define SYSEX_CMD_BOOT_ENTER 0x30
+#define SYSEX_CMD_BOOT_BEGIN 0x31
+#define SYSEX_CMD_BOOT_BLOCK 0x32
+#define SYSEX_CMD_BOOT_END 0x33
+#define SYSEX_CMD_BOOT_STATUS 0x3F
+//runtime control and telemetry, see control.h
+#define SYSEX_CMD_CTL_STATS 0x40
+#define SYSEX_CMD_CTL_MAP_READ 0x41
+#define SYSEX_CMD_CTL_MAP_WRITE 0x42
+#define SYSEX_CMD_CTL_HISTOGRAM 0x43
+#define SYSEX_CMD_CTL_PANIC 0x44
+#define SYSEX_CMD_CTL_REPLY 0x4F
+
+//packed length of n bytes of binary data
+#define SYSEX_PACKED_LENGTH(n) ((n) + ((n) + 6) / 7)
+
+typedef void (* sysex_handler_t)(uint8_t command, const uint8_t * data, uint8_t length);
+typedef void (* sysex_output_t)(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+
+void sysex_init(sysex_handler_t handler);
+void sysex_set_output(sysex_output_t output);
+
+//feed a single byte of input
+void sysex_input_byte(uint8_t b);
+
+//feed a usb midi event packet, cin is the packet's code index number, only
+//sysex packets are looked at
+void sysex_usb_input(uint8_t cin, uint8_t byte0, uint8_t byte1, uint8_t byte2);
+
+//send one of our messages with the given command and [7 bit] data
+void sysex_reply(uint8_t command, const uint8_t * data, uint8_t length);
+
+//7 bit pack length bytes of in to out, returns the packed length
+uint8_t sysex_pack(const uint8_t * in, uint8_t length, uint8_t * out);
+//unpack length packed bytes of in to out, returns the unpacked length
+uint8_t sysex_unpack(const uint8_t * in, uint8_t length, uint8_t * out);
+
+#endif
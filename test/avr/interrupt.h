@@ -0,0 +1,10 @@
+#ifndef FAKE_AVR_INTERRUPT_H
+#define FAKE_AVR_INTERRUPT_H
+
+//interrupt handlers become plain functions the simulation calls
+
+#define ISR(vector) void vector(void)
+#define cli()
+#define sei()
+
+#endif
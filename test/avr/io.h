@@ -0,0 +1,42 @@
+#ifndef FAKE_AVR_IO_H
+#define FAKE_AVR_IO_H
+
+//just enough of the avr registers for the spi link to build on the host, the
+//makefile renames them per end so the master and slave get their own
+
+#include <inttypes.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t SREG;
+
+extern volatile uint8_t SPDR;
+extern volatile uint8_t SPCR;
+extern volatile uint8_t DDRB;
+extern volatile uint8_t PORTB;
+extern volatile uint8_t PINB;
+extern volatile uint8_t PCMSK0;
+extern volatile uint8_t PCICR;
+
+#define SPR0 0
+#define SPR1 1
+#define CPHA 2
+#define CPOL 3
+#define MSTR 4
+#define DORD 5
+#define SPE 6
+#define SPIE 7
+
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+
+#define PCINT2 2
+#define PCIE0 0
+
+#endif
@@ -0,0 +1,327 @@
+//host side simulation of both ends of the spi link
+//
+//the master [../spi_link.c] and slave [../tiny48/spi_link_slave.c] are
+//built with their registers renamed, this file plays the wires between them:
+//it swaps the two SPDRs for every byte, runs the slave's spi interrupt then
+//the master's, and turns the master's TINY_SS output into the slave's SS pin
+//change interrupt.  A second select line, MISSING_SS, has no slave on it and
+//reads 0xFF.  Bytes can be corrupted on the way to check the error counters.
+//
+//the master runs off scheduler ticks, here a tick is as many passes of
+//spi_link_service as it takes to poll every slave that is due.
+
+#include "spi_link.h"
+#include "tiny48/spi_link_slave.h"
+#include <avr/io.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define TINY_SS PINB4
+#define MISSING_SS PINB6
+#define SLAVE_SS PINB2
+
+volatile uint8_t SREG;
+volatile uint8_t master_SPDR, master_SPCR, master_DDRB, master_PORTB;
+volatile uint8_t master_PINB, master_PCMSK0, master_PCICR;
+volatile uint8_t slave_SPDR, slave_SPCR, slave_DDRB, slave_PORTB;
+volatile uint8_t slave_PINB, slave_PCMSK0, slave_PCICR;
+
+static uint8_t tick;
+
+uint8_t sched_now(void) {
+   return tick;
+}
+
+void master_spi_isr(void);
+void slave_spi_isr(void);
+void slave_pcint_isr(void);
+
+//flip a bit in one of every noise_rate transactions, 0 for a clean line
+static unsigned int noise_rate;
+static unsigned int corrupted;
+
+//what the master got from the slave
+static uint8_t master_got_first;
+static uint8_t master_got_last;
+static unsigned int master_got;
+//payloads missing going by their ids
+static unsigned int master_gaps;
+
+static bool master_selected(void) {
+   return !(master_PORTB & _BV(TINY_SS));
+}
+
+static void set_slave_ss(bool high) {
+   if (high)
+      slave_PINB |= _BV(SLAVE_SS);
+   else
+      slave_PINB &= ~_BV(SLAVE_SS);
+   slave_pcint_isr();
+}
+
+//a payload of len bytes tagged with id
+static void make_payload(uint8_t * payload, uint8_t id, uint8_t len) {
+   uint8_t i;
+   payload[0] = id;
+   for (i = 1; i < len; i++)
+      payload[i] = id ^ (i * 37);
+}
+
+static void check_payload(const uint8_t * payload, uint8_t len) {
+   uint8_t expected[SPI_FRAME_MAX_PAYLOAD];
+   assert(len > 0 && len <= SPI_FRAME_MAX_PAYLOAD);
+   make_payload(expected, payload[0], len);
+   assert(memcmp(expected, payload, len) == 0);
+}
+
+static void master_receive(uint8_t slave, const uint8_t * payload, uint8_t len) {
+   assert(slave == 0);
+   check_payload(payload, len);
+   //frames can be lost but never repeated
+   if (master_got == 0)
+      master_got_first = payload[0];
+   else {
+      assert(payload[0] != master_got_last);
+      master_gaps += (uint8_t)(payload[0] - master_got_last - 1);
+   }
+   master_got_last = payload[0];
+   master_got++;
+}
+
+//run the transaction spi_link_service started, returns the bytes clocked
+static unsigned int run_transaction(void) {
+   unsigned int bytes = 0;
+   int bad = -1;
+
+   //nobody home, the master reads the pulled up MISO
+   if (!(master_PORTB & _BV(MISSING_SS))) {
+      while (!(master_PORTB & _BV(MISSING_SS))) {
+         master_SPDR = 0xFF;
+         master_spi_isr();
+         bytes++;
+         assert(bytes <= SPI_FRAME_MAX * 2);
+      }
+      return bytes;
+   }
+
+   if (!master_selected())
+      return 0;
+
+   if (noise_rate && (rand() % noise_rate) == 0)
+      bad = rand() % SPI_FRAME_MAX;
+
+   set_slave_ss(false);
+   while (master_selected()) {
+      uint8_t mosi = master_SPDR;
+      uint8_t miso = slave_SPDR;
+      if ((int)bytes == bad) {
+         if (rand() & 1)
+            mosi ^= _BV(rand() % 8);
+         else
+            miso ^= _BV(rand() % 8);
+         corrupted++;
+      }
+      slave_SPDR = mosi;
+      master_SPDR = miso;
+      //the slave gets its next byte in before the master clocks it
+      slave_spi_isr();
+      master_spi_isr();
+      bytes++;
+      assert(bytes <= SPI_FRAME_MAX * 2);
+   }
+   set_slave_ss(true);
+   return bytes;
+}
+
+//one scheduler tick, poll every slave that is due, returns the transactions
+static unsigned int run_tick(void) {
+   unsigned int transactions = 0;
+   for (;;) {
+      spi_link_service();
+      if (!run_transaction())
+         break;
+      transactions++;
+      assert(transactions <= SPI_LINK_MAX_SLAVES);
+   }
+   tick++;
+   return transactions;
+}
+
+static void init(void) {
+   master_PORTB = _BV(MISSING_SS);
+   slave_PINB = _BV(SLAVE_SS);
+   spi_link_init();
+   assert(spi_link_add_slave(&master_PORTB, &master_DDRB, TINY_SS) == 0);
+   spi_link_set_receive(master_receive);
+   spi_slave_init();
+   master_got = 0;
+   master_gaps = 0;
+   corrupted = 0;
+}
+
+static void test_idle(void) {
+   unsigned int i, polls = 0;
+   uint8_t command[SPI_FRAME_MAX_PAYLOAD];
+   const spi_link_stats_t * stats;
+
+   init();
+   stats = spi_link_stats(0);
+   for (i = 0; i < 40; i++) {
+      unsigned int before = stats->bytes;
+      polls += run_tick();
+      //an idle poll is an empty frame each way
+      assert(stats->bytes == before || stats->bytes - before == SPI_FRAME_EMPTY);
+   }
+   //an idle slave backs off to the slowest poll rate
+   assert(stats->interval == SPI_LINK_POLL_MAX);
+   assert(stats->max_gap == SPI_LINK_POLL_MAX);
+   assert(polls < 40 / SPI_LINK_POLL_MAX + SPI_LINK_POLL_MAX);
+   assert(stats->frames == polls);
+   assert(stats->payloads == 0);
+   assert(spi_slave_receive(command) == 0);
+}
+
+static void test_clean(void) {
+   unsigned int i, slave_sent = 0;
+   uint8_t slave_id = 0, master_id = 0, command_id = 0;
+   uint8_t payload[SPI_FRAME_MAX_PAYLOAD];
+   const spi_link_stats_t * stats;
+   spi_slave_stats_t slave;
+
+   init();
+   stats = spi_link_stats(0);
+   for (i = 0; i < 1000; i++) {
+      uint8_t len;
+      //the slave has something to say most ticks, the master now and then
+      if ((i % 5) && spi_slave_can_send()) {
+         len = 1 + (++slave_id % SPI_FRAME_MAX_PAYLOAD);
+         make_payload(payload, slave_id, len);
+         assert(spi_slave_send(payload, len));
+         assert(!spi_slave_can_send());
+         slave_sent++;
+      }
+      if (i % 7 == 0) {
+         make_payload(payload, ++master_id, 3);
+         assert(spi_link_send(0, payload, 3));
+      }
+      run_tick();
+
+      len = spi_slave_receive(payload);
+      if (len) {
+         check_payload(payload, len);
+         assert(payload[0] == ++command_id);
+      }
+   }
+   //a busy slave is polled every tick or two
+   assert(stats->max_gap <= SPI_LINK_POLL_MIN + 1);
+
+   //a few more to get the last payloads out
+   for (i = 0; i < SPI_LINK_POLL_MAX * 2; i++)
+      run_tick();
+   spi_slave_stats(&slave);
+
+   assert(master_got == slave_sent);
+   assert(master_got_first == 1 && master_got_last == slave_id);
+   assert(master_gaps == 0);
+   assert(command_id == master_id);
+   assert(stats->crc_errors == 0);
+   assert(stats->sync_errors == 0);
+   assert(stats->lost == 0);
+   assert(stats->frames == stats->transactions);
+   assert(slave.frames == stats->transactions);
+   assert(slave.crc_errors == 0 && slave.sync_errors == 0 && slave.lost == 0);
+   assert(slave.sent == slave_sent);
+   assert(slave.overruns == 0);
+   printf("clean: %u transactions, %lu bytes, %lu payload bytes\n",
+         stats->transactions, (unsigned long)stats->bytes,
+         (unsigned long)stats->payload_bytes);
+}
+
+static void test_noisy(void) {
+   unsigned int i;
+   uint8_t slave_id = 0;
+   uint8_t payload[SPI_FRAME_MAX_PAYLOAD];
+   const spi_link_stats_t * stats;
+   spi_slave_stats_t slave;
+
+   init();
+   stats = spi_link_stats(0);
+   srand(1);
+   noise_rate = 4;
+   for (i = 0; i < 2000; i++) {
+      if (spi_slave_can_send()) {
+         uint8_t len = 1 + (++slave_id % SPI_FRAME_MAX_PAYLOAD);
+         make_payload(payload, slave_id, len);
+         spi_slave_send(payload, len);
+      }
+      if (i % 3 == 0)
+         spi_link_send(0, payload, 2);
+      run_tick();
+      spi_slave_receive(payload);
+   }
+   noise_rate = 0;
+   spi_slave_stats(&slave);
+
+   //single bit errors are always caught, every transaction ends up as a good
+   //frame or an error on each side
+   assert(corrupted > 0);
+   assert(stats->crc_errors + stats->sync_errors > 0);
+   assert(stats->frames + stats->crc_errors + stats->sync_errors == stats->transactions);
+   assert(slave.crc_errors + slave.sync_errors > 0);
+   assert(slave.frames + slave.crc_errors + slave.sync_errors == stats->transactions);
+   //the sequence numbers account for every payload frame that was dropped
+   assert(master_got > 0);
+   assert(stats->lost == master_gaps);
+   //occasional errors don't take the slave offline
+   assert(spi_link_online(0));
+   printf("noisy: %u corrupted, %u crc errors, %u sync errors, %u lost\n",
+         corrupted, stats->crc_errors, stats->sync_errors, stats->lost);
+}
+
+static void test_multi(void) {
+   unsigned int i;
+   uint8_t slave_id = 0;
+   uint8_t payload[SPI_FRAME_MAX_PAYLOAD];
+   const spi_link_stats_t * busy;
+   const spi_link_stats_t * missing;
+
+   init();
+   assert(spi_link_add_slave(&master_PORTB, &master_DDRB, MISSING_SS) == 1);
+   assert(spi_link_num_slaves() == 2);
+   busy = spi_link_stats(0);
+   missing = spi_link_stats(1);
+
+   for (i = 0; i < 500; i++) {
+      if (spi_slave_can_send()) {
+         uint8_t len = 1 + (++slave_id % SPI_FRAME_MAX_PAYLOAD);
+         make_payload(payload, slave_id, len);
+         spi_slave_send(payload, len);
+      }
+      run_tick();
+   }
+
+   //the missing slave goes offline and only costs an idle poll now and then
+   assert(!spi_link_online(1));
+   assert(missing->frames == 0);
+   assert(missing->sync_errors == missing->transactions);
+   assert(missing->interval == SPI_LINK_POLL_MAX);
+   assert(missing->transactions <= 500 / SPI_LINK_POLL_MAX + SPI_LINK_OFFLINE_ERRORS);
+   //and the busy one is still polled every tick
+   assert(spi_link_online(0));
+   assert(busy->max_gap == SPI_LINK_POLL_MIN);
+   assert(busy->transactions >= 499);
+   assert(master_gaps == 0 && busy->lost == 0);
+   printf("multi: %u polls of the busy slave, %u of the missing one\n",
+         busy->transactions, missing->transactions);
+}
+
+int main(void) {
+   test_idle();
+   test_clean();
+   test_noisy();
+   test_multi();
+   printf("\n\nTEST PASSED!\n");
+   return 0;
+}
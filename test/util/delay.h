@@ -0,0 +1,7 @@
+#ifndef FAKE_UTIL_DELAY_H
+#define FAKE_UTIL_DELAY_H
+
+#define _delay_us(us)
+#define _delay_ms(ms)
+
+#endif
@@ -0,0 +1,139 @@
+//interrupt driven adc scanner for analog controls [pots, faders]
+
+#include "adc_scan.h"
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define ADC_SCAN_MUXMASK 0x0F
+//nothing reported yet, out of range of any value so the first always goes
+#define ADC_SCAN_UNREPORTED 0xFFFF
+
+static uint8_t channels[ADC_SCAN_MAX_CHANNELS];
+static uint8_t num_channels;
+
+//shared with the interrupt
+static volatile uint16_t values[ADC_SCAN_MAX_CHANNELS];
+//a bit per channel, set when the interrupt has a new value for it
+static volatile uint8_t fresh;
+//completed scans of the channel list, our clock for the holdoff
+static volatile uint8_t scans;
+
+//interrupt only
+static uint8_t current;
+static uint8_t samples;
+static uint16_t sum;
+
+//main loop only
+static uint16_t reported[ADC_SCAN_MAX_CHANNELS];
+static uint8_t reported_scan[ADC_SCAN_MAX_CHANNELS];
+static uint8_t next_check;
+
+ISR(ADC_vect) {
+   uint16_t sample = ADC;
+
+   //the first conversion after a mux switch is thrown away
+   if (samples++ != 0)
+      sum += sample;
+
+   if (samples > ADC_SCAN_OVERSAMPLE) {
+      values[current] = sum;
+      fresh |= _BV(current);
+      sum = 0;
+      samples = 0;
+      if (++current >= num_channels) {
+         current = 0;
+         scans++;
+      }
+      ADMUX = (ADMUX & ~ADC_SCAN_MUXMASK) | channels[current];
+   }
+
+   //start the next one
+   ADCSRA |= _BV(ADSC);
+}
+
+void adc_scan_init(const uint8_t * chans, uint8_t num_chans) {
+   uint8_t i;
+
+   if (num_chans > ADC_SCAN_MAX_CHANNELS)
+      num_chans = ADC_SCAN_MAX_CHANNELS;
+   if (num_chans == 0)
+      return;
+
+   for (i = 0; i < num_chans; i++) {
+      channels[i] = chans[i] & ADC_SCAN_MUXMASK;
+      reported[i] = ADC_SCAN_UNREPORTED;
+      reported_scan[i] = 0;
+      values[i] = 0;
+   }
+   num_channels = num_chans;
+   current = 0;
+   samples = 0;
+   sum = 0;
+   fresh = 0;
+   scans = 0;
+   next_check = 0;
+
+   PRR &= ~_BV(PRADC);
+   //avcc reference [REFS0 clear, on the tiny48 setting it picks the internal
+   //1.1V one and pots wired to vcc would read full scale], first channel
+   ADMUX = channels[0];
+   //enable, interrupt, clk/128 [125kHz at 16MHz], and start the first
+   //conversion, the interrupt keeps it going from here
+   ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+   ADCSRA |= _BV(ADSC);
+}
+
+bool adc_scan_get_change(uint8_t * index, uint16_t * value) {
+   uint8_t i;
+
+   //start where we left off so a busy channel can't hide the others
+   for (i = 0; i < num_channels; i++) {
+      uint8_t chan = next_check;
+      uint8_t mask = _BV(chan);
+      uint8_t now, sreg;
+      uint16_t val, diff;
+
+      if (++next_check >= num_channels)
+         next_check = 0;
+
+      if (!(fresh & mask))
+         continue;
+
+      sreg = SREG;
+      cli();
+      val = values[chan];
+      fresh &= ~mask;
+      now = scans;
+      SREG = sreg;
+
+      //rate limit, the channel will have a fresh value next scan anyway
+      if ((uint8_t)(now - reported_scan[chan]) < ADC_SCAN_HOLDOFF)
+         continue;
+
+      //snap to the ends so the deadband doesn't keep us from reaching them
+      if (val < ADC_SCAN_DEADBAND)
+         val = 0;
+      else if (val > ADC_SCAN_VALUE_MAX - ADC_SCAN_DEADBAND)
+         val = ADC_SCAN_VALUE_MAX;
+
+      diff = (val > reported[chan]) ? val - reported[chan] : reported[chan] - val;
+      if (diff < ADC_SCAN_DEADBAND)
+         continue;
+
+      reported[chan] = val;
+      reported_scan[chan] = now;
+      *index = chan;
+      *value = val;
+      return true;
+   }
+   return false;
+}
+
+uint16_t adc_scan_value(uint8_t index) {
+   uint16_t val;
+   uint8_t sreg = SREG;
+   cli();
+   val = values[index];
+   SREG = sreg;
+   return val;
+}
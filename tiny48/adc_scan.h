@@ -0,0 +1,43 @@
+//interrupt driven adc scanner for analog controls [pots, faders]
+//
+//the atmega32u2 has no adc, so analog controls are read by the tiny48.
+//
+//the adc interrupt walks a list of mux channels, for each channel it throws
+//away the first conversion after switching the mux [settling] and then sums
+//ADC_SCAN_OVERSAMPLE conversions.  16 10 bit samples sum to a 14 bit value,
+//which is what we hand out, so 7 bit users take the top 7 bits and 14 bit
+//users get it as is.  The main loop never waits on a conversion.
+//
+//adc_scan_get_change only reports a channel when its value has moved more
+//than ADC_SCAN_DEADBAND from the last value reported and at most once every
+//ADC_SCAN_HOLDOFF scans of the channel list, so a jittery pot doesn't flood
+//the 31.25k output.
+
+#ifndef ADC_SCAN_H
+#define ADC_SCAN_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define ADC_SCAN_MAX_CHANNELS 8
+//conversions summed per value, 16 10 bit conversions give 14 bits
+#define ADC_SCAN_OVERSAMPLE 16
+//how far [in 14 bit units] a value must move before we report it, this is
+//2 lsbs of the raw 10 bit conversion
+#define ADC_SCAN_DEADBAND 32
+//scans of the whole channel list between reports of a single channel
+#define ADC_SCAN_HOLDOFF 2
+
+#define ADC_SCAN_VALUE_MAX 0x3FFF
+
+//start scanning the given mux channels, the list is copied
+void adc_scan_init(const uint8_t * channels, uint8_t num_channels);
+
+//get the next channel whose value has changed, returns false if none has
+//index is the position of the channel in the list given to init
+bool adc_scan_get_change(uint8_t * index, uint16_t * value);
+
+//the latest filtered value of a channel
+uint16_t adc_scan_value(uint8_t index);
+
+#endif
@@ -0,0 +1,188 @@
+//the tiny48 end of the framed spi link to the 32u2
+
+#include "spi_link_slave.h"
+#include <stddef.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#define SPI_SLAVE_DDR DDRB
+#define SPI_SLAVE_PIN PINB
+#define SPI_SLAVE_SS PINB2
+#define SPI_SLAVE_MISO PINB4
+
+//outgoing frames, tx_active is shifted out while the other one is filled
+static uint8_t tx_frames[2][SPI_FRAME_MAX];
+static volatile uint8_t tx_active;
+//set by spi_slave_send once the other buffer is ready, cleared by the
+//interrupt when it swaps it in
+static volatile bool tx_pending;
+static volatile uint8_t tx_sequence;
+
+//interrupt only
+static uint8_t tx_length;
+static uint8_t tx_index;
+static uint8_t tx_next;
+static uint8_t rx_bytes[SPI_FRAME_MAX];
+static uint8_t rx_index;
+static uint8_t rx_sequence;
+static bool rx_synced;
+//the active buffer holds a payload rather than an empty frame
+static bool tx_payload;
+
+//a checked frame waiting for the main loop
+static uint8_t rx_frame[SPI_FRAME_MAX];
+static volatile bool rx_ready;
+
+static volatile spi_slave_stats_t stats;
+
+static inline uint8_t tx_byte(uint8_t index) {
+   return (index < tx_length) ? tx_frames[tx_active][index] : 0;
+}
+
+//start shifting out the active frame
+static void tx_load(void) {
+   tx_length = spi_frame_length(tx_frames[tx_active]);
+   tx_index = 0;
+   tx_next = tx_byte(1);
+   SPDR = tx_byte(0);
+}
+
+ISR(SPI_STC_vect) {
+   uint8_t b = SPDR;
+   //get the next byte in before the master clocks it
+   SPDR = tx_next;
+   tx_next = tx_byte(++tx_index + 1);
+
+   if (rx_index < SPI_FRAME_MAX)
+      rx_bytes[rx_index++] = b;
+}
+
+//take what the master sent at the end of a transaction
+static void spi_slave_take(void) {
+   uint8_t i, len;
+
+   stats.bytes += rx_index;
+   switch (spi_frame_check(rx_bytes, rx_index)) {
+      case SPI_FRAME_OK:
+         break;
+      case SPI_FRAME_BAD_CRC:
+         stats.crc_errors++;
+         return;
+      default:
+         stats.sync_errors++;
+         return;
+   }
+
+   stats.frames++;
+   len = rx_bytes[SPI_FRAME_LENGTH];
+   if (len == 0)
+      return;
+
+   if (rx_synced)
+      stats.lost += (uint8_t)(rx_bytes[SPI_FRAME_SEQUENCE] - rx_sequence - 1);
+   rx_sequence = rx_bytes[SPI_FRAME_SEQUENCE];
+   rx_synced = true;
+   stats.payloads++;
+
+   if (rx_ready) {
+      stats.overruns++;
+      return;
+   }
+   len += SPI_FRAME_OVERHEAD;
+   for (i = 0; i < len; i++)
+      rx_frame[i] = rx_bytes[i];
+   rx_ready = true;
+}
+
+//make the filled buffer the one going out
+static void tx_swap(void) {
+   tx_active ^= 1;
+   tx_pending = false;
+   tx_payload = true;
+   tx_load();
+}
+
+//slave select
+ISR(PCINT0_vect) {
+   if (!(SPI_SLAVE_PIN & _BV(SPI_SLAVE_SS))) {
+      //start of a transaction, if a payload came in since the last one we
+      //can still get it out in this one, the master gives us
+      //SPI_LINK_SELECT_US before it clocks
+      if (tx_pending && !tx_payload)
+         tx_swap();
+      return;
+   }
+
+   //end of a transaction
+   stats.transactions++;
+   spi_slave_take();
+   rx_index = 0;
+
+   //the master clocks until it has our whole frame, there are no retries
+   if (tx_payload) {
+      stats.sent++;
+      tx_payload = false;
+   }
+
+   if (tx_pending)
+      tx_swap();
+   else {
+      spi_frame_build(tx_frames[tx_active], tx_sequence, NULL, 0);
+      tx_load();
+   }
+}
+
+void spi_slave_init(void) {
+   tx_active = 0;
+   tx_pending = false;
+   tx_sequence = 0;
+   tx_payload = false;
+   rx_index = 0;
+   rx_synced = false;
+   rx_ready = false;
+   memset((void *)&stats, 0, sizeof(stats));
+
+   //MISO out, the rest in
+   SPI_SLAVE_DDR |= _BV(SPI_SLAVE_MISO);
+
+   //slave, interrupt driven
+   SPCR = _BV(SPIE) | _BV(SPE);
+   spi_frame_build(tx_frames[tx_active], tx_sequence, NULL, 0);
+   tx_load();
+
+   PCMSK0 |= _BV(PCINT2);
+   PCICR |= _BV(PCIE0);
+}
+
+bool spi_slave_can_send(void) {
+   return !tx_pending;
+}
+
+bool spi_slave_send(const uint8_t * payload, uint8_t len) {
+   if (tx_pending || len > SPI_FRAME_MAX_PAYLOAD)
+      return false;
+   //the interrupt doesn't touch the other buffer until tx_pending is set
+   spi_frame_build(tx_frames[tx_active ^ 1], ++tx_sequence, payload, len);
+   stats.queued++;
+   tx_pending = true;
+   return true;
+}
+
+uint8_t spi_slave_receive(uint8_t * payload) {
+   uint8_t i, len;
+   if (!rx_ready)
+      return 0;
+   len = rx_frame[SPI_FRAME_LENGTH];
+   for (i = 0; i < len; i++)
+      payload[i] = rx_frame[SPI_FRAME_PAYLOAD + i];
+   rx_ready = false;
+   return len;
+}
+
+void spi_slave_stats(spi_slave_stats_t * out) {
+   uint8_t sreg = SREG;
+   cli();
+   *out = *(spi_slave_stats_t *)&stats;
+   SREG = sreg;
+}
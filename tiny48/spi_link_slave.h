@@ -0,0 +1,59 @@
+//the tiny48 end of the framed spi link to the 32u2
+//
+//the tiny48 is the spi slave, the 32u2 polls it on a fixed schedule.  Each
+//transaction swaps one frame each way [see spilink/spi_frame.h].  Bytes go
+//in and out from the spi interrupt, the slave select pin change interrupt
+//marks the end of a transaction.
+//
+//outgoing frames are double buffered.  The interrupt shifts out the active
+//buffer while spi_slave_send fills the other one, at the end of a
+//transaction [or at the start of one, if the active buffer only holds an
+//empty frame] the filled buffer becomes the active one.  If nothing new was
+//sent the next transaction carries a frame with no payload.  A received
+//frame is held until spi_slave_receive takes it.
+
+#ifndef SPI_LINK_SLAVE_H
+#define SPI_LINK_SLAVE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include "spilink/spi_frame.h"
+
+typedef struct {
+   //transactions seen [slave select going high]
+   uint16_t transactions;
+   uint32_t bytes;
+   //good frames from the 32u2, and how many had a payload
+   uint16_t frames;
+   uint16_t payloads;
+   //frames with a payload we've handed to the interrupt, and how many of
+   //them have gone out
+   uint16_t queued;
+   uint16_t sent;
+   //bad frames from the 32u2
+   uint16_t sync_errors;
+   uint16_t crc_errors;
+   //payload frames missing going by the sequence numbers
+   uint16_t lost;
+   //frames that arrived before spi_slave_receive took the last one
+   uint16_t overruns;
+} spi_slave_stats_t;
+
+//set up the spi as slave and the slave select pin change interrupt
+void spi_slave_init(void);
+
+//queue a payload for the 32u2, returns false if the last one hasn't gone out
+//yet
+bool spi_slave_send(const uint8_t * payload, uint8_t len);
+
+//true if spi_slave_send would accept a payload
+bool spi_slave_can_send(void);
+
+//take the payload of a frame from the 32u2, returns its length or 0 if there
+//is nothing new.  payload must hold SPI_FRAME_MAX_PAYLOAD bytes
+uint8_t spi_slave_receive(uint8_t * payload);
+
+//the stats, copied out with interrupts off
+void spi_slave_stats(spi_slave_stats_t * out);
+
+#endif
@@ -30,10 +30,15 @@
 */
 
 #include "spislave.h"
+#include "adc_scan.h"
+#include "spi_link_slave.h"
+#include "spilink/expander_report.h"
+#include "debounce.h"
 #include <avr/io.h>
 #include <avr/wdt.h>
 #include <avr/power.h>
 #include <stdbool.h>
+#include <avr/interrupt.h>
 
 #include <LUFA/Version.h>
 #include <LUFA/Common/Common.h>
@@ -41,20 +46,106 @@
 
 #include <util/delay.h>
 
-#define DDR_SPI DDRB
-#define DD_MISO PINB4
+//we are an input expander for the 32u2.  Digital pins are sampled and
+//debounced from a 1kHz timer, analog inputs are scanned and filtered by
+//adc_scan, and when the 32u2 polls we send what has changed since the last
+//report [see spilink/expander_report.h].
+
+//the adc channels our analog controls are on, ADC0-5 [PC0-5] and ADC6/7
+//[PA0/PA1 on the tiny48]
+static const uint8_t analog_channels[EXPANDER_ANALOG_INS] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+//digital port 0 is all of PORTD, port 1 is PB0, PB1, PB7, PA2 and PA3 in
+//that bit order [bits 5-7 are always 0], all active low with pullups.
+//PA0/PA1 are ADC6/7, they're analog inputs only.
+#define DIGITAL_PORTB_MASK (_BV(PINB0) | _BV(PINB1) | _BV(PINB7))
+#define DIGITAL_PORTA_MASK (_BV(PINA2) | _BV(PINA3))
+
+//latest value of each analog input and which inputs have changed since they
+//were last sent to the 32u2, a bit per analog input and per digital port
+uint16_t analog_values[EXPANDER_ANALOG_INS];
+uint8_t analog_changed;
+uint8_t digital_changed;
+
+static inline uint8_t digital_port1(void) {
+	uint8_t b = PINB;
+	return (b & (_BV(PINB0) | _BV(PINB1))) | ((b >> (PINB7 - 2)) & _BV(2)) |
+		((PINA & DIGITAL_PORTA_MASK) << (3 - PINA2));
+}
+
+ISR(TIMER0_COMPA_vect) {
+	debounce_sample(0, ~PIND);
+	debounce_sample(1, ~digital_port1());
+}
+
+//report everything, when the 32u2 thinks it has missed something
+static void resync(void) {
+	uint8_t i;
+	for (i = 0; i < EXPANDER_ANALOG_INS; i++)
+		analog_values[i] = adc_scan_value(i);
+	analog_changed = 0xFF;
+	digital_changed = _BV(EXPANDER_DIGITAL_PORTS) - 1;
+}
+
+//fill a report with as many changes as fit, returns its length
+static uint8_t build_report(uint8_t * report) {
+	uint8_t len = 0;
+	uint8_t i;
+
+	for (i = 0; i < EXPANDER_DIGITAL_PORTS; i++) {
+		if (!(digital_changed & _BV(i)))
+			continue;
+		if (len + EXPANDER_DIGITAL_LENGTH > SPI_FRAME_MAX_PAYLOAD)
+			return len;
+		report[len++] = EXPANDER_DIGITAL | i;
+		report[len++] = debounce_state(i);
+		digital_changed &= ~_BV(i);
+	}
+
+	for (i = 0; i < EXPANDER_ANALOG_INS; i++) {
+		if (!(analog_changed & _BV(i)))
+			continue;
+		if (len + EXPANDER_ANALOG_LENGTH > SPI_FRAME_MAX_PAYLOAD)
+			return len;
+		report[len++] = EXPANDER_ANALOG | i;
+		report[len++] = (analog_values[i] >> 7) & 0x7F;
+		report[len++] = analog_values[i] & 0x7F;
+		analog_changed &= ~_BV(i);
+	}
+	return len;
+}
 
 int main(void)
 {
 	SetupHardware();
-	uint8_t cnt = 0;
+
+	//nothing to resync at boot, debounced pins and the first scan of each
+	//analog input report themselves as changes
+	sei();
 
 	while(1) {
-		SPDR = cnt++;
-		while(!(SPSR & (1<<SPIF))){
-			;
+		uint8_t index;
+		uint16_t value;
+		uint8_t i;
+		uint8_t buffer[SPI_FRAME_MAX_PAYLOAD];
+
+		if (spi_slave_receive(buffer) && buffer[0] == EXPANDER_CMD_RESYNC)
+			resync();
+
+		//collect changes, they go out the next time we can send
+		while (adc_scan_get_change(&index, &value)) {
+			analog_values[index] = value;
+			analog_changed |= _BV(index);
 		}
-		uint8_t tmp = SPDR;
+		for (i = 0; i < EXPANDER_DIGITAL_PORTS; i++) {
+			if (debounce_changes(i))
+				digital_changed |= _BV(i);
+		}
+
+		//the link double buffers, so we can fill the next report while the
+		//last one goes out
+		if ((analog_changed || digital_changed) && spi_slave_can_send())
+			spi_slave_send(buffer, build_report(buffer));
 	}
 
 }
@@ -71,12 +162,23 @@ void SetupHardware(void)
 
 	//set up slave
 	PRR &= ~(_BV(PRSPI));
-	/* Set MISO output, all others input */
-	DDR_SPI = _BV(DD_MISO);
-	//no pullups
-	PORTB = 0;
+	spi_slave_init();
 
-	/* Enable SPI */
-	SPCR = (1<<SPE);
-}
+	//digital inputs with pullups, none on the spi pins
+	DDRD = 0;
+	PORTD = 0xFF;
+	DDRB &= ~DIGITAL_PORTB_MASK;
+	PORTB = DIGITAL_PORTB_MASK;
+	DDRA &= ~DIGITAL_PORTA_MASK;
+	PORTA |= DIGITAL_PORTA_MASK;
 
+	//sample them at 1kHz, ctc with clk/64 and a top of 249
+	OCR0A = (F_CPU / 64 / 1000) - 1;
+	TCCR0A = _BV(CTC0) | _BV(CS01) | _BV(CS00);
+	TIMSK0 = _BV(OCIE0A);
+
+	//analog inputs, no digital input buffers on the adc pins [on the tiny48
+	//ADC6/7 have them too] and no pullups on PA0/PA1
+	DIDR0 = 0xFF;
+	adc_scan_init(analog_channels, EXPANDER_ANALOG_INS);
+}
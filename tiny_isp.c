@@ -0,0 +1,356 @@
+//in system programming of the tiny48 from the 32u2
+
+#include "tiny_isp.h"
+#include "sysex.h"
+#include "spi_link.h"
+#include "scheduler.h"
+#include <stdbool.h>
+#include <avr/io.h>
+#include <util/delay.h>
+#include <util/crc16.h>
+
+#define TINY_ISP_RESET_PORT PORTB
+#define TINY_ISP_RESET_DDR DDRB
+#define TINY_ISP_RESET_PIN PINB5
+
+//polled master at fck/128, 125kHz is slow enough for a tiny48 on any clock
+//down to its 1MHz default
+#define TINY_ISP_SPCR (_BV(SPE) | _BV(MSTR) | _BV(SPR1) | _BV(SPR0))
+
+//timing, in scheduler ticks
+#define TINY_ISP_RESET_MS 20
+#define TINY_ISP_ERASE_TIMEOUT 50
+#define TINY_ISP_WRITE_TIMEOUT 20
+//tries at programming enable, with a reset pulse between them
+#define TINY_ISP_SYNC_TRIES 8
+//bytes loaded or verified per run of the task, each is a 4 byte instruction
+#define TINY_ISP_SLICE 4
+
+//serial programming instructions
+#define ISP_PROG_ENABLE 0xAC
+#define ISP_PROG_ENABLE_ECHO 0x53
+#define ISP_CHIP_ERASE 0x80
+#define ISP_POLL_BUSY 0xF0
+#define ISP_READ_SIGNATURE 0x30
+#define ISP_LOAD_LOW 0x40
+#define ISP_LOAD_HIGH 0x48
+#define ISP_WRITE_PAGE 0x4C
+#define ISP_READ_LOW 0x20
+#define ISP_READ_HIGH 0x28
+
+typedef enum {
+   TINY_ISP_IDLE,
+   //waiting for the spi link to let go of the bus
+   TINY_ISP_SUSPEND,
+   //tiny48 in reset, getting it into programming mode
+   TINY_ISP_RESET,
+   TINY_ISP_ERASE,
+   TINY_ISP_RECEIVE,
+   TINY_ISP_VERIFY
+} tiny_isp_state_t;
+
+typedef enum {
+   TINY_ISP_PAGE_LOAD,
+   TINY_ISP_PAGE_WRITE
+} tiny_isp_page_state_t;
+
+static const uint8_t signature[3] = TINY_ISP_SIGNATURE;
+
+static tiny_isp_state_t state;
+static uint8_t started;
+static uint8_t tries;
+
+static uint16_t image_size;
+static uint16_t image_crc;
+//bytes taken from the host, and the page being loaded or the byte verified
+static uint16_t received;
+static uint16_t position;
+static bool ending;
+static bool busy_reported;
+
+//the last chunk from the host, it goes straight into the tiny48's own page
+//buffer so we don't keep a page here
+static uint8_t chunk[TINY_ISP_CHUNK_MAX];
+static uint8_t chunk_length;
+static uint8_t chunk_index;
+static tiny_isp_page_state_t page_state;
+static uint8_t page_index;
+static uint16_t crc;
+
+static void tiny_isp_status(uint8_t status) {
+   uint8_t data[3];
+   data[0] = status;
+   data[1] = received & 0x7F;
+   data[2] = (received >> 7) & 0x7F;
+   sysex_reply(SYSEX_CMD_TINY_STATUS, data, 3);
+}
+
+static uint8_t isp_transfer(uint8_t b) {
+   SPDR = b;
+   while (!(SPSR & _BV(SPIF)))
+      ;
+   return SPDR;
+}
+
+//send an instruction, returns the last byte we got back
+static uint8_t isp_command(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3) {
+   isp_transfer(b0);
+   isp_transfer(b1);
+   isp_transfer(b2);
+   return isp_transfer(b3);
+}
+
+static bool isp_busy(void) {
+   return isp_command(ISP_POLL_BUSY, 0, 0, 0) & 0x01;
+}
+
+static bool isp_enable(void) {
+   uint8_t echo;
+   isp_transfer(ISP_PROG_ENABLE);
+   isp_transfer(ISP_PROG_ENABLE_ECHO);
+   echo = isp_transfer(0);
+   isp_transfer(0);
+   return echo == ISP_PROG_ENABLE_ECHO;
+}
+
+//let the tiny48 go and give the bus back to the link
+static void tiny_isp_finish(uint8_t status) {
+   TINY_ISP_RESET_PORT |= _BV(TINY_ISP_RESET_PIN);
+   spi_link_resume();
+   state = TINY_ISP_IDLE;
+   tiny_isp_status(status);
+}
+
+static void tiny_isp_begin(const uint8_t * data, uint8_t length) {
+   uint32_t size;
+
+   if (state != TINY_ISP_IDLE) {
+      tiny_isp_status(TINY_ISP_ERR_STATE);
+      return;
+   }
+   received = 0;
+   if (length != 6) {
+      tiny_isp_status(TINY_ISP_ERR_SIZE);
+      return;
+   }
+   size = data[0] | ((uint32_t)data[1] << 7) | ((uint32_t)data[2] << 14);
+   if (size == 0 || size > TINY_ISP_FLASH_SIZE) {
+      tiny_isp_status(TINY_ISP_ERR_SIZE);
+      return;
+   }
+
+   image_size = size;
+   image_crc = data[3] | ((uint16_t)data[4] << 7) | ((uint16_t)data[5] << 14);
+   position = 0;
+   ending = false;
+   busy_reported = false;
+   chunk_length = chunk_index = 0;
+   page_index = 0;
+   page_state = TINY_ISP_PAGE_LOAD;
+   state = TINY_ISP_SUSPEND;
+}
+
+static void tiny_isp_data(const uint8_t * data, uint8_t length) {
+   uint8_t n;
+   uint16_t offset;
+
+   if (state != TINY_ISP_RECEIVE || ending) {
+      tiny_isp_status(TINY_ISP_ERR_STATE);
+      return;
+   }
+   if (length < 2 || SYSEX_PACKED_LENGTH(TINY_ISP_CHUNK_MAX) < length - 2) {
+      tiny_isp_status(TINY_ISP_ERR_SIZE);
+      return;
+   }
+   offset = data[0] | ((uint16_t)data[1] << 7);
+   if (offset != received) {
+      //a chunk went missing or came twice, the host can start again from
+      //the offset we send back
+      tiny_isp_status(TINY_ISP_ERR_OFFSET);
+      return;
+   }
+   if (chunk_length) {
+      busy_reported = true;
+      tiny_isp_status(TINY_ISP_BUSY);
+      return;
+   }
+   n = sysex_unpack(data + 2, length - 2, chunk);
+   if (received + n > image_size) {
+      tiny_isp_status(TINY_ISP_ERR_SIZE);
+      return;
+   }
+
+   chunk_length = n;
+   chunk_index = 0;
+   received += n;
+   tiny_isp_status(TINY_ISP_OK);
+}
+
+static void tiny_isp_end(void) {
+   if (state != TINY_ISP_RECEIVE || ending) {
+      tiny_isp_status(TINY_ISP_ERR_STATE);
+      return;
+   }
+   if (received != image_size) {
+      tiny_isp_status(TINY_ISP_ERR_SIZE);
+      return;
+   }
+   ending = true;
+}
+
+void tiny_isp_command(uint8_t command, const uint8_t * data, uint8_t length) {
+   switch (command) {
+      case SYSEX_CMD_TINY_BEGIN:
+         tiny_isp_begin(data, length);
+         break;
+      case SYSEX_CMD_TINY_DATA:
+         tiny_isp_data(data, length);
+         break;
+      case SYSEX_CMD_TINY_END:
+         tiny_isp_end();
+         break;
+      case SYSEX_CMD_TINY_ABORT:
+         if (state == TINY_ISP_SUSPEND) {
+            //we haven't touched the tiny48 yet
+            state = TINY_ISP_IDLE;
+            tiny_isp_status(TINY_ISP_ERR_ABORTED);
+         } else if (state != TINY_ISP_IDLE)
+            tiny_isp_finish(TINY_ISP_ERR_ABORTED);
+         break;
+      default:
+         break;
+   }
+}
+
+//get the tiny48 into programming mode, check it is what we think it is and
+//erase it
+static void tiny_isp_reset(uint8_t now) {
+   uint8_t i;
+
+   if ((uint8_t)(now - started) < TINY_ISP_RESET_MS)
+      return;
+   started = now;
+
+   if (!isp_enable()) {
+      if (++tries >= TINY_ISP_SYNC_TRIES) {
+         tiny_isp_finish(TINY_ISP_ERR_SYNC);
+         return;
+      }
+      //out of sync, a positive pulse on reset and try again
+      TINY_ISP_RESET_PORT |= _BV(TINY_ISP_RESET_PIN);
+      _delay_us(10);
+      TINY_ISP_RESET_PORT &= ~_BV(TINY_ISP_RESET_PIN);
+      return;
+   }
+
+   for (i = 0; i < sizeof(signature); i++) {
+      if (isp_command(ISP_READ_SIGNATURE, 0, i, 0) != signature[i]) {
+         tiny_isp_finish(TINY_ISP_ERR_SIGNATURE);
+         return;
+      }
+   }
+
+   isp_command(ISP_PROG_ENABLE, ISP_CHIP_ERASE, 0, 0);
+   state = TINY_ISP_ERASE;
+}
+
+//load the chunk into the tiny48's page buffer and write each page as it fills
+static void tiny_isp_page(uint8_t now) {
+   uint8_t i, b;
+
+   switch (page_state) {
+      case TINY_ISP_PAGE_LOAD:
+         for (i = 0; i < TINY_ISP_SLICE && page_index < TINY_ISP_PAGE_SIZE; i++) {
+            if (chunk_index < chunk_length)
+               b = chunk[chunk_index++];
+            else if (ending && page_index)
+               //pad out the last page with erased flash
+               b = 0xFF;
+            else
+               break;
+            isp_command((page_index & 1) ? ISP_LOAD_HIGH : ISP_LOAD_LOW, 0,
+                  page_index >> 1, b);
+            page_index++;
+         }
+         if (chunk_length && chunk_index == chunk_length) {
+            chunk_length = 0;
+            //the host is waiting to send a chunk we had no room for
+            if (busy_reported) {
+               busy_reported = false;
+               tiny_isp_status(TINY_ISP_OK);
+            }
+         }
+         if (page_index == TINY_ISP_PAGE_SIZE) {
+            //the write page instruction takes a word address
+            uint16_t word = position >> 1;
+            isp_command(ISP_WRITE_PAGE, word >> 8, word & 0xFF, 0);
+            started = now;
+            page_state = TINY_ISP_PAGE_WRITE;
+         } else if (ending && page_index == 0 && chunk_length == 0) {
+            position = 0;
+            crc = 0;
+            state = TINY_ISP_VERIFY;
+         }
+         break;
+      case TINY_ISP_PAGE_WRITE:
+         if (isp_busy()) {
+            if ((uint8_t)(now - started) > TINY_ISP_WRITE_TIMEOUT)
+               tiny_isp_finish(TINY_ISP_ERR_TIMEOUT);
+            return;
+         }
+         position += TINY_ISP_PAGE_SIZE;
+         page_index = 0;
+         page_state = TINY_ISP_PAGE_LOAD;
+         break;
+   }
+}
+
+//read the image back and check its crc
+static void tiny_isp_verify(void) {
+   uint8_t i;
+   for (i = 0; i < TINY_ISP_SLICE && position < image_size; i++, position++) {
+      uint8_t b = isp_command((position & 1) ? ISP_READ_HIGH : ISP_READ_LOW,
+            position >> 9, (position >> 1) & 0xFF, 0);
+      crc = _crc16_update(crc, b);
+   }
+   if (position == image_size)
+      tiny_isp_finish((crc == image_crc) ? TINY_ISP_DONE : TINY_ISP_ERR_VERIFY);
+}
+
+void tiny_isp_task(void) {
+   uint8_t now = sched_now();
+
+   switch (state) {
+      case TINY_ISP_IDLE:
+         break;
+      case TINY_ISP_SUSPEND:
+         if (!spi_link_suspend())
+            break;
+         SPCR = TINY_ISP_SPCR;
+         //hold the tiny48 in reset, SCK is low with the spi idle
+         TINY_ISP_RESET_PORT &= ~_BV(TINY_ISP_RESET_PIN);
+         TINY_ISP_RESET_DDR |= _BV(TINY_ISP_RESET_PIN);
+         started = now;
+         tries = 0;
+         state = TINY_ISP_RESET;
+         break;
+      case TINY_ISP_RESET:
+         tiny_isp_reset(now);
+         break;
+      case TINY_ISP_ERASE:
+         if (isp_busy()) {
+            if ((uint8_t)(now - started) > TINY_ISP_ERASE_TIMEOUT)
+               tiny_isp_finish(TINY_ISP_ERR_TIMEOUT);
+            break;
+         }
+         state = TINY_ISP_RECEIVE;
+         tiny_isp_status(TINY_ISP_READY);
+         break;
+      case TINY_ISP_RECEIVE:
+         tiny_isp_page(now);
+         break;
+      case TINY_ISP_VERIFY:
+         tiny_isp_verify();
+         break;
+   }
+}
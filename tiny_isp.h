@@ -0,0 +1,65 @@
+//in system programming of the tiny48 from the 32u2
+//
+//the tiny48's spi pins are its programming pins and we drive its reset, so
+//we can rewrite its flash without a programmer.  A new image comes in over
+//sysex and tiny_isp_task programs it a few bytes per run so the main loop
+//keeps going.  The spi link is suspended and the tiny48 held in reset for
+//the duration.
+//
+//each chunk of the image is loaded straight into the tiny48's own page
+//buffer, which is written to flash as it fills, so we only hold one chunk.
+//Once all of it is written the flash is read back and its crc-16 [avr-libc's
+//_crc16_update, starting from 0] is checked against the one given at the
+//start.  Then the tiny48 is let out of reset.
+//
+//sysex commands [data bytes]:
+//SYSEX_CMD_TINY_BEGIN size[3] crc[3]
+//   image size in bytes and its crc, 7 bits per byte, least significant
+//   first.  We reset the tiny48, check its signature and erase it, then reply
+//   TINY_ISP_READY.
+//SYSEX_CMD_TINY_DATA offset[2] data...
+//   up to TINY_ISP_CHUNK_MAX bytes of the image, 7 bit packed [see sysex.h],
+//   in order.  Replies TINY_ISP_OK once taken.  TINY_ISP_BUSY means the
+//   last chunk isn't loaded yet, send it again after the next TINY_ISP_OK.
+//SYSEX_CMD_TINY_END
+//   write what is left and verify, replies TINY_ISP_DONE or an error.
+//SYSEX_CMD_TINY_ABORT
+//   stop and let the tiny48 run [what is left of] its program.
+//
+//every reply is SYSEX_CMD_TINY_STATUS status offset[2], offset being how
+//many bytes of the image we have taken.  Errors end the update.
+
+#ifndef TINY_ISP_H
+#define TINY_ISP_H
+
+#include <inttypes.h>
+
+//attiny48
+#define TINY_ISP_FLASH_SIZE 4096
+#define TINY_ISP_PAGE_SIZE 64
+#define TINY_ISP_SIGNATURE {0x1E, 0x92, 0x09}
+
+//most image bytes in one data command, what fits in the sysex buffer
+#define TINY_ISP_CHUNK_MAX 24
+
+//status replies
+#define TINY_ISP_OK 0x00
+#define TINY_ISP_READY 0x01
+#define TINY_ISP_BUSY 0x02
+#define TINY_ISP_DONE 0x03
+#define TINY_ISP_ERR_STATE 0x10
+#define TINY_ISP_ERR_SIZE 0x11
+#define TINY_ISP_ERR_OFFSET 0x12
+#define TINY_ISP_ERR_SYNC 0x13
+#define TINY_ISP_ERR_SIGNATURE 0x14
+#define TINY_ISP_ERR_TIMEOUT 0x15
+#define TINY_ISP_ERR_VERIFY 0x16
+#define TINY_ISP_ERR_ABORTED 0x17
+
+//handle one of the SYSEX_CMD_TINY_* commands
+void tiny_isp_command(uint8_t command, const uint8_t * data, uint8_t length);
+
+//do the programming, run it on every pass of the main loop
+void tiny_isp_task(void);
+
+#endif
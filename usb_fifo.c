@@ -0,0 +1,133 @@
+//non-blocking transmit fifo for the usb midi IN endpoint
+
+#include "usb_fifo.h"
+#include "avr-midi/midi.h"
+#include "avr-midi/ring.h"
+
+#if (USB_FIFO_LENGTH & (USB_FIFO_LENGTH - 1)) || (USB_FIFO_LENGTH > 128)
+#error "USB_FIFO_LENGTH must be a power of 2 no larger than 128"
+#endif
+
+RING_DEFINE(usb_fifo_ring, MIDI_EventPacket_t, uint8_t, USB_FIFO_LENGTH)
+
+static usb_fifo_ring_t fifo;
+static uint16_t fifo_dropped;
+static usb_fifo_policy_t fifo_policy;
+static usb_fifo_keep_func_t fifo_keep;
+
+static void usb_fifo_count_drop(void) {
+   if (fifo_dropped != 0xFFFF)
+      fifo_dropped++;
+}
+
+//controls where every value counts and can't stand in for the one before:
+//bank select, data entry and the [n]rpn numbers
+static bool usb_fifo_keep_all(uint8_t num) {
+   switch (num) {
+      case 0:
+      case 6:
+      case 32:
+      case 38:
+         return true;
+      default:
+         return num >= 96 && num <= 101;
+   }
+}
+
+//look for a queued cc with the same status and number as the given packet,
+//if we find one it is stale, take it out and return true
+static bool usb_fifo_coalesce(const MIDI_EventPacket_t * packet) {
+   uint8_t i;
+   if ((packet->Data1 & 0xF0) != MIDI_CC || usb_fifo_keep_all(packet->Data2) ||
+         (fifo_keep && fifo_keep(packet->Data1, packet->Data2)))
+      return false;
+   for (i = 0; i < usb_fifo_ring_length(&fifo); i++) {
+      MIDI_EventPacket_t * queued = usb_fifo_ring_peek(&fifo, i);
+      if (queued->Data1 == packet->Data1 && queued->Data2 == packet->Data2 &&
+            queued->CableNumber == packet->CableNumber) {
+         //move the ones before it up a place and drop the oldest, so the
+         //rest keep their order and the new value goes in behind them
+         for (; i > 0; i--)
+            *usb_fifo_ring_peek(&fifo, i) = *usb_fifo_ring_peek(&fifo, i - 1);
+         usb_fifo_ring_pop(&fifo, NULL);
+         return true;
+      }
+   }
+   return false;
+}
+
+void usb_fifo_init(usb_fifo_policy_t policy) {
+   usb_fifo_ring_init(&fifo);
+   fifo_dropped = 0;
+   fifo_policy = policy;
+   fifo_keep = NULL;
+}
+
+void usb_fifo_set_keep_func(usb_fifo_keep_func_t keep) {
+   fifo_keep = keep;
+}
+
+void usb_fifo_set_policy(usb_fifo_policy_t policy) {
+   fifo_policy = policy;
+}
+
+bool usb_fifo_push(const MIDI_EventPacket_t * packet) {
+   bool ok = true;
+
+   //with no host to read them, packets would only pile up and go out as a
+   //burst of stale values on enumeration, and the fifo would look full to
+   //everyone checking its length.  Throw them away, and whatever is left
+   //from before the host went away.
+   if (USB_DeviceState != DEVICE_STATE_Configured) {
+      usb_fifo_ring_init(&fifo);
+      return true;
+   }
+
+   if (!usb_fifo_ring_space(&fifo)) {
+      //a coalesced cc isn't a drop, the host just never sees the stale value
+      if (fifo_policy == USB_FIFO_COALESCE_CC && usb_fifo_coalesce(packet)) {
+         usb_fifo_ring_push(&fifo, packet);
+         return true;
+      }
+      usb_fifo_count_drop();
+      ok = false;
+      if (fifo_policy == USB_FIFO_DROP_NEWEST)
+         return false;
+      //drop the oldest
+      usb_fifo_ring_pop(&fifo, NULL);
+   }
+
+   usb_fifo_ring_push(&fifo, packet);
+   return ok;
+}
+
+void usb_fifo_service(USB_ClassInfo_MIDI_Device_t * interface) {
+   if (!usb_fifo_ring_length(&fifo) || USB_DeviceState != DEVICE_STATE_Configured)
+      return;
+
+   Endpoint_SelectEndpoint(interface->Config.DataINEndpointNumber);
+
+   //the host hasn't taken the last bank yet, try again next time around
+   if (!Endpoint_IsINReady())
+      return;
+
+   //fill the bank with as many packets as it will hold
+   while (usb_fifo_ring_length(&fifo) && Endpoint_IsReadWriteAllowed()) {
+      const uint8_t * bytes = (const uint8_t *)usb_fifo_ring_peek(&fifo, 0);
+      uint8_t i;
+      for (i = 0; i < sizeof(MIDI_EventPacket_t); i++)
+         Endpoint_Write_Byte(bytes[i]);
+      usb_fifo_ring_pop(&fifo, NULL);
+   }
+
+   //send it off, we don't wait for the host to pick it up
+   Endpoint_ClearIN();
+}
+
+uint8_t usb_fifo_length(void) {
+   return usb_fifo_ring_length(&fifo);
+}
+
+uint16_t usb_fifo_dropped(void) {
+   return fifo_dropped;
+}
@@ -0,0 +1,58 @@
+//non-blocking transmit fifo for the usb midi IN endpoint
+//
+//midi_send_usb used to write straight into the endpoint and flush, which
+//waits on the host.  If the host stops reading [DAW paused, port closed] that
+//stalls the whole main loop.  Instead we queue event packets here and the
+//main loop moves them into the endpoint whenever there is room.
+//
+//the fifo is only touched from the main loop, it is not interrupt safe.
+
+#ifndef USB_FIFO_H
+#define USB_FIFO_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <LUFA/Drivers/USB/Class/MIDI.h>
+
+//number of event packets we can hold, must be a power of 2
+#ifndef USB_FIFO_LENGTH
+#define USB_FIFO_LENGTH 32
+#endif
+
+//what to do when a packet is pushed into a full fifo
+typedef enum {
+   //throw away the oldest queued packet to make room
+   USB_FIFO_DROP_OLDEST,
+   //throw away the packet being pushed
+   USB_FIFO_DROP_NEWEST,
+   //when full, a cc takes the place of a queued cc with the same channel and
+   //number: that one is dropped and the new one queued behind the rest.
+   //Otherwise we drop the oldest.  Bank select, data entry and the [n]rpn
+   //numbers are never merged, nor what the keep func asks for.
+   USB_FIFO_COALESCE_CC
+} usb_fifo_policy_t;
+
+void usb_fifo_init(usb_fifo_policy_t policy);
+void usb_fifo_set_policy(usb_fifo_policy_t policy);
+//with USB_FIFO_COALESCE_CC, returns true for a cc [status with channel and
+//number] that must not be merged, say one where each value is a relative
+//change.  NULL for none, which is what init sets.
+typedef bool (* usb_fifo_keep_func_t)(uint8_t status, uint8_t num);
+void usb_fifo_set_keep_func(usb_fifo_keep_func_t keep);
+
+//queue a packet, never blocks
+//returns false if a packet had to be dropped to make this call
+//while usb isn't configured, the packet and anything still queued is thrown
+//away instead [that isn't counted as a drop]
+bool usb_fifo_push(const MIDI_EventPacket_t * packet);
+
+//move as many queued packets into the IN endpoint as the free bank will
+//take and send them off, never waits for the host
+void usb_fifo_service(USB_ClassInfo_MIDI_Device_t * interface);
+
+//number of packets waiting to go out
+uint8_t usb_fifo_length(void);
+//number of packets dropped since init [saturates]
+uint16_t usb_fifo_dropped(void);
+
+#endif